@@ -1,5 +1,5 @@
 APP_NAME="hellogz"
-ADDITIONAL_SOURCES="src/decode_gz.c src/inflate.c"
+ADDITIONAL_SOURCES="src/decode_gz.c src/inflate.c src/crc32.c"
 
 echo "Building $APP_NAME... (this shell script must be run from the app's root directory"
 
@@ -0,0 +1,297 @@
+#include "adler32.h"
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+/*
+Spec (RFC 1950):
+"s1 is the sum of all bytes, s2 is the sum of all the values of s1. Both sums
+are done modulo 65521. s1 is initialized to 1, s2 to zero. The Adler-32
+checksum is stored as s2*65536 + s1"
+*/
+#define ADLER32_MODULO 65521
+
+/*
+The largest amount of bytes n such that 255n(n+1)/2 + (n+1)(MODULO-1) still
+fits in 32 bits. We can keep adding up that many bytes before we need to
+apply the (slow) modulo
+*/
+#define ADLER32_NMAX 5552
+
+#if !defined(ADLER32_SCALAR_ONLY) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__GNUC__)
+#define ADLER32_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+static uint32_t adler32_scalar(
+    const uint32_t adler,
+    uint8_t const * data,
+    uint64_t size)
+{
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    
+    while (size > 0) {
+        uint32_t chunk = size < ADLER32_NMAX ? (uint32_t)size : ADLER32_NMAX;
+        size -= chunk;
+        
+        while (chunk >= 8) {
+            s1 += data[0]; s2 += s1;
+            s1 += data[1]; s2 += s1;
+            s1 += data[2]; s2 += s1;
+            s1 += data[3]; s2 += s1;
+            s1 += data[4]; s2 += s1;
+            s1 += data[5]; s2 += s1;
+            s1 += data[6]; s2 += s1;
+            s1 += data[7]; s2 += s1;
+            data += 8;
+            chunk -= 8;
+        }
+        
+        while (chunk > 0) {
+            s1 += *data++;
+            s2 += s1;
+            chunk--;
+        }
+        
+        s1 %= ADLER32_MODULO;
+        s2 %= ADLER32_MODULO;
+    }
+    
+    return (s2 << 16) | s1;
+}
+
+#ifdef ADLER32_X86_KERNELS
+/*
+The vector kernels below work on chunks of L bytes d[0..L-1] at a time,
+using the closed form of what the scalar loop does:
+
+s1' = s1 + sum(d[i])
+s2' = s2 + L * s1 + sum((L - i) * d[i])
+
+For the 2nd sum we split (L - i) into a per-vector part (how many whole
+vectors come after the byte, times the vector width) and a per-byte weight
+inside the vector (width .. 1). The per-vector part is what v_s2 collects:
+before adding each vector's byte sum to v_s1, we add v_s1 (the sum of all
+previous vectors) to v_s2. The per-byte part is a multiply-add with the
+weights.
+
+The lanes are 32 bits wide, so we stay below ADLER32_NMAX bytes per chunk,
+and do the final combination in 64 bits.
+*/
+#define ADLER32_SIMD_CHUNK_SIZE (ADLER32_NMAX & ~31)
+
+static uint64_t adler32_sum_lanes(
+    uint32_t const * lanes,
+    const uint32_t lanes_size)
+{
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < lanes_size; i++) {
+        sum += lanes[i];
+    }
+    return sum;
+}
+
+__attribute__((target("ssse3")))
+static uint32_t adler32_ssse3(
+    const uint32_t adler,
+    uint8_t const * data,
+    uint64_t size)
+{
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    
+    const __m128i weights = _mm_setr_epi8(
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+    
+    while (size >= 16) {
+        uint64_t chunk =
+            size < ADLER32_SIMD_CHUNK_SIZE ?
+                (size & ~(uint64_t)15) :
+                ADLER32_SIMD_CHUNK_SIZE;
+        size -= chunk;
+        
+        __m128i v_s1 = zero;
+        __m128i v_s2 = zero;
+        __m128i v_products = zero;
+        
+        for (uint64_t i = 0; i < chunk; i += 16) {
+            __m128i bytes = _mm_loadu_si128((__m128i const *)(data + i));
+            v_s2 = _mm_add_epi32(v_s2, v_s1);
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes, zero));
+            v_products = _mm_add_epi32(
+                v_products,
+                _mm_madd_epi16(_mm_maddubs_epi16(bytes, weights), ones));
+        }
+        data += chunk;
+        
+        uint32_t lanes_s1[4];
+        uint32_t lanes_s2[4];
+        uint32_t lanes_products[4];
+        _mm_storeu_si128((__m128i *)lanes_s1, v_s1);
+        _mm_storeu_si128((__m128i *)lanes_s2, v_s2);
+        _mm_storeu_si128((__m128i *)lanes_products, v_products);
+        
+        uint64_t new_s2 =
+            (uint64_t)s2 +
+            (uint64_t)s1 * chunk +
+            16 * adler32_sum_lanes(lanes_s2, 4) +
+            adler32_sum_lanes(lanes_products, 4);
+        uint64_t new_s1 = s1 + adler32_sum_lanes(lanes_s1, 4);
+        
+        s1 = (uint32_t)(new_s1 % ADLER32_MODULO);
+        s2 = (uint32_t)(new_s2 % ADLER32_MODULO);
+    }
+    
+    return adler32_scalar((s2 << 16) | s1, data, size);
+}
+
+__attribute__((target("avx2")))
+static uint32_t adler32_avx2(
+    const uint32_t adler,
+    uint8_t const * data,
+    uint64_t size)
+{
+    uint32_t s1 = adler & 0xffff;
+    uint32_t s2 = adler >> 16;
+    
+    const __m256i weights = _mm256_setr_epi8(
+        32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i zero = _mm256_setzero_si256();
+    
+    while (size >= 32) {
+        uint64_t chunk =
+            size < ADLER32_SIMD_CHUNK_SIZE ?
+                (size & ~(uint64_t)31) :
+                ADLER32_SIMD_CHUNK_SIZE;
+        size -= chunk;
+        
+        __m256i v_s1 = zero;
+        __m256i v_s2 = zero;
+        __m256i v_products = zero;
+        
+        for (uint64_t i = 0; i < chunk; i += 32) {
+            __m256i bytes =
+                _mm256_loadu_si256((__m256i const *)(data + i));
+            v_s2 = _mm256_add_epi32(v_s2, v_s1);
+            v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes, zero));
+            v_products = _mm256_add_epi32(
+                v_products,
+                _mm256_madd_epi16(
+                    _mm256_maddubs_epi16(bytes, weights),
+                    ones));
+        }
+        data += chunk;
+        
+        uint32_t lanes_s1[8];
+        uint32_t lanes_s2[8];
+        uint32_t lanes_products[8];
+        _mm256_storeu_si256((__m256i *)lanes_s1, v_s1);
+        _mm256_storeu_si256((__m256i *)lanes_s2, v_s2);
+        _mm256_storeu_si256((__m256i *)lanes_products, v_products);
+        
+        uint64_t new_s2 =
+            (uint64_t)s2 +
+            (uint64_t)s1 * chunk +
+            32 * adler32_sum_lanes(lanes_s2, 8) +
+            adler32_sum_lanes(lanes_products, 8);
+        uint64_t new_s1 = s1 + adler32_sum_lanes(lanes_s1, 8);
+        
+        s1 = (uint32_t)(new_s1 % ADLER32_MODULO);
+        s2 = (uint32_t)(new_s2 % ADLER32_MODULO);
+    }
+    
+    // the leftover (< 32 bytes) may still hold 1 whole 16-byte vector
+    return adler32_ssse3((s2 << 16) | s1, data, size);
+}
+#endif // ADLER32_X86_KERNELS
+
+/*
+Picked on the first call to adler32_update(). Several threads can make their
+first call at the same time, and they'd all pick the same kernel, so each of
+them just stores its pick. The stores and loads are atomic, so nobody ever
+sees a half written pointer.
+
+Without GCC / clang atomics we can't do that, and the first call to
+adler32_update() has to happen before you start any other threads.
+*/
+static uint32_t (* adler32_kernel)(
+    const uint32_t adler,
+    uint8_t const * data,
+    uint64_t size) = NULL;
+
+static uint32_t (* adler32_pick_kernel(void))(
+    const uint32_t adler,
+    uint8_t const * data,
+    uint64_t size)
+{
+    #ifdef ADLER32_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return adler32_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        return adler32_ssse3;
+    }
+    #endif
+    
+    return adler32_scalar;
+}
+
+uint32_t adler32_update(
+    const uint32_t adler,
+    uint8_t const * data,
+    const uint64_t size)
+{
+    #ifdef __GNUC__
+    uint32_t (* kernel)(
+        const uint32_t adler,
+        uint8_t const * data,
+        uint64_t size) =
+            __atomic_load_n(&adler32_kernel, __ATOMIC_RELAXED);
+    if (kernel == NULL) {
+        kernel = adler32_pick_kernel();
+        __atomic_store_n(&adler32_kernel, kernel, __ATOMIC_RELAXED);
+    }
+    #else
+    if (adler32_kernel == NULL) {
+        adler32_kernel = adler32_pick_kernel();
+    }
+    uint32_t (* kernel)(
+        const uint32_t adler,
+        uint8_t const * data,
+        uint64_t size) = adler32_kernel;
+    #endif
+    
+    return kernel(adler, data, size);
+}
+
+/*
+s1 of the whole is s1 of both minus the 1 they both started from, and s2
+of the whole adds s1 of the first part once for every byte of the second
+(RFC 1950, and zlib's adler32_combine())
+*/
+uint32_t adler32_combine(
+    const uint32_t adler_1,
+    const uint32_t adler_2,
+    const uint64_t size_2)
+{
+    uint64_t remainder = size_2 % ADLER32_MODULO;
+    uint64_t s1_1 = adler_1 & 0xffff;
+    uint64_t s2_1 = adler_1 >> 16;
+    uint64_t s1_2 = adler_2 & 0xffff;
+    uint64_t s2_2 = adler_2 >> 16;
+    
+    uint64_t s1 = (s1_1 + s1_2 + ADLER32_MODULO - 1) % ADLER32_MODULO;
+    uint64_t s2 =
+        (remainder * s1_1 + s2_1 + s2_2 + ADLER32_MODULO - remainder) %
+            ADLER32_MODULO;
+    
+    return (uint32_t)(s1 | (s2 << 16));
+}
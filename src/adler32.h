@@ -0,0 +1,58 @@
+#ifndef ADLER32_H
+#define ADLER32_H
+
+/*
+Adler-32 is the checksum at the end of every 'zlib' stream (so also at the
+end of the IDAT data in a .png file). It's computed over the decompressed
+data, so checking it tells you if inflate() produced the right output.
+
+We have SSSE3 and AVX2 versions, and pick the best one your CPU supports the
+first time you call adler32_update(). Everything else falls back to plain C.
+With GCC or clang, any number of threads can call it at the same time,
+including the first time.
+*/
+
+// #define ADLER32_SCALAR_ONLY // never use SSSE3 / AVX2 kernels
+
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the value to start with before you checksum anything
+#define ADLER32_INITIAL_VALUE 1
+
+/*
+Update a running Adler-32 checksum with the bytes data[0..size-1]
+
+You can call this on the whole buffer at once, or on each piece of output
+right after you decompressed it (while it's still in the cache), for example
+on every chunk from inflate_stream_feed() or inflate_to_sink(). Both give the
+same result.
+
+** Example:
+** uint32_t adler = ADLER32_INITIAL_VALUE;
+** adler = adler32_update(adler, chunk_1, chunk_1_size);
+** adler = adler32_update(adler, chunk_2, chunk_2_size);
+*/
+uint32_t adler32_update(
+    const uint32_t adler,
+    uint8_t const * data,
+    const uint64_t size);
+
+/*
+The Adler-32 of 2 pieces of data one after the other, from the Adler-32 of
+each piece and the size of the second one. Several threads can each checksum
+a piece of a big buffer, and this joins the results.
+*/
+uint32_t adler32_combine(
+    const uint32_t adler_1,
+    const uint32_t adler_2,
+    const uint64_t size_2);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ADLER32_H
@@ -0,0 +1,372 @@
+#include "crc32.h"
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+// the CRC-32 polynomial 0x04C11DB7, bit reversed
+#define CRC32_POLYNOMIAL 0xedb88320
+
+#if !defined(CRC32_SCALAR_ONLY) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__GNUC__)
+#define CRC32_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/*
+crc32_tables[0] is the classic table of CRCs of all 8-bit messages that the
+PNG spec generates with a snippet of C code.
+
+crc32_tables[k][n] is the CRC of byte n followed by k zero bytes. That lets
+us look up 16 bytes independently and xor the results together, instead of
+waiting for each byte's lookup before we can do the next one
+("slicing-by-16").
+*/
+#define CRC32_SLICES 16
+static uint32_t crc32_tables[CRC32_SLICES][256];
+
+static void crc32_build_tables(void)
+{
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (uint32_t k = 0; k < 8; k++) {
+            c = (c & 1) ? (CRC32_POLYNOMIAL ^ (c >> 1)) : (c >> 1);
+        }
+        crc32_tables[0][n] = c;
+    }
+    
+    for (uint32_t slice = 1; slice < CRC32_SLICES; slice++) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t previous = crc32_tables[slice - 1][n];
+            crc32_tables[slice][n] =
+                (previous >> 8) ^ crc32_tables[0][previous & 0xff];
+        }
+    }
+}
+
+static uint32_t crc32_load_u32_little_endian(
+    uint8_t const * from)
+{
+    return
+        ((uint32_t)from[0]) |
+        ((uint32_t)from[1] << 8) |
+        ((uint32_t)from[2] << 16) |
+        ((uint32_t)from[3] << 24);
+}
+
+/*
+The kernels take and return the 'raw' running CRC, which is the
+complement of the checksum we hand out
+*/
+static uint32_t crc32_slice_by_16(
+    uint32_t crc,
+    uint8_t const * data,
+    uint64_t size)
+{
+    while (size >= 16) {
+        uint32_t word_0 = crc ^ crc32_load_u32_little_endian(data);
+        uint32_t word_1 = crc32_load_u32_little_endian(data + 4);
+        uint32_t word_2 = crc32_load_u32_little_endian(data + 8);
+        uint32_t word_3 = crc32_load_u32_little_endian(data + 12);
+        
+        crc =
+            crc32_tables[15][word_0 & 0xff] ^
+            crc32_tables[14][(word_0 >> 8) & 0xff] ^
+            crc32_tables[13][(word_0 >> 16) & 0xff] ^
+            crc32_tables[12][word_0 >> 24] ^
+            crc32_tables[11][word_1 & 0xff] ^
+            crc32_tables[10][(word_1 >> 8) & 0xff] ^
+            crc32_tables[9][(word_1 >> 16) & 0xff] ^
+            crc32_tables[8][word_1 >> 24] ^
+            crc32_tables[7][word_2 & 0xff] ^
+            crc32_tables[6][(word_2 >> 8) & 0xff] ^
+            crc32_tables[5][(word_2 >> 16) & 0xff] ^
+            crc32_tables[4][word_2 >> 24] ^
+            crc32_tables[3][word_3 & 0xff] ^
+            crc32_tables[2][(word_3 >> 8) & 0xff] ^
+            crc32_tables[1][(word_3 >> 16) & 0xff] ^
+            crc32_tables[0][word_3 >> 24];
+        
+        data += 16;
+        size -= 16;
+    }
+    
+    // slicing-by-8 for the rest, with the first 8 of the same tables
+    if (size >= 8) {
+        uint32_t word_0 = crc ^ crc32_load_u32_little_endian(data);
+        uint32_t word_1 = crc32_load_u32_little_endian(data + 4);
+        
+        crc =
+            crc32_tables[7][word_0 & 0xff] ^
+            crc32_tables[6][(word_0 >> 8) & 0xff] ^
+            crc32_tables[5][(word_0 >> 16) & 0xff] ^
+            crc32_tables[4][word_0 >> 24] ^
+            crc32_tables[3][word_1 & 0xff] ^
+            crc32_tables[2][(word_1 >> 8) & 0xff] ^
+            crc32_tables[1][(word_1 >> 16) & 0xff] ^
+            crc32_tables[0][word_1 >> 24];
+        
+        data += 8;
+        size -= 8;
+    }
+    
+    while (size > 0) {
+        crc = crc32_tables[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+        data++;
+        size--;
+    }
+    
+    return crc;
+}
+
+#ifdef CRC32_X86_KERNELS
+/*
+Carry-less multiplication lets us treat 128 bits of data as a polynomial and
+multiply it by x^n mod P in 1 instruction, which 'moves' it n bits further
+down the message. We keep 4 such 128-bit accumulators and fold each of them
+over the next 64 bytes, then fold them into each other, and finally do a
+Barrett reduction down to 32 bits.
+
+The constants are x^n mod P for the distances we fold over (bit reflected,
+like the rest of this CRC), see Intel's paper "Fast CRC Computation for
+Generic Polynomials Using PCLMULQDQ Instruction".
+
+size must be at least 64 and a multiple of 16
+*/
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold_pclmul(
+    uint32_t crc,
+    uint8_t const * data,
+    uint64_t size)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i low_32_bits = _mm_setr_epi32(~0, 0, ~0, 0);
+    
+    __m128i x1 = _mm_loadu_si128((__m128i const *)(data + 0x00));
+    __m128i x2 = _mm_loadu_si128((__m128i const *)(data + 0x10));
+    __m128i x3 = _mm_loadu_si128((__m128i const *)(data + 0x20));
+    __m128i x4 = _mm_loadu_si128((__m128i const *)(data + 0x30));
+    __m128i x5;
+    
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    data += 64;
+    size -= 64;
+    
+    // fold 4 x 128 bits in parallel
+    while (size >= 64) {
+        __m128i x6 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x0 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x6),
+            _mm_loadu_si128((__m128i const *)(data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x7),
+            _mm_loadu_si128((__m128i const *)(data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x8),
+            _mm_loadu_si128((__m128i const *)(data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x0),
+            _mm_loadu_si128((__m128i const *)(data + 0x30)));
+        
+        data += 64;
+        size -= 64;
+    }
+    
+    // fold the 4 accumulators into 1
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+    
+    // fold the remaining 16 byte blocks, if any
+    while (size >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(
+            _mm_xor_si128(x1, _mm_loadu_si128((__m128i const *)data)),
+            x5);
+        
+        data += 16;
+        size -= 16;
+    }
+    
+    // 128 bits -> 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, low_32_bits);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    
+    // Barrett reduction, 64 bits -> 32 bits
+    x2 = _mm_and_si128(x1, low_32_bits);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, low_32_bits);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_pclmul(
+    uint32_t crc,
+    uint8_t const * data,
+    uint64_t size)
+{
+    if (size >= 64) {
+        uint64_t folded_size = size & ~(uint64_t)15;
+        crc = crc32_fold_pclmul(crc, data, folded_size);
+        data += folded_size;
+        size -= folded_size;
+    }
+    
+    return crc32_slice_by_16(crc, data, size);
+}
+#endif // CRC32_X86_KERNELS
+
+/*
+Picked on the first call to crc32_update(), after the tables are built.
+
+Several threads can make their first call at the same time, so the setup
+goes through crc32_state: the 1 thread that moves it from NOT_READY to
+BUILDING builds the tables and picks the kernel, and everyone else waits
+until it says READY. The release store / acquire load pair makes sure the
+tables and crc32_kernel are visible to a thread before it sees READY.
+
+Without GCC / clang atomics we can't do that, and the first call to
+crc32_update() has to happen before you start any other threads.
+*/
+#define CRC32_NOT_READY 0
+#define CRC32_BUILDING 1
+#define CRC32_READY 2
+
+static uint32_t crc32_state = CRC32_NOT_READY;
+
+static uint32_t (* crc32_kernel)(
+    uint32_t crc,
+    uint8_t const * data,
+    uint64_t size) = NULL;
+
+static void crc32_build_tables_and_pick_kernel(void)
+{
+    crc32_build_tables();
+    
+    #ifdef CRC32_X86_KERNELS
+    __builtin_cpu_init();
+    if (
+        __builtin_cpu_supports("pclmul") &&
+        __builtin_cpu_supports("sse4.1"))
+    {
+        crc32_kernel = crc32_pclmul;
+    } else {
+        crc32_kernel = crc32_slice_by_16;
+    }
+    #else
+    crc32_kernel = crc32_slice_by_16;
+    #endif
+}
+
+static void crc32_set_up_once(void)
+{
+    #ifdef __GNUC__
+    uint32_t expected = CRC32_NOT_READY;
+    if (
+        __atomic_compare_exchange_n(
+            /* ptr: */ &crc32_state,
+            /* expected: */ &expected,
+            /* desired: */ CRC32_BUILDING,
+            /* weak: */ 0,
+            /* success_memorder: */ __ATOMIC_ACQUIRE,
+            /* failure_memorder: */ __ATOMIC_ACQUIRE))
+    {
+        crc32_build_tables_and_pick_kernel();
+        __atomic_store_n(&crc32_state, CRC32_READY, __ATOMIC_RELEASE);
+    } else {
+        // building the tables only takes a few microseconds
+        while (
+            __atomic_load_n(&crc32_state, __ATOMIC_ACQUIRE) != CRC32_READY)
+        {
+        }
+    }
+    #else
+    crc32_build_tables_and_pick_kernel();
+    crc32_state = CRC32_READY;
+    #endif
+}
+
+uint32_t crc32_update(
+    const uint32_t crc,
+    uint8_t const * data,
+    const uint64_t size)
+{
+    #ifdef __GNUC__
+    if (__atomic_load_n(&crc32_state, __ATOMIC_ACQUIRE) != CRC32_READY) {
+        crc32_set_up_once();
+    }
+    #else
+    if (crc32_state != CRC32_READY) {
+        crc32_set_up_once();
+    }
+    #endif
+    
+    return ~crc32_kernel(~crc, data, size);
+}
+
+/*
+Multiply 2 polynomials modulo the CRC polynomial, in the same bit reversed
+order the CRCs themselves use (the top bit is x^0)
+*/
+static uint32_t crc32_multiply_modulo(
+    uint32_t a,
+    uint32_t b)
+{
+    uint32_t product = 0;
+    for (uint32_t i = 0; i < 32; i++) {
+        if (a & 0x80000000u) {
+            product ^= b;
+        }
+        a <<= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32_POLYNOMIAL : b >> 1;
+    }
+    
+    return product;
+}
+
+/*
+Appending n zero bytes to a message multiplies its CRC by x^(8n) modulo
+the polynomial, so that's what we compute, by squaring: x^8, x^16, x^32...
+*/
+uint32_t crc32_combine(
+    const uint32_t crc_1,
+    const uint32_t crc_2,
+    const uint64_t size_2)
+{
+    uint32_t power = 0x00800000u; // x^8
+    uint32_t shift = 0x80000000u; // x^0
+    
+    for (uint64_t bits = size_2; bits > 0; bits >>= 1) {
+        if (bits & 1) {
+            shift = crc32_multiply_modulo(shift, power);
+        }
+        power = crc32_multiply_modulo(power, power);
+    }
+    
+    return crc32_multiply_modulo(shift, crc_1) ^ crc_2;
+}
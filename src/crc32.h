@@ -0,0 +1,58 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+/*
+CRC-32 is the checksum used by every chunk of a .png file, and at the end of
+every member of a .gz file. Both use the same polynomial, so this module is
+shared by decode_png.c and decode_gz.c.
+
+There's a table based version that handles 16 (or 8) bytes per step, and a
+version that folds 64 bytes at a time with carry-less multiplication
+(PCLMULQDQ). The first call to crc32_update() checks your CPU and picks the
+fastest one that it supports. With GCC or clang, any number of threads can
+call it at the same time, including the first time.
+*/
+
+// #define CRC32_SCALAR_ONLY // never use the PCLMULQDQ kernel
+
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// the value to start with before you checksum anything
+#define CRC32_INITIAL_VALUE 0
+
+/*
+Update a running CRC-32 with the bytes data[0..size-1]
+
+The result is the finished checksum (the spec's pre- and post- conditioning
+with 0xffffffff is done for you), and you can pass it back in to continue
+with more bytes.
+
+** Example:
+** uint32_t crc = CRC32_INITIAL_VALUE;
+** crc = crc32_update(crc, chunk_type, 4);
+** crc = crc32_update(crc, chunk_data, chunk_data_size);
+*/
+uint32_t crc32_update(
+    const uint32_t crc,
+    uint8_t const * data,
+    const uint64_t size);
+
+/*
+The CRC-32 of 2 pieces of data one after the other, from the CRC-32 of each
+piece and the size of the second one. Several threads can each checksum a
+piece of a big buffer, and this joins the results.
+*/
+uint32_t crc32_combine(
+    const uint32_t crc_1,
+    const uint32_t crc_2,
+    const uint64_t size_2);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CRC32_H
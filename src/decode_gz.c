@@ -1,18 +1,35 @@
 #include "decode_gz.h"
 
+#ifndef DECODE_GZ_IGNORE_CRC_CHECKS
+#include "crc32.h"
+#endif
+
 static void * (* malloc_func)(size_t __size) = NULL;
+static void * (* realloc_func)(void * to_grow, size_t new_size) = NULL;
+static void (* free_func)(void * to_free) = NULL;
+static InflateContext * inflate_context = NULL;
 
 void init_decode_gz(
     void * (* malloc_funcptr)
         (size_t __size),
+    void * (* realloc_funcptr)
+        (void * to_grow, size_t new_size),
+    void (* free_funcptr)
+        (void * to_free),
     void * (* arg_memset_func)
         (void *str, int c, size_t n),
     void * (* arg_memcpy_func)
         (void * dest, const void * src, size_t n))
 {
     malloc_func = malloc_funcptr;
+    realloc_func = realloc_funcptr;
+    free_func = free_funcptr;
     
-    inflate_init(malloc_funcptr, arg_memset_func, arg_memcpy_func);
+    inflate_context = inflate_context_create(
+        malloc_funcptr,
+        free_funcptr,
+        arg_memset_func,
+        arg_memcpy_func);
 }
 
 #ifndef true
@@ -113,6 +130,9 @@ DecodedData * decode_gz(
     }
     DecodedData * return_value =
         (DecodedData *)malloc_func(sizeof(DecodedData));
+    return_value->data = NULL;
+    return_value->data_size = 0;
+    return_value->good = false;
     
     if (compressed_bytes == NULL) {
         return_value->good = false;
@@ -241,23 +261,59 @@ DecodedData * decode_gz(
         compressed_bytes_left - 8);
     #endif
     
-    // TODO: figure out how much memory to assign in advance
-    uint32_t guess_decompressed_size = (compressed_bytes_left * 35) + 1000000;
+    if (compressed_bytes_left < sizeof(GZFooter)) {
+        #ifndef DECODE_GZ_SILENCE
+        printf("data stream too tiny to contain a footer\n");
+        #endif
+        return return_value;
+    }
+    uint32_t deflate_size = compressed_bytes_left - sizeof(GZFooter);
     
-    uint8_t * recipient = (uint8_t *)malloc_func(guess_decompressed_size);
+    /*
+    The footer's ISIZE is the decompressed size modulo 2^32, so it's almost
+    always exactly right, and we start with a recipient of that size. It
+    could be wrong for huge or corrupt files, but then inflate_growable()
+    simply grows the recipient. We don't trust it beyond the most that
+    DEFLATE could ever decompress to (1032:1), so a broken footer can't make
+    us allocate gigabytes up front.
+    */
+    GZFooter const * footer_peek =
+        (GZFooter const *)(compressed_bytes + deflate_size);
+    uint64_t initial_capacity = footer_peek->ISIZE;
+    if (initial_capacity > (uint64_t)deflate_size * 1032) {
+        initial_capacity = (uint64_t)deflate_size * 1032;
+    }
+    if (initial_capacity < 1) {
+        initial_capacity = 1;
+    }
+    
+    uint8_t * recipient = (uint8_t *)malloc_func(initial_capacity);
+    uint64_t recipient_capacity = initial_capacity;
     uint64_t recipient_size = 0;
+    if (recipient == NULL) {
+        return return_value;
+    }
     
-    uint64_t temp_working_memory_size = 50000000;
+    // only the lookup tables, the same small size for any file
+    uint64_t temp_working_memory_size = inflate_working_memory_required();
     uint8_t * temp_working_memory = (uint8_t *)malloc_func(
         temp_working_memory_size);
+    if (temp_working_memory == NULL) {
+        free_func(recipient);
+        return return_value;
+    }
     
     uint32_t inflate_good = false;
     
-    inflate(
-        /* uint8_t const * recipient: */
-            recipient,
-        /* const uint64_t recipient_size: */
-            guess_decompressed_size,
+    inflate_growable(
+        /* InflateContext * context: */
+            inflate_context,
+        /* realloc_funcptr: */
+            realloc_func,
+        /* uint8_t ** recipient: */
+            &recipient,
+        /* uint64_t * recipient_capacity: */
+            &recipient_capacity,
         /* uint64_t * final_recipient_size: */
             &recipient_size,
         /* uint8_t const * temp_working_memory: */
@@ -267,17 +323,26 @@ DecodedData * decode_gz(
         /* uint8_t const * compressed_input: */
             compressed_bytes,
         /* const uint64_t compressed_input_size: */
-            compressed_bytes_left - 8,
+            deflate_size,
         /* uint32_t * out_good: */
             &inflate_good);
+    
+    free_func(temp_working_memory);
    
     #ifndef DECODE_GZ_SILENCE 
     printf("\ninflate algorithm returned: %u\n", inflate_good);
     #endif
     if (!inflate_good) {
+        free_func(recipient);
         return return_value;
     }
     
+    // skip the DEFLATE data, the footer is in the last 8 bytes
+    consume_bytes(
+        /* buffer: */ &compressed_bytes,
+        /* buffer_size: */ &compressed_bytes_left,
+        /* amount_to_consume: */ compressed_bytes_left - sizeof(GZFooter));
+    
     GZFooter * gzip_footer = consume_struct(
         /* type: */ GZFooter,
         /* buffer: */ &compressed_bytes,
@@ -294,13 +359,120 @@ DecodedData * decode_gz(
     printf("end of gz file...\n");
     #endif
     
-    (void)gzip_footer;
+    /*
+    ISIZE is the size of the original input data modulo 2^32, and CRC32 is
+    the CRC-32 of the uncompressed data. Both are stored LSB first.
+    */
+    if (gzip_footer->ISIZE != (uint32_t)recipient_size) {
+        #ifndef DECODE_GZ_SILENCE
+        printf(
+            "ERROR: decompressed %llu bytes, but the footer's ISIZE says "
+            "%u\n",
+            recipient_size,
+            gzip_footer->ISIZE);
+        #endif
+        free_func(recipient);
+        return return_value;
+    }
+    
+    #ifndef DECODE_GZ_IGNORE_CRC_CHECKS
+    uint32_t actual_crc = crc32_update(
+        /* crc: */ CRC32_INITIAL_VALUE,
+        /* data: */ recipient,
+        /* size: */ recipient_size);
+    if (actual_crc != gzip_footer->CRC32) {
+        #ifndef DECODE_GZ_SILENCE
+        printf(
+            "ERROR: CRC32 checksum mismatch - the footer says %u but the "
+            "decompressed data has %u. gz file is corrupted?\n",
+            gzip_footer->CRC32,
+            actual_crc);
+        #endif
+        free_func(recipient);
+        return return_value;
+    }
+    #endif
     
     return_value->data = (char *)recipient;
+    return_value->data_size = (uint32_t)recipient_size;
     return_value->good = true;
     
     return return_value;
 }
 
+uint32_t decode_gz_deflate_data(
+    uint8_t const * compressed_bytes,
+    const uint64_t compressed_bytes_size,
+    uint8_t const ** deflate_data,
+    uint64_t * deflate_data_size)
+{
+    *deflate_data = NULL;
+    *deflate_data_size = 0;
+    
+    // the smallest header, and the footer
+    if (
+        compressed_bytes == NULL ||
+        compressed_bytes_size < sizeof(GZHeader) + sizeof(GZFooter))
+    {
+        return false;
+    }
+    
+    GZHeader const * gzip_header = (GZHeader const *)compressed_bytes;
+    if (
+        gzip_header->id1 != 31 ||
+        gzip_header->id2 != 139 ||
+        gzip_header->CM != 8)
+    {
+        #ifndef DECODE_GZ_SILENCE
+        printf("decode_gz_deflate_data() - not a gzip file with DEFLATE\n");
+        #endif
+        return false;
+    }
+    
+    uint64_t at = sizeof(GZHeader);
+    uint64_t end = compressed_bytes_size - sizeof(GZFooter);
+    
+    // FEXTRA: a 2 byte size (LSB first), then that many bytes
+    if (gzip_header->FLG >> 2 & 1) {
+        if (end - at < 2) {
+            return false;
+        }
+        uint64_t XLEN =
+            (uint64_t)compressed_bytes[at] |
+            ((uint64_t)compressed_bytes[at + 1] << 8);
+        at += 2;
+        if (end - at < XLEN) {
+            return false;
+        }
+        at += XLEN;
+    }
+    
+    // FNAME, then FCOMMENT: zero-terminated strings
+    for (uint32_t flag_bit = 3; flag_bit <= 4; flag_bit++) {
+        if (gzip_header->FLG >> flag_bit & 1) {
+            while (at < end && compressed_bytes[at] != 0) {
+                at++;
+            }
+            if (at >= end) {
+                return false;
+            }
+            at++;
+        }
+    }
+    
+    // FHCRC: a 2 byte CRC of the header
+    if (gzip_header->FLG >> 1 & 1) {
+        if (end - at < 2) {
+            return false;
+        }
+        at += 2;
+    }
+    
+    *deflate_data = compressed_bytes + at;
+    *deflate_data_size = end - at;
+    
+    return true;
+}
+
 #undef true
 #undef false
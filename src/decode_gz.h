@@ -9,6 +9,8 @@ This is the API for decoding a gzip (.gz) file.
 #include "assert.h"
 #endif
 
+// #define DECODE_GZ_IGNORE_CRC_CHECKS
+
 // #define DECODE_GZ_SILENCE
 #ifndef DECODE_GZ_SILENCE
 #include "stdio.h"
@@ -28,6 +30,8 @@ typedef struct DecodedData {
 
 void init_decode_gz(
     void * (* malloc_funcptr)(size_t __size),
+    void * (* realloc_funcptr)(void * to_grow, size_t new_size),
+    void (* free_funcptr)(void * to_free),
     void * (* arg_memset_func)
         (void *str, int c, size_t n),
     void * (* arg_memcpy_func)
@@ -37,5 +41,20 @@ DecodedData * decode_gz(
     uint8_t * compressed_bytes,
     uint32_t compressed_bytes_size);
 
+/*
+Find the raw DEFLATE data inside a .gz file, without decompressing anything.
+This is what you'd pass to inflate_index_build() and inflate_index_read() to
+read ranges from the middle of a big .gz file.
+
+Only the first member of the file is found, and the footer isn't checked.
+
+returns 1 on success, 0 if this is not a (complete) gzip header
+*/
+uint32_t decode_gz_deflate_data(
+    uint8_t const * compressed_bytes,
+    const uint64_t compressed_bytes_size,
+    uint8_t const ** deflate_data,
+    uint64_t * deflate_data_size);
+
 #endif
 
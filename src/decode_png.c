@@ -8,329 +8,21 @@
 #include "assert.h"
 #endif
 
+#ifndef DECODE_PNG_IGNORE_ADLER32_CHECKS
+#include "adler32.h"
+#endif
+
 #ifndef NULL
 #define NULL 0
 #endif
 
-// 5mb                        5...000
-#define INFLATE_HASHMAPS_SIZE 3000000
-
 /*
 PNG files include CRC 'cyclic redundancy checks', a kind
 of checksum to make sure each block is valid data.
+The CRC-32 code is shared with decode_gz.c, see crc32.h
 */
 #ifndef DECODE_PNG_IGNORE_CRC_CHECKS
-/*
-Table of CRCs of all 8-bit messages.
-
-The table itself is not found in the spec, but the spec
-has a snippet of C code that generates it
-*/
-static unsigned long crc_table[256] = {
-    0,
-    1996959894,
-    3993919788,
-    2567524794,
-    124634137,
-    1886057615,
-    3915621685,
-    2657392035,
-    249268274,
-    2044508324,
-    3772115230,
-    2547177864,
-    162941995,
-    2125561021,
-    3887607047,
-    2428444049,
-    498536548,
-    1789927666,
-    4089016648,
-    2227061214,
-    450548861,
-    1843258603,
-    4107580753,
-    2211677639,
-    325883990,
-    1684777152,
-    4251122042,
-    2321926636,
-    335633487,
-    1661365465,
-    4195302755,
-    2366115317,
-    997073096,
-    1281953886,
-    3579855332,
-    2724688242,
-    1006888145,
-    1258607687,
-    3524101629,
-    2768942443,
-    901097722,
-    1119000684,
-    3686517206,
-    2898065728,
-    853044451,
-    1172266101,
-    3705015759,
-    2882616665,
-    651767980,
-    1373503546,
-    3369554304,
-    3218104598,
-    565507253,
-    1454621731,
-    3485111705,
-    3099436303,
-    671266974,
-    1594198024,
-    3322730930,
-    2970347812,
-    795835527,
-    1483230225,
-    3244367275,
-    3060149565,
-    1994146192,
-    31158534,
-    2563907772,
-    4023717930,
-    1907459465,
-    112637215,
-    2680153253,
-    3904427059,
-    2013776290,
-    251722036,
-    2517215374,
-    3775830040,
-    2137656763,
-    141376813,
-    2439277719,
-    3865271297,
-    1802195444,
-    476864866,
-    2238001368,
-    4066508878,
-    1812370925,
-    453092731,
-    2181625025,
-    4111451223,
-    1706088902,
-    314042704,
-    2344532202,
-    4240017532,
-    1658658271,
-    366619977,
-    2362670323,
-    4224994405,
-    1303535960,
-    984961486,
-    2747007092,
-    3569037538,
-    1256170817,
-    1037604311,
-    2765210733,
-    3554079995,
-    1131014506,
-    879679996,
-    2909243462,
-    3663771856,
-    1141124467,
-    855842277,
-    2852801631,
-    3708648649,
-    1342533948,
-    654459306,
-    3188396048,
-    3373015174,
-    1466479909,
-    544179635,
-    3110523913,
-    3462522015,
-    1591671054,
-    702138776,
-    2966460450,
-    3352799412,
-    1504918807,
-    783551873,
-    3082640443,
-    3233442989,
-    3988292384,
-    2596254646,
-    62317068,
-    1957810842,
-    3939845945,
-    2647816111,
-    81470997,
-    1943803523,
-    3814918930,
-    2489596804,
-    225274430,
-    2053790376,
-    3826175755,
-    2466906013,
-    167816743,
-    2097651377,
-    4027552580,
-    2265490386,
-    503444072,
-    1762050814,
-    4150417245,
-    2154129355,
-    426522225,
-    1852507879,
-    4275313526,
-    2312317920,
-    282753626,
-    1742555852,
-    4189708143,
-    2394877945,
-    397917763,
-    1622183637,
-    3604390888,
-    2714866558,
-    953729732,
-    1340076626,
-    3518719985,
-    2797360999,
-    1068828381,
-    1219638859,
-    3624741850,
-    2936675148,
-    906185462,
-    1090812512,
-    3747672003,
-    2825379669,
-    829329135,
-    1181335161,
-    3412177804,
-    3160834842,
-    628085408,
-    1382605366,
-    3423369109,
-    3138078467,
-    570562233,
-    1426400815,
-    3317316542,
-    2998733608,
-    733239954,
-    1555261956,
-    3268935591,
-    3050360625,
-    752459403,
-    1541320221,
-    2607071920,
-    3965973030,
-    1969922972,
-    40735498,
-    2617837225,
-    3943577151,
-    1913087877,
-    83908371,
-    2512341634,
-    3803740692,
-    2075208622,
-    213261112,
-    2463272603,
-    3855990285,
-    2094854071,
-    198958881,
-    2262029012,
-    4057260610,
-    1759359992,
-    534414190,
-    2176718541,
-    4139329115,
-    1873836001,
-    414664567,
-    2282248934,
-    4279200368,
-    1711684554,
-    285281116,
-    2405801727,
-    4167216745,
-    1634467795,
-    376229701,
-    2685067896,
-    3608007406,
-    1308918612,
-    956543938,
-    2808555105,
-    3495958263,
-    1231636301,
-    1047427035,
-    2932959818,
-    3654703836,
-    1088359270,
-    936918000,
-    2847714899,
-    3736837829,
-    1202900863,
-    817233897,
-    3183342108,
-    3401237130,
-    1404277552,
-    615818150,
-    3134207493,
-    3453421203,
-    1423857449,
-    601450431,
-    3009837614,
-    3294710456,
-    1567103746,
-    711928724,
-    3020668471,
-    3272380065,
-    1510334235,
-    755167117
-};
-
-#ifndef DECODE_PNG_IGNORE_ASSERTS
-static void assert_crc_table_accurate(void)
-{
-    unsigned long c;
-    int n, k;
-    
-    for (n = 0; n < 256; n++) {
-        c = (unsigned long) n;
-        for (k = 0; k < 8; k++) {
-            if (c & 1)
-                c = 0xedb88320L ^ (c >> 1);
-            else
-                c = c >> 1;
-        }
-        assert(crc_table[n] == c);
-    }
-}
-#endif
-
-/*
-Update a running CRC with the bytes buf[0..len-1]--the CRC
-should be initialized to all 1's, and the transmitted value
-is the 1's complement of the final running CRC (see the
-crc() routine below).
-*/
-static unsigned long update_crc(
-    const unsigned long crc,
-    const unsigned char * buf,
-    const uint32_t len)
-{
-    #ifndef DECODE_PNG_IGNORE_ASSERTS
-    assert(buf != NULL);
-    assert(len > 0);
-    #endif
-    
-    unsigned long c = crc;
-    
-    for (uint32_t n = 0; n < len; n++) {
-        #ifndef DECODE_PNG_IGNORE_ASSERTS
-        assert(((c ^ buf[n]) & 0xff) < 256);
-        #endif
-        c = crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
-    }
-    
-    return c;
-}
+#include "crc32.h"
 #endif // DECODE_PNG_IGNORE_CRC_CHECKS
 
 /*
@@ -549,6 +241,7 @@ typedef struct {
 
 typedef struct {
     Palette palette;
+    InflateContext * inflate_context;
     uint8_t * dpng_working_memory;
     void * (* malloc)(uint64_t __size);
     void (* free)(void *);
@@ -592,15 +285,11 @@ decode_png_init(
         return;
     }
     
-    inflate_init(
+    states[thread_id]->inflate_context = inflate_context_create(
         arg_malloc_funcptr,
+        arg_free_funcptr,
         arg_memset_funcptr,
-        arg_memcpy_funcptr,
-        thread_id);
-    
-    #ifndef DECODE_PNG_IGNORE_ASSERTS
-    assert_crc_table_accurate();
-    #endif
+        arg_memcpy_funcptr);
     
     states[thread_id]->dpng_working_memory_size = arg_dpng_working_memory_size;
     states[thread_id]->dpng_working_memory =
@@ -612,6 +301,7 @@ void decode_png_deinit(const uint32_t thread_id)
 {
     states[thread_id]->already_initialized = 0;
     
+    inflate_context_destroy(states[thread_id]->inflate_context);
     states[thread_id]->free(states[thread_id]->dpng_working_memory);
     states[thread_id]->free(states[thread_id]);
     states[thread_id] = NULL;
@@ -763,7 +453,7 @@ void decode_png(
         #endif
         
         #ifndef DECODE_PNG_IGNORE_CRC_CHECKS
-        unsigned long running_crc = 0xffffffffL;
+        uint32_t running_crc = CRC32_INITIAL_VALUE;
         #endif
         
         PNGChunkHeader chunk_header = *(PNGChunkHeader *)compressed_input;
@@ -787,17 +477,21 @@ void decode_png(
                 (void *)decoded_stream_start);
             printf(
                 "inflate hashmap memory will start at: %p\n",
-                (void *)(states[thread_id]->dpng_working_memory + estimated_decoded_stream_size));
+                (void *)(decoded_stream_start + estimated_decoded_stream_size));
             #endif
             
             #ifndef DECODE_PNG_IGNORE_ASSERTS
-            assert(states[thread_id]->dpng_working_memory_size - estimated_decoded_stream_size >
-                INFLATE_HASHMAPS_SIZE);
+            assert(states[thread_id]->dpng_working_memory_size >=
+                sizeof(Palette) +
+                estimated_decoded_stream_size +
+                inflate_working_memory_required());
             assert(headerless_compressed_data_stream_size > 4);
             #endif
             
             uint32_t inflate_result = 0;
             inflate(
+                /* context: */
+                    states[thread_id]->inflate_context,
                 /* recipient: */
                     decoded_stream_start,
                 /* recipient_size: */
@@ -805,19 +499,15 @@ void decode_png(
                 /* final_recipient_size: */
                     &actual_decoded_stream_size,
                 /* temp_working_memory: */
-                    states[thread_id]->dpng_working_memory +
-                        estimated_decoded_stream_size,
+                    decoded_stream_start + estimated_decoded_stream_size,
                 /* temp_working_memory_size: */
-                    states[thread_id]->dpng_working_memory_size -
-                        estimated_decoded_stream_size,
+                    inflate_working_memory_required(),
                 /* compressed_input: */
                     headerless_compressed_data_begin,
                 /* compressed_input_size: */
                     headerless_compressed_data_stream_size - 4,
                 /* good: */
-                    &inflate_result,
-                /* const uint32_t thread_id: */
-                    thread_id);
+                    &inflate_result);
             ran_inflate_algorithm = 1;
             
             if (inflate_result == 0) {
@@ -856,21 +546,49 @@ void decode_png(
                     *out_good = 0;
                     return;
                 }
+                
+                #ifndef DECODE_PNG_IGNORE_ADLER32_CHECKS
+                /*
+                The zlib stream ends with the Adler-32 checksum of the
+                decompressed data, stored MSB first
+                */
+                uint8_t * adler_bytes =
+                    headerless_compressed_data_begin +
+                        headerless_compressed_data_stream_size - 4;
+                uint32_t expected_adler =
+                    ((uint32_t)adler_bytes[0] << 24) |
+                    ((uint32_t)adler_bytes[1] << 16) |
+                    ((uint32_t)adler_bytes[2] << 8) |
+                    (uint32_t)adler_bytes[3];
+                uint32_t actual_adler = adler32_update(
+                    /* adler: */ ADLER32_INITIAL_VALUE,
+                    /* data: */ decoded_stream_start,
+                    /* size: */ actual_decoded_stream_size);
+                
+                if (actual_adler != expected_adler) {
+                    #ifndef DECODE_PNG_SILENCE
+                    printf(
+                        "ERROR - Adler-32 checksum of the decompressed IDAT "
+                        "data was %u, but the zlib stream says %u\n",
+                        actual_adler,
+                        expected_adler);
+                    #endif
+                    *out_good = 0;
+                    return;
+                }
+                #endif
             }
         }
         
         #ifndef DECODE_PNG_IGNORE_CRC_CHECKS
-        running_crc = update_crc(
+        running_crc = crc32_update(
             /* crc: */ running_crc,
-            /* buffer: */ (unsigned char *)chunk_header.type,
-            /* length: */ 4);
-        if (chunk_header.length > 0) {
-            running_crc = update_crc(
-                /* crc: */ running_crc,
-                /* buffer: */ (unsigned char *)compressed_input,
-                /* length: */ chunk_header.length);
-        }
-        running_crc = running_crc ^ 0xffffffffL;
+            /* data: */ (uint8_t *)chunk_header.type,
+            /* size: */ 4);
+        running_crc = crc32_update(
+            /* crc: */ running_crc,
+            /* data: */ (uint8_t *)compressed_input,
+            /* size: */ chunk_header.length);
         #endif
         
         #ifndef DECODE_PNG_SILENCE 
@@ -1057,24 +775,25 @@ void decode_png(
                 return;
             }
             
+            // the decoded stream comes after the palette, and the lookup
+            // tables for inflate() come after the decoded stream
             uint64_t required_memory_size =
-                (ihdr_body.width * ihdr_body.height * 4)
+                sizeof(Palette)
+                    + ((uint64_t)ihdr_body.width * ihdr_body.height * 4)
                     + ihdr_body.height
                     + 1
-                    + INFLATE_HASHMAPS_SIZE;
+                    + inflate_working_memory_required();
             if (
                 required_memory_size >
                     states[thread_id]->dpng_working_memory_size)
             {
                 #ifndef DECODE_PNG_SILENCE
                 printf(
-                    "ERROR: this function assumes at least"
-                    "(imgwidth * imgwidth * 4)+imgheight+1+hashmap memory) to "
-                    "to work in and write to, got: %u, expected: %u\n",
+                    "ERROR: this function assumes at least "
+                    "(imgwidth * imgheight * 4)+imgheight+1+hashmap memory "
+                    "to work in and write to, got: %u, expected: %llu\n",
                     states[thread_id]->dpng_working_memory_size,
-                    (ihdr_body.width * ihdr_body.height * 4)
-                        + ihdr_body.height
-                        + INFLATE_HASHMAPS_SIZE);
+                    required_memory_size);
                 #endif
                 *out_good = 0;
                 return;
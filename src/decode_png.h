@@ -10,6 +10,7 @@ PNG files.
 
 // #define DECODE_PNG_SILENCE
 // #define DECODE_PNG_IGNORE_CRC_CHECKS
+// #define DECODE_PNG_IGNORE_ADLER32_CHECKS
 // #define DECODE_PNG_IGNORE_ASSERTS
 
 #include "inflate.h"
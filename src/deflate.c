@@ -0,0 +1,1392 @@
+#include "deflate.h"
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+#ifndef DEFLATE_SILENCE
+#include <stdio.h>
+#endif
+
+#ifndef DEFLATE_IGNORE_ASSERTS
+#include <assert.h>
+#endif
+
+/*
+A match can refer back at most 32KiB, and be 3 to 258 bytes long
+*/
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_WINDOW_MASK (DEFLATE_WINDOW_SIZE - 1)
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+
+/*
+A 3 byte match that far back usually costs more bits than 3 literals
+*/
+#define DEFLATE_TOO_FAR 4096
+
+#define DEFLATE_LITLEN_CODES 286
+#define DEFLATE_FIXED_LITLEN_CODES 288
+#define DEFLATE_DIST_CODES 30
+#define DEFLATE_CODELENGTH_CODES 19
+#define DEFLATE_END_OF_BLOCK 256
+#define DEFLATE_MAX_CODE_LENGTH 15
+#define DEFLATE_MAX_CODELENGTH_CODE_LENGTH 7
+#define DEFLATE_MAX_STORED_SIZE 65535
+
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_HASH_SIZE (1 << DEFLATE_HASH_BITS)
+
+/*
+How many literals and matches we collect before we decide how to write
+them as a block. Bigger blocks have less header overhead, smaller blocks
+adapt to changing data quicker.
+*/
+#define DEFLATE_BLOCK_SYMBOLS 16384
+
+// the order code length code lengths are written in, see inflate.c
+static const uint8_t codelength_order[DEFLATE_CODELENGTH_CODES] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t dist_base[DEFLATE_DIST_CODES] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+    8193, 12289, 16385, 24577
+};
+static const uint8_t dist_extra[DEFLATE_DIST_CODES] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+/*
+A huffman code, ready to write: the bits are already reversed, because
+DEFLATE writes huffman codes starting from their most significant bit
+*/
+typedef struct DeflateCode {
+    uint16_t code;
+    uint16_t length;
+} DeflateCode;
+
+struct DeflateContext {
+    void * (* malloc_func)(uint64_t size);
+    void (* free_func)(void * to_free);
+    void * (* memset_func)(void * str, int c, uint64_t n);
+    void * (* memcpy_func)(void * dest, const void * src, uint64_t n);
+    
+    // length 3..258 -> index into length_base
+    uint8_t length_symbols[DEFLATE_MAX_MATCH + 1];
+    /*
+    distance - 1 -> index into dist_base, for distances up to 256. Further
+    than that, ((distance - 1) >> 7) + 256 is the index
+    */
+    uint8_t dist_symbols[512];
+    
+    uint8_t fixed_litlen_lengths[DEFLATE_FIXED_LITLEN_CODES];
+    uint8_t fixed_dist_lengths[DEFLATE_DIST_CODES];
+    DeflateCode fixed_litlen_codes[DEFLATE_FIXED_LITLEN_CODES];
+    DeflateCode fixed_dist_codes[DEFLATE_DIST_CODES];
+};
+
+/*
+How hard each level tries, the same knobs zlib has:
+- good_length: once we have a match this long, only search a quarter as long
+  for a better one
+- max_lazy: (lazy levels) don't look for a better match if we have one this
+  long. (greedy levels) don't bother hashing the bytes inside matches longer
+  than this
+- nice_length: stop searching when we found a match this long
+- max_chain: how many earlier positions with the same hash we compare
+*/
+typedef struct DeflateLevel {
+    uint16_t good_length;
+    uint16_t max_lazy;
+    uint16_t nice_length;
+    uint16_t max_chain;
+    uint32_t lazy;
+} DeflateLevel;
+
+static const DeflateLevel deflate_levels[DEFLATE_MAX_LEVEL + 1] = {
+    { 0, 0, 0, 0, 0 }, // stored blocks only
+    { 4, 4, 8, 4, 0 },
+    { 4, 5, 16, 8, 0 },
+    { 4, 6, 32, 32, 0 },
+    { 4, 4, 16, 16, 1 },
+    { 8, 16, 32, 32, 1 },
+    { 8, 16, 128, 128, 1 },
+    { 8, 32, 128, 256, 1 },
+    { 32, 128, 258, 1024, 1 },
+    { 32, 258, 258, 4096, 1 },
+};
+
+/*
+1 literal (dist is 0) or 1 match
+*/
+typedef struct DeflateSymbol {
+    uint16_t litlen; // the byte, or the match length
+    uint16_t dist;
+} DeflateSymbol;
+
+/*
+Collects bits starting from the least significant one, like DataStream in
+inflate.c reads them
+*/
+typedef struct BitWriter {
+    uint8_t * at;
+    uint8_t * end;
+    uint64_t bit_buffer;
+    uint32_t bits_used;
+    uint32_t overflowed;
+} BitWriter;
+
+typedef struct DeflateState {
+    DeflateContext * context;
+    DeflateLevel level;
+    
+    uint8_t const * input;
+    uint64_t input_size;
+    
+    /*
+    head[hash] is the latest position with that hash, and prev[position &
+    DEFLATE_WINDOW_MASK] the position with the same hash before it. Both
+    store (position - hash_base + 1), so 0 means 'none'.
+    */
+    uint32_t * head;
+    uint32_t * prev;
+    uint64_t hash_base;
+    
+    // the current block, covering block_size bytes from block_start
+    DeflateSymbol * symbols;
+    uint32_t symbols_size;
+    uint64_t block_start;
+    uint64_t block_size;
+    uint32_t litlen_freqs[DEFLATE_LITLEN_CODES];
+    uint32_t dist_freqs[DEFLATE_DIST_CODES];
+    
+    BitWriter writer;
+} DeflateState;
+
+static uint32_t reverse_bits(
+    uint32_t bits,
+    const uint32_t amount)
+{
+    uint32_t return_value = 0;
+    for (uint32_t i = 0; i < amount; i++) {
+        return_value = (return_value << 1) | (bits & 1);
+        bits >>= 1;
+    }
+    
+    return return_value;
+}
+
+/*
+Give every symbol with a length its canonical huffman code, the same way the
+decoder will (RFC 1951 section 3.2.2)
+*/
+static void lengths_to_codes(
+    uint8_t const * lengths,
+    const uint32_t lengths_size,
+    DeflateCode * recipient)
+{
+    uint32_t length_counts[DEFLATE_MAX_CODE_LENGTH + 1];
+    uint32_t next_code[DEFLATE_MAX_CODE_LENGTH + 1];
+    for (uint32_t i = 0; i <= DEFLATE_MAX_CODE_LENGTH; i++) {
+        length_counts[i] = 0;
+    }
+    for (uint32_t i = 0; i < lengths_size; i++) {
+        length_counts[lengths[i]]++;
+    }
+    length_counts[0] = 0;
+    
+    uint32_t code = 0;
+    next_code[0] = 0;
+    for (uint32_t bits = 1; bits <= DEFLATE_MAX_CODE_LENGTH; bits++) {
+        code = (code + length_counts[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+    
+    for (uint32_t i = 0; i < lengths_size; i++) {
+        recipient[i].length = lengths[i];
+        recipient[i].code = 0;
+        if (lengths[i] > 0) {
+            recipient[i].code = (uint16_t)reverse_bits(
+                next_code[lengths[i]]++,
+                lengths[i]);
+        }
+    }
+}
+
+DeflateContext * deflate_context_create(
+    void * (* malloc_funcptr)(uint64_t __size),
+    void (* free_funcptr)(void * to_free),
+    void * (* memset_funcptr)(void * str, int c, uint64_t n),
+    void * (* memcpy_funcptr)(void * dest, const void * src, uint64_t n))
+{
+    #ifndef DEFLATE_IGNORE_ASSERTS
+    assert(malloc_funcptr != NULL);
+    assert(free_funcptr != NULL);
+    assert(memset_funcptr != NULL);
+    assert(memcpy_funcptr != NULL);
+    #endif
+    
+    DeflateContext * context = malloc_funcptr(sizeof(DeflateContext));
+    if (context == NULL) {
+        return NULL;
+    }
+    
+    context->malloc_func = malloc_funcptr;
+    context->free_func = free_funcptr;
+    context->memset_func = memset_funcptr;
+    context->memcpy_func = memcpy_funcptr;
+    
+    for (uint32_t symbol = 0; symbol < 29; symbol++) {
+        uint32_t lengths_size = 1u << length_extra[symbol];
+        for (uint32_t i = 0; i < lengths_size; i++) {
+            uint32_t length = length_base[symbol] + i;
+            if (length <= DEFLATE_MAX_MATCH) {
+                context->length_symbols[length] = (uint8_t)symbol;
+            }
+        }
+    }
+    // 258 has its own symbol, even though 227 + 31 would also reach it
+    context->length_symbols[DEFLATE_MAX_MATCH] = 28;
+    
+    for (uint32_t symbol = 0; symbol < DEFLATE_DIST_CODES; symbol++) {
+        uint32_t dists_size = 1u << dist_extra[symbol];
+        for (uint32_t i = 0; i < dists_size; i++) {
+            uint32_t dist = dist_base[symbol] + i;
+            if (dist <= 256) {
+                context->dist_symbols[dist - 1] = (uint8_t)symbol;
+            } else {
+                context->dist_symbols[256 + ((dist - 1) >> 7)] =
+                    (uint8_t)symbol;
+            }
+        }
+    }
+    
+    // the fixed codes from the spec, see build_fixed_tables() in inflate.c
+    for (uint32_t i = 0; i < DEFLATE_FIXED_LITLEN_CODES; i++) {
+        if (i < 144) {
+            context->fixed_litlen_lengths[i] = 8;
+        } else if (i < 256) {
+            context->fixed_litlen_lengths[i] = 9;
+        } else if (i < 280) {
+            context->fixed_litlen_lengths[i] = 7;
+        } else {
+            context->fixed_litlen_lengths[i] = 8;
+        }
+    }
+    for (uint32_t i = 0; i < DEFLATE_DIST_CODES; i++) {
+        context->fixed_dist_lengths[i] = 5;
+    }
+    lengths_to_codes(
+        /* lengths: */ context->fixed_litlen_lengths,
+        /* lengths_size: */ DEFLATE_FIXED_LITLEN_CODES,
+        /* recipient: */ context->fixed_litlen_codes);
+    lengths_to_codes(
+        /* lengths: */ context->fixed_dist_lengths,
+        /* lengths_size: */ DEFLATE_DIST_CODES,
+        /* recipient: */ context->fixed_dist_codes);
+    
+    return context;
+}
+
+void deflate_context_destroy(
+    DeflateContext * context)
+{
+    if (context == NULL) {
+        return;
+    }
+    
+    context->free_func(context);
+}
+
+/*
+deflate() carves these out of temp_working_memory in this order, each one
+16-byte aligned
+*/
+uint64_t deflate_working_memory_required(void)
+{
+    return
+        (sizeof(uint32_t) * DEFLATE_HASH_SIZE + 15) +
+        (sizeof(uint32_t) * DEFLATE_WINDOW_SIZE + 15) +
+        (sizeof(DeflateSymbol) * DEFLATE_BLOCK_SYMBOLS + 15);
+}
+
+/*
+In the worst case, every block is written as stored blocks: 5 bytes of
+header per 65535 bytes, and at most 1 block per 16384 bytes of input (a block
+is only cut when it has DEFLATE_BLOCK_SYMBOLS symbols, and every symbol is at
+least 1 byte). The constant covers the final block and the last partial byte.
+*/
+uint64_t deflate_bound(
+    const uint64_t input_size)
+{
+    return input_size + (input_size >> 11) + 16;
+}
+
+static void * take_working_memory(
+    uint8_t ** at,
+    uint64_t * remaining,
+    const uint64_t size)
+{
+    uint64_t padding = (16 - ((uint64_t)(uintptr_t)*at & 15)) & 15;
+    if (*remaining < padding + size) {
+        return NULL;
+    }
+    
+    void * return_value = *at + padding;
+    *at += padding + size;
+    *remaining -= padding + size;
+    
+    return return_value;
+}
+
+/*
+Write out the whole bytes we collected. If the recipient is full, we
+remember that and keep going, so the hot loops don't need to check.
+*/
+static void flush_whole_bytes(
+    BitWriter * writer)
+{
+    while (writer->bits_used >= 8) {
+        if (writer->at < writer->end) {
+            *writer->at = (uint8_t)(writer->bit_buffer & 255);
+            writer->at++;
+        } else {
+            writer->overflowed = 1;
+        }
+        writer->bit_buffer >>= 8;
+        writer->bits_used -= 8;
+    }
+}
+
+inline static void write_bits(
+    BitWriter * writer,
+    const uint32_t bits,
+    const uint32_t amount)
+{
+    #ifndef DEFLATE_IGNORE_ASSERTS
+    assert(amount <= 32);
+    assert(amount == 32 || (bits >> amount) == 0);
+    assert(writer->bits_used < 32);
+    #endif
+    
+    writer->bit_buffer |= (uint64_t)bits << writer->bits_used;
+    writer->bits_used += amount;
+    
+    if (writer->bits_used >= 32) {
+        flush_whole_bytes(writer);
+    }
+}
+
+// pad with zero bits up to the next byte boundary, and write everything
+static void align_writer(
+    BitWriter * writer)
+{
+    writer->bits_used = (writer->bits_used + 7) & ~7u;
+    flush_whole_bytes(writer);
+}
+
+/*
+Stored blocks are byte aligned, so after the 3 header bits we pad to a byte,
+then write LEN, NLEN and the bytes as they are
+*/
+static void write_stored_blocks(
+    DeflateState * state,
+    uint8_t const * bytes,
+    uint64_t bytes_size,
+    const uint32_t is_final)
+{
+    BitWriter * writer = &state->writer;
+    
+    do {
+        uint32_t size = bytes_size > DEFLATE_MAX_STORED_SIZE ?
+            DEFLATE_MAX_STORED_SIZE :
+            (uint32_t)bytes_size;
+        uint32_t BFINAL = is_final && size == bytes_size;
+        
+        write_bits(writer, BFINAL, 1);
+        write_bits(writer, 0, 2);
+        align_writer(writer);
+        write_bits(writer, size, 16);
+        write_bits(writer, ~size & 0xFFFF, 16);
+        flush_whole_bytes(writer);
+        
+        if ((uint64_t)(writer->end - writer->at) < size) {
+            writer->overflowed = 1;
+            return;
+        }
+        state->context->memcpy_func(writer->at, bytes, size);
+        writer->at += size;
+        
+        bytes += size;
+        bytes_size -= size;
+    } while (bytes_size > 0);
+}
+
+/*
+Compute huffman code lengths for freqs, no longer than max_length. Symbols
+that never occur get length 0.
+
+This is the in-place algorithm from Moffat and Katajainen ("In-Place
+Calculation of Minimum-Redundancy Codes"), which needs the frequencies sorted.
+It can give codes longer than DEFLATE allows, so after that we move codes
+from the bottom of the tree up until they fit, like zlib and miniz do.
+
+Needs at least 2 symbols with a frequency above 0.
+*/
+static void freqs_to_lengths(
+    uint32_t const * freqs,
+    const uint32_t freqs_size,
+    const uint32_t max_length,
+    uint8_t * lengths)
+{
+    // the used symbols, sorted by frequency (an insertion sort, n <= 288)
+    uint32_t sorted_symbols[DEFLATE_FIXED_LITLEN_CODES];
+    uint32_t tree[DEFLATE_FIXED_LITLEN_CODES];
+    uint32_t used = 0;
+    
+    for (uint32_t symbol = 0; symbol < freqs_size; symbol++) {
+        lengths[symbol] = 0;
+        if (freqs[symbol] == 0) {
+            continue;
+        }
+        
+        uint32_t i = used;
+        while (i > 0 && freqs[sorted_symbols[i - 1]] > freqs[symbol]) {
+            sorted_symbols[i] = sorted_symbols[i - 1];
+            i--;
+        }
+        sorted_symbols[i] = symbol;
+        used++;
+    }
+    
+    #ifndef DEFLATE_IGNORE_ASSERTS
+    assert(used >= 2);
+    #endif
+    
+    for (uint32_t i = 0; i < used; i++) {
+        tree[i] = freqs[sorted_symbols[i]];
+    }
+    
+    // 1. build the tree: parent pointers for internal nodes
+    tree[0] += tree[1];
+    uint32_t root = 0;
+    uint32_t leaf = 2;
+    for (uint32_t next = 1; next < used - 1; next++) {
+        if (leaf >= used || tree[root] < tree[leaf]) {
+            tree[next] = tree[root];
+            tree[root++] = next;
+        } else {
+            tree[next] = tree[leaf++];
+        }
+        
+        if (leaf >= used || (root < next && tree[root] < tree[leaf])) {
+            tree[next] += tree[root];
+            tree[root++] = next;
+        } else {
+            tree[next] += tree[leaf++];
+        }
+    }
+    
+    // 2. turn parent pointers into depths
+    tree[used - 2] = 0;
+    for (int32_t next = (int32_t)used - 3; next >= 0; next--) {
+        tree[next] = tree[tree[next]] + 1;
+    }
+    
+    // 3. count leaves at each depth, from the top down
+    uint32_t length_counts[DEFLATE_MAX_CODE_LENGTH + 1];
+    for (uint32_t i = 0; i <= max_length; i++) {
+        length_counts[i] = 0;
+    }
+    
+    int32_t node = (int32_t)used - 2;
+    uint32_t available = 1;
+    uint32_t depth = 0;
+    while (available > 0) {
+        uint32_t internal = 0;
+        while (node >= 0 && tree[node] == depth) {
+            internal++;
+            node--;
+        }
+        
+        // the rest of the available nodes at this depth are leaves
+        if (available > internal) {
+            uint32_t clamped = depth > max_length ? max_length : depth;
+            length_counts[clamped] += available - internal;
+        }
+        
+        available = 2 * internal;
+        depth++;
+    }
+    
+    /*
+    Clamping made the code over-subscribed. Take codes away from the longest
+    length, and split a shorter code in 2 to make room, until it fits.
+    */
+    uint32_t total = 0;
+    for (uint32_t i = 1; i <= max_length; i++) {
+        total += length_counts[i] << (max_length - i);
+    }
+    while (total > (1u << max_length)) {
+        length_counts[max_length]--;
+        for (uint32_t i = max_length - 1; i > 0; i--) {
+            if (length_counts[i] > 0) {
+                length_counts[i]--;
+                length_counts[i + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+    
+    // the least frequent symbols get the longest codes
+    uint32_t sorted_i = 0;
+    for (uint32_t length = max_length; length > 0; length--) {
+        for (uint32_t i = 0; i < length_counts[length]; i++) {
+            lengths[sorted_symbols[sorted_i++]] = (uint8_t)length;
+        }
+    }
+    
+    #ifndef DEFLATE_IGNORE_ASSERTS
+    assert(sorted_i == used);
+    #endif
+}
+
+/*
+Every huffman code we write has at least 2 symbols, so it's complete. A
+code with 1 symbol is allowed for distances, but not every decoder likes it,
+and it only costs us a bit.
+*/
+static void ensure_2_symbols(
+    uint32_t * freqs,
+    const uint32_t freqs_size)
+{
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < freqs_size; i++) {
+        used += freqs[i] > 0;
+    }
+    
+    for (uint32_t i = 0; used < 2 && i < freqs_size; i++) {
+        if (freqs[i] == 0) {
+            freqs[i] = 1;
+            used++;
+        }
+    }
+}
+
+/*
+The bits for the literals, lengths and distances (with their extra bits),
+if they were written with these code lengths
+*/
+static uint64_t symbols_cost(
+    DeflateState * state,
+    uint8_t const * litlen_lengths,
+    uint8_t const * dist_lengths)
+{
+    uint64_t return_value = 0;
+    
+    for (uint32_t i = 0; i < DEFLATE_LITLEN_CODES; i++) {
+        return_value += (uint64_t)state->litlen_freqs[i] * litlen_lengths[i];
+    }
+    for (uint32_t i = 0; i < 29; i++) {
+        return_value +=
+            (uint64_t)state->litlen_freqs[257 + i] * length_extra[i];
+    }
+    for (uint32_t i = 0; i < DEFLATE_DIST_CODES; i++) {
+        return_value +=
+            (uint64_t)state->dist_freqs[i] * (dist_lengths[i] + dist_extra[i]);
+    }
+    
+    return return_value;
+}
+
+static void write_symbols(
+    DeflateState * state,
+    DeflateCode const * litlen_codes,
+    DeflateCode const * dist_codes)
+{
+    DeflateContext * context = state->context;
+    BitWriter * writer = &state->writer;
+    
+    for (uint32_t i = 0; i < state->symbols_size; i++) {
+        DeflateSymbol symbol = state->symbols[i];
+        
+        if (symbol.dist == 0) {
+            DeflateCode code = litlen_codes[symbol.litlen];
+            write_bits(writer, code.code, code.length);
+            continue;
+        }
+        
+        uint32_t length_symbol = context->length_symbols[symbol.litlen];
+        DeflateCode code = litlen_codes[257 + length_symbol];
+        write_bits(writer, code.code, code.length);
+        write_bits(
+            writer,
+            symbol.litlen - length_base[length_symbol],
+            length_extra[length_symbol]);
+        
+        uint32_t dist_symbol = symbol.dist <= 256 ?
+            context->dist_symbols[symbol.dist - 1] :
+            context->dist_symbols[256 + ((symbol.dist - 1) >> 7)];
+        code = dist_codes[dist_symbol];
+        write_bits(writer, code.code, code.length);
+        write_bits(
+            writer,
+            symbol.dist - dist_base[dist_symbol],
+            dist_extra[dist_symbol]);
+    }
+    
+    DeflateCode end_of_block = litlen_codes[DEFLATE_END_OF_BLOCK];
+    write_bits(writer, end_of_block.code, end_of_block.length);
+}
+
+/*
+Write the symbols we collected as 1 block, in whichever of the 3 block types
+is smallest, and start a new block
+*/
+static void flush_block(
+    DeflateState * state,
+    const uint32_t is_final)
+{
+    DeflateContext * context = state->context;
+    BitWriter * writer = &state->writer;
+    
+    state->litlen_freqs[DEFLATE_END_OF_BLOCK] = 1;
+    ensure_2_symbols(state->litlen_freqs, DEFLATE_LITLEN_CODES);
+    ensure_2_symbols(state->dist_freqs, DEFLATE_DIST_CODES);
+    
+    uint8_t litlen_lengths[DEFLATE_LITLEN_CODES];
+    uint8_t dist_lengths[DEFLATE_DIST_CODES];
+    freqs_to_lengths(
+        /* freqs: */ state->litlen_freqs,
+        /* freqs_size: */ DEFLATE_LITLEN_CODES,
+        /* max_length: */ DEFLATE_MAX_CODE_LENGTH,
+        /* lengths: */ litlen_lengths);
+    freqs_to_lengths(
+        /* freqs: */ state->dist_freqs,
+        /* freqs_size: */ DEFLATE_DIST_CODES,
+        /* max_length: */ DEFLATE_MAX_CODE_LENGTH,
+        /* lengths: */ dist_lengths);
+    
+    uint32_t HLIT = DEFLATE_LITLEN_CODES;
+    while (HLIT > 257 && litlen_lengths[HLIT - 1] == 0) {
+        HLIT--;
+    }
+    uint32_t HDIST = DEFLATE_DIST_CODES;
+    while (HDIST > 1 && dist_lengths[HDIST - 1] == 0) {
+        HDIST--;
+    }
+    
+    // the 2 sets of lengths are compressed together, right after each other
+    uint8_t lengths[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+    for (uint32_t i = 0; i < HLIT; i++) {
+        lengths[i] = litlen_lengths[i];
+    }
+    for (uint32_t i = 0; i < HDIST; i++) {
+        lengths[HLIT + i] = dist_lengths[i];
+    }
+    uint32_t lengths_size = HLIT + HDIST;
+    
+    /*
+    Run length encode the lengths: 16 repeats the previous length 3-6 times,
+    17 is 3-10 zeros, 18 is 11-138 zeros
+    */
+    uint8_t runs[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+    uint8_t runs_extra[DEFLATE_LITLEN_CODES + DEFLATE_DIST_CODES];
+    uint32_t runs_size = 0;
+    uint32_t codelength_freqs[DEFLATE_CODELENGTH_CODES];
+    for (uint32_t i = 0; i < DEFLATE_CODELENGTH_CODES; i++) {
+        codelength_freqs[i] = 0;
+    }
+    
+    uint32_t i = 0;
+    while (i < lengths_size) {
+        uint8_t length = lengths[i];
+        uint32_t run = 1;
+        while (i + run < lengths_size && lengths[i + run] == length) {
+            run++;
+        }
+        i += run;
+        
+        if (length == 0) {
+            while (run >= 11) {
+                uint32_t repeats = run > 138 ? 138 : run;
+                runs[runs_size] = 18;
+                runs_extra[runs_size++] = (uint8_t)(repeats - 11);
+                run -= repeats;
+            }
+            if (run >= 3) {
+                runs[runs_size] = 17;
+                runs_extra[runs_size++] = (uint8_t)(run - 3);
+                run = 0;
+            }
+        } else {
+            runs[runs_size] = length;
+            runs_extra[runs_size++] = 0;
+            run--;
+            while (run >= 3) {
+                uint32_t repeats = run > 6 ? 6 : run;
+                runs[runs_size] = 16;
+                runs_extra[runs_size++] = (uint8_t)(repeats - 3);
+                run -= repeats;
+            }
+        }
+        
+        while (run > 0) {
+            runs[runs_size] = length;
+            runs_extra[runs_size++] = 0;
+            run--;
+        }
+    }
+    
+    for (uint32_t run_i = 0; run_i < runs_size; run_i++) {
+        codelength_freqs[runs[run_i]]++;
+    }
+    ensure_2_symbols(codelength_freqs, DEFLATE_CODELENGTH_CODES);
+    
+    uint8_t codelength_lengths[DEFLATE_CODELENGTH_CODES];
+    freqs_to_lengths(
+        /* freqs: */ codelength_freqs,
+        /* freqs_size: */ DEFLATE_CODELENGTH_CODES,
+        /* max_length: */ DEFLATE_MAX_CODELENGTH_CODE_LENGTH,
+        /* lengths: */ codelength_lengths);
+    
+    uint32_t HCLEN = DEFLATE_CODELENGTH_CODES;
+    while (HCLEN > 4 && codelength_lengths[codelength_order[HCLEN - 1]] == 0)
+    {
+        HCLEN--;
+    }
+    
+    // now we can tell what each kind of block would cost, in bits
+    uint64_t dynamic_cost = 3 + 5 + 5 + 4 + 3 * HCLEN;
+    for (uint32_t symbol = 0; symbol < DEFLATE_CODELENGTH_CODES; symbol++) {
+        dynamic_cost +=
+            (uint64_t)codelength_freqs[symbol] * codelength_lengths[symbol];
+    }
+    dynamic_cost +=
+        2 * codelength_freqs[16] +
+        3 * codelength_freqs[17] +
+        7 * codelength_freqs[18];
+    dynamic_cost += symbols_cost(state, litlen_lengths, dist_lengths);
+    
+    uint64_t fixed_cost = 3 + symbols_cost(
+        state,
+        context->fixed_litlen_lengths,
+        context->fixed_dist_lengths);
+    
+    uint64_t stored_pieces =
+        state->block_size == 0 ?
+            1 :
+            (state->block_size + DEFLATE_MAX_STORED_SIZE - 1) /
+                DEFLATE_MAX_STORED_SIZE;
+    uint64_t stored_cost =
+        3 + ((8 - ((writer->bits_used + 3) & 7)) & 7) +
+        (stored_pieces - 1) * 8 +
+        stored_pieces * 32 +
+        state->block_size * 8;
+    
+    if (stored_cost <= fixed_cost && stored_cost <= dynamic_cost) {
+        write_stored_blocks(
+            /* state: */ state,
+            /* bytes: */ state->input + state->block_start,
+            /* bytes_size: */ state->block_size,
+            /* is_final: */ is_final);
+    } else if (fixed_cost <= dynamic_cost) {
+        write_bits(writer, is_final, 1);
+        write_bits(writer, 1, 2);
+        write_symbols(
+            /* state: */ state,
+            /* litlen_codes: */ context->fixed_litlen_codes,
+            /* dist_codes: */ context->fixed_dist_codes);
+    } else {
+        DeflateCode litlen_codes[DEFLATE_LITLEN_CODES];
+        DeflateCode dist_codes[DEFLATE_DIST_CODES];
+        DeflateCode codelength_codes[DEFLATE_CODELENGTH_CODES];
+        lengths_to_codes(litlen_lengths, DEFLATE_LITLEN_CODES, litlen_codes);
+        lengths_to_codes(dist_lengths, DEFLATE_DIST_CODES, dist_codes);
+        lengths_to_codes(
+            codelength_lengths,
+            DEFLATE_CODELENGTH_CODES,
+            codelength_codes);
+        
+        write_bits(writer, is_final, 1);
+        write_bits(writer, 2, 2);
+        write_bits(writer, HLIT - 257, 5);
+        write_bits(writer, HDIST - 1, 5);
+        write_bits(writer, HCLEN - 4, 4);
+        for (uint32_t j = 0; j < HCLEN; j++) {
+            write_bits(writer, codelength_lengths[codelength_order[j]], 3);
+        }
+        
+        for (uint32_t run_i = 0; run_i < runs_size; run_i++) {
+            DeflateCode code = codelength_codes[runs[run_i]];
+            write_bits(writer, code.code, code.length);
+            if (runs[run_i] == 16) {
+                write_bits(writer, runs_extra[run_i], 2);
+            } else if (runs[run_i] == 17) {
+                write_bits(writer, runs_extra[run_i], 3);
+            } else if (runs[run_i] == 18) {
+                write_bits(writer, runs_extra[run_i], 7);
+            }
+        }
+        
+        write_symbols(
+            /* state: */ state,
+            /* litlen_codes: */ litlen_codes,
+            /* dist_codes: */ dist_codes);
+    }
+    
+    state->block_start += state->block_size;
+    state->block_size = 0;
+    state->symbols_size = 0;
+    for (uint32_t j = 0; j < DEFLATE_LITLEN_CODES; j++) {
+        state->litlen_freqs[j] = 0;
+    }
+    for (uint32_t j = 0; j < DEFLATE_DIST_CODES; j++) {
+        state->dist_freqs[j] = 0;
+    }
+}
+
+inline static void record_literal(
+    DeflateState * state,
+    const uint8_t literal)
+{
+    state->symbols[state->symbols_size].litlen = literal;
+    state->symbols[state->symbols_size].dist = 0;
+    state->symbols_size++;
+    state->litlen_freqs[literal]++;
+    state->block_size += 1;
+    
+    if (state->symbols_size >= DEFLATE_BLOCK_SYMBOLS) {
+        flush_block(state, 0);
+    }
+}
+
+inline static void record_match(
+    DeflateState * state,
+    const uint32_t length,
+    const uint32_t dist)
+{
+    #ifndef DEFLATE_IGNORE_ASSERTS
+    assert(length >= DEFLATE_MIN_MATCH && length <= DEFLATE_MAX_MATCH);
+    assert(dist >= 1 && dist <= DEFLATE_WINDOW_SIZE);
+    #endif
+    
+    DeflateContext * context = state->context;
+    
+    state->symbols[state->symbols_size].litlen = (uint16_t)length;
+    state->symbols[state->symbols_size].dist = (uint16_t)dist;
+    state->symbols_size++;
+    state->litlen_freqs[257 + context->length_symbols[length]]++;
+    state->dist_freqs[
+        dist <= 256 ?
+            context->dist_symbols[dist - 1] :
+            context->dist_symbols[256 + ((dist - 1) >> 7)]]++;
+    state->block_size += length;
+    
+    if (state->symbols_size >= DEFLATE_BLOCK_SYMBOLS) {
+        flush_block(state, 0);
+    }
+}
+
+inline static uint32_t hash_at(
+    uint8_t const * bytes)
+{
+    uint32_t value =
+        (uint32_t)bytes[0] |
+        ((uint32_t)bytes[1] << 8) |
+        ((uint32_t)bytes[2] << 16);
+    
+    return (value * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+/*
+Add position to the hash chains (it needs DEFLATE_MIN_MATCH bytes of input)
+
+returns the entry of the previous position with the same hash, 0 if none
+*/
+inline static uint32_t insert_hash(
+    DeflateState * state,
+    const uint64_t position)
+{
+    /*
+    Entries are 32 bits, so on inputs of several GB we have to move
+    hash_base up once in a while. Anything older than the window is
+    useless anyway, so it becomes 0.
+    */
+    if (position - state->hash_base >= 0xF0000000u) {
+        uint64_t new_base = position - DEFLATE_WINDOW_SIZE;
+        uint32_t shift = (uint32_t)(new_base - state->hash_base);
+        for (uint32_t i = 0; i < DEFLATE_HASH_SIZE; i++) {
+            state->head[i] = state->head[i] > shift ?
+                state->head[i] - shift : 0;
+        }
+        for (uint32_t i = 0; i < DEFLATE_WINDOW_SIZE; i++) {
+            state->prev[i] = state->prev[i] > shift ?
+                state->prev[i] - shift : 0;
+        }
+        state->hash_base = new_base;
+    }
+    
+    uint32_t hash = hash_at(state->input + position);
+    uint32_t previous = state->head[hash];
+    state->prev[position & DEFLATE_WINDOW_MASK] = previous;
+    state->head[hash] = (uint32_t)(position - state->hash_base + 1);
+    
+    return previous;
+}
+
+/*
+Compilers turn this into 1 unaligned load (on little endian CPUs)
+*/
+inline static uint64_t load_8_bytes(
+    uint8_t const * bytes)
+{
+    return
+        (uint64_t)bytes[0] |
+        ((uint64_t)bytes[1] << 8) |
+        ((uint64_t)bytes[2] << 16) |
+        ((uint64_t)bytes[3] << 24) |
+        ((uint64_t)bytes[4] << 32) |
+        ((uint64_t)bytes[5] << 40) |
+        ((uint64_t)bytes[6] << 48) |
+        ((uint64_t)bytes[7] << 56);
+}
+
+/*
+Walk the hash chain from entry, and find the longest match for position
+that's longer than best_length
+
+returns the length of the best match (best_length if we didn't find a
+longer one), and sets dist if we did
+*/
+static uint32_t find_longest_match(
+    DeflateState * state,
+    const uint64_t position,
+    uint32_t entry,
+    const uint32_t max_length,
+    uint32_t best_length,
+    uint32_t chain,
+    uint32_t * dist)
+{
+    if (best_length >= max_length) {
+        return best_length;
+    }
+    
+    uint8_t const * here = state->input + position;
+    uint32_t nice_length = state->level.nice_length;
+    if (nice_length > max_length) {
+        nice_length = max_length;
+    }
+    
+    while (entry != 0 && chain > 0) {
+        chain--;
+        
+        uint64_t candidate = state->hash_base + entry - 1;
+        if (
+            candidate >= position ||
+            position - candidate > DEFLATE_WINDOW_SIZE)
+        {
+            break;
+        }
+        
+        uint8_t const * there = state->input + candidate;
+        
+        /*
+        The end of our best match so far is the likeliest place for a
+        candidate to differ (its start probably matches, it had our hash)
+        */
+        if (
+            there[best_length] == here[best_length] &&
+            there[best_length - 1] == here[best_length - 1])
+        {
+            uint32_t length = 0;
+            while (length + 8 <= max_length) {
+                uint64_t difference =
+                    load_8_bytes(there + length) ^ load_8_bytes(here + length);
+                if (difference != 0) {
+                    // little endian, so the first differing byte is lowest
+                    while ((difference & 255) == 0) {
+                        difference >>= 8;
+                        length++;
+                    }
+                    break;
+                }
+                length += 8;
+            }
+            if (length + 8 > max_length) {
+                while (length < max_length && there[length] == here[length]) {
+                    length++;
+                }
+            }
+            
+            if (length > best_length) {
+                best_length = length;
+                *dist = (uint32_t)(position - candidate);
+                if (length >= nice_length) {
+                    break;
+                }
+            }
+        }
+        
+        // a newer position overwrote this slot, the chain ends here
+        uint32_t next = state->prev[candidate & DEFLATE_WINDOW_MASK];
+        if (next >= entry) {
+            break;
+        }
+        entry = next;
+    }
+    
+    return best_length;
+}
+
+/*
+Levels 1-3: take the longest match at each position, if there is one
+*/
+static void compress_greedy(
+    DeflateState * state)
+{
+    uint8_t const * input = state->input;
+    uint64_t end = state->input_size;
+    uint64_t position = state->block_start;
+    
+    while (position < end) {
+        uint32_t length = 0;
+        uint32_t dist = 0;
+        uint64_t bytes_left = end - position;
+        
+        if (bytes_left >= DEFLATE_MIN_MATCH) {
+            uint32_t entry = insert_hash(state, position);
+            length = find_longest_match(
+                /* state: */
+                    state,
+                /* position: */
+                    position,
+                /* entry: */
+                    entry,
+                /* max_length: */
+                    bytes_left > DEFLATE_MAX_MATCH ?
+                        DEFLATE_MAX_MATCH :
+                        (uint32_t)bytes_left,
+                /* best_length: */
+                    DEFLATE_MIN_MATCH - 1,
+                /* chain: */
+                    state->level.max_chain,
+                /* dist: */
+                    &dist);
+            if (length == DEFLATE_MIN_MATCH && dist > DEFLATE_TOO_FAR) {
+                length = 0;
+            }
+        }
+        
+        if (length < DEFLATE_MIN_MATCH) {
+            record_literal(state, input[position]);
+            position++;
+            continue;
+        }
+        
+        record_match(state, length, dist);
+        
+        if (length <= state->level.max_lazy) {
+            for (uint32_t i = 1; i < length; i++) {
+                if (end - (position + i) >= DEFLATE_MIN_MATCH) {
+                    insert_hash(state, position + i);
+                }
+            }
+        }
+        position += length;
+    }
+}
+
+/*
+Levels 4-9: before we take a match, check if the next position has a longer
+one. If so, write a literal instead and consider that one.
+*/
+static void compress_lazy(
+    DeflateState * state)
+{
+    uint8_t const * input = state->input;
+    uint64_t end = state->input_size;
+    uint64_t position = state->block_start;
+    
+    // the best match at position - 1, if match_available
+    uint32_t previous_length = 0;
+    uint32_t previous_dist = 0;
+    uint32_t match_available = 0;
+    
+    while (position < end) {
+        uint32_t length = 0;
+        uint32_t dist = 0;
+        uint64_t bytes_left = end - position;
+        
+        if (bytes_left >= DEFLATE_MIN_MATCH) {
+            uint32_t entry = insert_hash(state, position);
+            
+            if (previous_length < state->level.max_lazy) {
+                uint32_t chain = state->level.max_chain;
+                if (previous_length >= state->level.good_length) {
+                    chain >>= 2;
+                }
+                
+                length = find_longest_match(
+                    /* state: */
+                        state,
+                    /* position: */
+                        position,
+                    /* entry: */
+                        entry,
+                    /* max_length: */
+                        bytes_left > DEFLATE_MAX_MATCH ?
+                            DEFLATE_MAX_MATCH :
+                            (uint32_t)bytes_left,
+                    /* best_length: */
+                        previous_length < DEFLATE_MIN_MATCH ?
+                            DEFLATE_MIN_MATCH - 1 :
+                            previous_length,
+                    /* chain: */
+                        chain,
+                    /* dist: */
+                        &dist);
+                if (length == DEFLATE_MIN_MATCH && dist > DEFLATE_TOO_FAR) {
+                    length = 0;
+                }
+            }
+        }
+        
+        if (previous_length >= DEFLATE_MIN_MATCH && length <= previous_length)
+        {
+            // the match at position - 1 wins, position is already hashed
+            uint64_t match_end = position - 1 + previous_length;
+            record_match(state, previous_length, previous_dist);
+            for (uint64_t i = position + 1; i < match_end; i++) {
+                if (end - i >= DEFLATE_MIN_MATCH) {
+                    insert_hash(state, i);
+                }
+            }
+            
+            position = match_end;
+            previous_length = 0;
+            match_available = 0;
+            continue;
+        }
+        
+        if (match_available) {
+            record_literal(state, input[position - 1]);
+        }
+        match_available = 1;
+        previous_length = length < DEFLATE_MIN_MATCH ? 0 : length;
+        previous_dist = dist;
+        position++;
+    }
+    
+    if (match_available) {
+        if (previous_length >= DEFLATE_MIN_MATCH) {
+            record_match(state, previous_length, previous_dist);
+        } else {
+            record_literal(state, input[position - 1]);
+        }
+    }
+}
+
+void deflate_chunk(
+    DeflateContext * context,
+    const uint32_t level,
+    uint8_t * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    uint8_t const * input,
+    const uint64_t input_size,
+    const uint32_t dictionary_size,
+    const uint32_t is_last,
+    uint32_t * out_good)
+{
+    #ifndef DEFLATE_IGNORE_ASSERTS
+    assert(context != NULL);
+    assert(final_recipient_size != NULL);
+    assert(out_good != NULL);
+    assert(input != NULL || (input_size == 0 && dictionary_size == 0));
+    #endif
+    
+    *out_good = 0;
+    *final_recipient_size = 0;
+    
+    if (level > DEFLATE_MAX_LEVEL) {
+        #ifndef DEFLATE_SILENCE
+        printf(
+            "deflate_chunk() ERROR: level %u, but the highest level is "
+            "%u\n",
+            level,
+            DEFLATE_MAX_LEVEL);
+        #endif
+        return;
+    }
+    
+    // matches can't reach back further than the window anyway
+    uint32_t history_size = dictionary_size > DEFLATE_WINDOW_SIZE ?
+        DEFLATE_WINDOW_SIZE :
+        dictionary_size;
+    
+    /*
+    The dictionary is simply the start of our input, that we hash but don't
+    write: positions 0 to history_size are in the past
+    */
+    DeflateState state;
+    state.context = context;
+    state.level = deflate_levels[level];
+    state.input = input - history_size;
+    state.input_size = history_size + input_size;
+    state.hash_base = 0;
+    state.symbols_size = 0;
+    state.block_start = history_size;
+    state.block_size = 0;
+    state.writer.at = recipient;
+    state.writer.end = recipient + recipient_size;
+    state.writer.bit_buffer = 0;
+    state.writer.bits_used = 0;
+    state.writer.overflowed = 0;
+    
+    if (level == 0) {
+        // these end on a byte boundary already, no need for a sync flush
+        write_stored_blocks(
+            /* state: */ &state,
+            /* bytes: */ input,
+            /* bytes_size: */ input_size,
+            /* is_final: */ is_last);
+    } else {
+        uint8_t * memory_at = temp_working_memory;
+        uint64_t memory_left = temp_working_memory_size;
+        state.head = take_working_memory(
+            &memory_at,
+            &memory_left,
+            sizeof(uint32_t) * DEFLATE_HASH_SIZE);
+        state.prev = take_working_memory(
+            &memory_at,
+            &memory_left,
+            sizeof(uint32_t) * DEFLATE_WINDOW_SIZE);
+        state.symbols = take_working_memory(
+            &memory_at,
+            &memory_left,
+            sizeof(DeflateSymbol) * DEFLATE_BLOCK_SYMBOLS);
+        if (
+            temp_working_memory == NULL ||
+            state.head == NULL ||
+            state.prev == NULL ||
+            state.symbols == NULL)
+        {
+            #ifndef DEFLATE_SILENCE
+            printf(
+                "deflate_chunk() ERROR: need %llu bytes of "
+                "temp_working_memory, got %llu\n",
+                deflate_working_memory_required(),
+                temp_working_memory_size);
+            #endif
+            return;
+        }
+        
+        // prev is only read for positions we inserted, no need to clear it
+        context->memset_func(
+            state.head,
+            0,
+            sizeof(uint32_t) * DEFLATE_HASH_SIZE);
+        for (uint32_t i = 0; i < DEFLATE_LITLEN_CODES; i++) {
+            state.litlen_freqs[i] = 0;
+        }
+        for (uint32_t i = 0; i < DEFLATE_DIST_CODES; i++) {
+            state.dist_freqs[i] = 0;
+        }
+        
+        for (uint32_t i = 0; i < history_size; i++) {
+            if (state.input_size - i >= DEFLATE_MIN_MATCH) {
+                insert_hash(&state, i);
+            }
+        }
+        
+        if (state.level.lazy) {
+            compress_lazy(&state);
+        } else {
+            compress_greedy(&state);
+        }
+        
+        flush_block(&state, is_last);
+        
+        /*
+        A 'sync flush', like zlib's Z_SYNC_FLUSH: an empty stored block gets
+        us to a byte boundary, so the next chunk's output can simply be
+        appended after ours
+        */
+        if (!is_last) {
+            write_stored_blocks(
+                /* state: */ &state,
+                /* bytes: */ input,
+                /* bytes_size: */ 0,
+                /* is_final: */ 0);
+        }
+    }
+    
+    align_writer(&state.writer);
+    
+    if (state.writer.overflowed) {
+        #ifndef DEFLATE_SILENCE
+        printf(
+            "deflate_chunk() ERROR: recipient_size %llu is too small, "
+            "deflate_bound() is always enough\n",
+            recipient_size);
+        #endif
+        return;
+    }
+    
+    *final_recipient_size = (uint64_t)(state.writer.at - recipient);
+    *out_good = 1;
+}
+
+void deflate(
+    DeflateContext * context,
+    const uint32_t level,
+    uint8_t * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    uint8_t const * input,
+    const uint64_t input_size,
+    uint32_t * out_good)
+{
+    deflate_chunk(
+        /* context: */
+            context,
+        /* level: */
+            level,
+        /* recipient: */
+            recipient,
+        /* recipient_size: */
+            recipient_size,
+        /* final_recipient_size: */
+            final_recipient_size,
+        /* temp_working_memory: */
+            temp_working_memory,
+        /* temp_working_memory_size: */
+            temp_working_memory_size,
+        /* input: */
+            input,
+        /* input_size: */
+            input_size,
+        /* dictionary_size: */
+            0,
+        /* is_last: */
+            1,
+        /* out_good: */
+            out_good);
+}
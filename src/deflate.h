@@ -0,0 +1,135 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+/*
+The other direction: compress bytes with the DEFLATE algorithm, so that
+inflate() (or zlib, or any .png or .gz reader) can decompress them again.
+
+Like inflate(), deflate() takes the whole input at once and writes into a
+recipient you provide. There's no hidden allocation during compression: the
+hash tables live in temp_working_memory, which you can reuse for every call.
+
+The level picks the trade-off between speed and size, like in zlib and gzip:
+- 0: no compression at all, only 'stored' blocks (fastest, but bigger than
+  the input)
+- 1 to 3: take the first good match we find ('greedy')
+- 4 to 9: before taking a match, check if the next byte starts a longer one
+  ('lazy'), and search longer for the best match
+
+For every block, we compute what it would cost as a dynamic huffman block, a
+fixed huffman block and a stored block, and write the smallest.
+*/
+
+// #define DEFLATE_SILENCE // don't printf() errors
+// #define DEFLATE_IGNORE_ASSERTS
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEFLATE_MIN_LEVEL 0
+#define DEFLATE_MAX_LEVEL 9
+#define DEFLATE_DEFAULT_LEVEL 6
+
+/*
+The lookup tables the encoder needs, and the functions you gave it. Create
+1 for each thread that compresses.
+
+returns NULL if malloc_funcptr failed
+
+** Example:
+** DeflateContext * context =
+**     deflate_context_create(malloc, free, memset, memcpy);
+** ...
+** deflate_context_destroy(context);
+*/
+typedef struct DeflateContext DeflateContext;
+
+DeflateContext * deflate_context_create(
+    void * (* malloc_funcptr)(uint64_t __size),
+    void (* free_funcptr)(void * to_free),
+    void * (* memset_funcptr)(void * str, int c, uint64_t n),
+    void * (* memcpy_funcptr)(void * dest, const void * src, uint64_t n));
+
+void deflate_context_destroy(
+    DeflateContext * context);
+
+/*
+The amount of temp_working_memory that deflate() needs, for any input and
+any level (a few hundred KB)
+*/
+uint64_t deflate_working_memory_required(void);
+
+/*
+The biggest the output of deflate() can ever be for input_size bytes. If
+your recipient is at least this big, deflate() can't run out of room.
+*/
+uint64_t deflate_bound(
+    const uint64_t input_size);
+
+/*
+Compress input into raw DEFLATE data (without a zlib or gzip header)
+
+- context: from deflate_context_create(), only use it from 1 thread at a time
+- level: DEFLATE_MIN_LEVEL to DEFLATE_MAX_LEVEL, see above
+- recipient: the receiving memory to compress to
+- recipient_size: the capacity in bytes of recipient
+- final_recipient_size: will be set to the amount of bytes written
+- temp_working_memory: deflate_working_memory_required() bytes for the hash
+  tables. It doesn't need to be zeroed, and you can reuse it right after.
+- temp_working_memory_size: the capacity in bytes of temp_working_memory
+- input: the data to compress
+- input_size: the size in bytes of input
+- out_good: will be set to 1 on success, and 0 on failure (for example if
+  recipient was too small)
+*/
+void deflate(
+    DeflateContext * context,
+    const uint32_t level,
+    uint8_t * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    uint8_t const * input,
+    const uint64_t input_size,
+    uint32_t * out_good);
+
+/*
+Compress 1 piece of a bigger input, so several threads can each compress a
+piece and you can just concatenate their outputs (this is what
+deflate_parallel.h does, the same way pigz does it)
+
+- input: the piece to compress
+- dictionary_size: how many bytes right before input (in the same buffer)
+  matches may refer back to, usually the 32KiB before the piece, and 0 for
+  the first piece. input[-dictionary_size] must be readable.
+- is_last: 1 for the last piece, whose last block is marked final. Any
+  other piece ends with an empty stored block (a 'sync flush' in zlib), so
+  its output ends on a byte boundary.
+
+The other parameters are the same as for deflate(), and deflate_bound() of
+the piece's size is also always enough here.
+*/
+void deflate_chunk(
+    DeflateContext * context,
+    const uint32_t level,
+    uint8_t * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    uint8_t const * input,
+    const uint64_t input_size,
+    const uint32_t dictionary_size,
+    const uint32_t is_last,
+    uint32_t * out_good);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DEFLATE_H
@@ -0,0 +1,389 @@
+#include "deflate_parallel.h"
+#include "crc32.h"
+#include "adler32.h"
+#include "parallel_tasks.h"
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+#ifndef DEFLATE_SILENCE
+#include <stdio.h>
+#endif
+
+#ifndef DEFLATE_IGNORE_ASSERTS
+#include <assert.h>
+#endif
+
+#define DEFLATE_PARALLEL_WINDOW_SIZE 32768
+#define DEFLATE_PARALLEL_GZIP_HEADER_SIZE 10
+#define DEFLATE_PARALLEL_GZIP_FOOTER_SIZE 8
+#define DEFLATE_PARALLEL_ZLIB_HEADER_SIZE 2
+#define DEFLATE_PARALLEL_ZLIB_FOOTER_SIZE 4
+
+/*
+1 chunk of the input, and what a thread made of it
+*/
+typedef struct DeflateParallelChunk {
+    uint64_t input_at;
+    uint64_t input_size;
+    uint8_t * output;
+    uint64_t output_size;
+    uint32_t checksum;
+    uint32_t good;
+} DeflateParallelChunk;
+
+typedef struct DeflateParallelShared {
+    uint8_t const * input;
+    uint32_t level;
+    uint32_t format;
+    void * (* malloc_func)(uint64_t __size);
+    
+    DeflateParallelChunk * chunks;
+    uint32_t chunks_size;
+} DeflateParallelShared;
+
+typedef struct DeflateParallelThread {
+    DeflateParallelShared * shared;
+    DeflateContext * context;
+    uint8_t * working_memory;
+    uint64_t working_memory_size;
+} DeflateParallelThread;
+
+uint64_t deflate_parallel_bound(
+    const uint64_t input_size)
+{
+    uint64_t chunks_size =
+        (input_size + DEFLATE_PARALLEL_CHUNK_SIZE - 1) /
+            DEFLATE_PARALLEL_CHUNK_SIZE;
+    if (chunks_size < 1) {
+        chunks_size = 1;
+    }
+    
+    // deflate_bound() per chunk is at most this, summed over all chunks
+    return
+        deflate_bound(input_size) +
+        deflate_bound(0) * chunks_size +
+        DEFLATE_PARALLEL_GZIP_HEADER_SIZE +
+        DEFLATE_PARALLEL_GZIP_FOOTER_SIZE;
+}
+
+static void compress_chunk(
+    void * thread_ptr,
+    const uint32_t chunk_i)
+{
+    DeflateParallelThread * thread = (DeflateParallelThread *)thread_ptr;
+    DeflateParallelShared * shared = thread->shared;
+    DeflateParallelChunk * chunk = shared->chunks + chunk_i;
+    uint8_t const * input = shared->input + chunk->input_at;
+    
+    uint64_t output_capacity = deflate_bound(chunk->input_size);
+    chunk->output = (uint8_t *)shared->malloc_func(output_capacity);
+    if (chunk->output == NULL) {
+        return;
+    }
+    
+    deflate_chunk(
+        /* context: */
+            thread->context,
+        /* level: */
+            shared->level,
+        /* recipient: */
+            chunk->output,
+        /* recipient_size: */
+            output_capacity,
+        /* final_recipient_size: */
+            &chunk->output_size,
+        /* temp_working_memory: */
+            thread->working_memory,
+        /* temp_working_memory_size: */
+            thread->working_memory_size,
+        /* input: */
+            input,
+        /* input_size: */
+            chunk->input_size,
+        /* dictionary_size: */
+            chunk->input_at > DEFLATE_PARALLEL_WINDOW_SIZE ?
+                DEFLATE_PARALLEL_WINDOW_SIZE :
+                (uint32_t)chunk->input_at,
+        /* is_last: */
+            chunk_i + 1 == shared->chunks_size,
+        /* out_good: */
+            &chunk->good);
+    
+    if (shared->format == DEFLATE_PARALLEL_ZLIB) {
+        chunk->checksum = adler32_update(
+            ADLER32_INITIAL_VALUE,
+            input,
+            chunk->input_size);
+    } else if (shared->format == DEFLATE_PARALLEL_GZIP) {
+        chunk->checksum = crc32_update(
+            CRC32_INITIAL_VALUE,
+            input,
+            chunk->input_size);
+    }
+}
+
+/*
+Write the header for format at recipient
+
+returns the amount of bytes written
+*/
+static uint32_t write_header(
+    const uint32_t format,
+    const uint32_t level,
+    uint8_t * recipient)
+{
+    if (format == DEFLATE_PARALLEL_ZLIB) {
+        // CM 8 (deflate) with a 32KiB window, FLEVEL is only a hint
+        uint32_t CMF = 0x78;
+        uint32_t FLEVEL = level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3;
+        uint32_t FLG = FLEVEL << 6;
+        FLG += 31 - ((CMF * 256 + FLG) % 31);
+        recipient[0] = (uint8_t)CMF;
+        recipient[1] = (uint8_t)FLG;
+        return DEFLATE_PARALLEL_ZLIB_HEADER_SIZE;
+    }
+    
+    if (format == DEFLATE_PARALLEL_GZIP) {
+        recipient[0] = 0x1f;
+        recipient[1] = 0x8b;
+        recipient[2] = 8; // CM: deflate
+        recipient[3] = 0; // FLG: no name, comment or extra field
+        recipient[4] = 0; // MTIME: 0 means 'not available'
+        recipient[5] = 0;
+        recipient[6] = 0;
+        recipient[7] = 0;
+        recipient[8] = level == 9 ? 2 : level == 1 ? 4 : 0; // XFL
+        recipient[9] = 255; // OS: unknown
+        return DEFLATE_PARALLEL_GZIP_HEADER_SIZE;
+    }
+    
+    return 0;
+}
+
+/*
+Write the footer for format at recipient
+
+returns the amount of bytes written
+*/
+static uint32_t write_footer(
+    const uint32_t format,
+    const uint32_t checksum,
+    const uint64_t input_size,
+    uint8_t * recipient)
+{
+    if (format == DEFLATE_PARALLEL_ZLIB) {
+        // zlib is big endian
+        for (uint32_t i = 0; i < 4; i++) {
+            recipient[i] = (uint8_t)(checksum >> (24 - i * 8));
+        }
+        return DEFLATE_PARALLEL_ZLIB_FOOTER_SIZE;
+    }
+    
+    if (format == DEFLATE_PARALLEL_GZIP) {
+        // gzip is little endian, and ISIZE is the size modulo 2^32
+        for (uint32_t i = 0; i < 4; i++) {
+            recipient[i] = (uint8_t)(checksum >> (i * 8));
+            recipient[4 + i] = (uint8_t)(input_size >> (i * 8));
+        }
+        return DEFLATE_PARALLEL_GZIP_FOOTER_SIZE;
+    }
+    
+    return 0;
+}
+
+void deflate_parallel(
+    const uint32_t threads_count,
+    const uint32_t level,
+    const uint32_t format,
+    void * (* malloc_funcptr)(uint64_t __size),
+    void (* free_funcptr)(void * to_free),
+    void * (* memset_funcptr)(void * str, int c, uint64_t n),
+    void * (* memcpy_funcptr)(void * dest, const void * src, uint64_t n),
+    uint8_t const * input,
+    const uint64_t input_size,
+    uint8_t * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint32_t * out_good)
+{
+    #ifndef DEFLATE_IGNORE_ASSERTS
+    assert(threads_count > 0);
+    assert(format <= DEFLATE_PARALLEL_GZIP);
+    #endif
+    
+    *out_good = 0;
+    *final_recipient_size = 0;
+    
+    if (level > DEFLATE_MAX_LEVEL) {
+        #ifndef DEFLATE_SILENCE
+        printf(
+            "deflate_parallel() ERROR: level %u, but the highest level is "
+            "%u\n",
+            level,
+            DEFLATE_MAX_LEVEL);
+        #endif
+        return;
+    }
+    
+    uint64_t chunks_size_64 =
+        (input_size + DEFLATE_PARALLEL_CHUNK_SIZE - 1) /
+            DEFLATE_PARALLEL_CHUNK_SIZE;
+    uint32_t chunks_size = chunks_size_64 < 1 ? 1 : (uint32_t)chunks_size_64;
+    
+    uint32_t threads_size = threads_count;
+    if (threads_size > chunks_size) {
+        threads_size = chunks_size;
+    }
+    
+    // the checksum of no bytes at all, we combine each chunk's into it
+    uint32_t checksum = 0;
+    if (format == DEFLATE_PARALLEL_ZLIB) {
+        checksum = ADLER32_INITIAL_VALUE;
+    } else if (format == DEFLATE_PARALLEL_GZIP) {
+        checksum = CRC32_INITIAL_VALUE;
+    }
+    
+    DeflateParallelShared shared;
+    shared.input = input;
+    shared.level = level;
+    shared.format = format;
+    shared.malloc_func = malloc_funcptr;
+    shared.chunks_size = chunks_size;
+    shared.chunks = (DeflateParallelChunk *)malloc_funcptr(
+        sizeof(DeflateParallelChunk) * chunks_size);
+    DeflateParallelThread * threads = (DeflateParallelThread *)malloc_funcptr(
+        sizeof(DeflateParallelThread) * threads_size);
+    
+    uint32_t threads_made = 0;
+    uint32_t all_allocated = shared.chunks != NULL && threads != NULL;
+    
+    for (uint32_t i = 0; all_allocated && i < threads_size; i++) {
+        threads[i].shared = &shared;
+        threads[i].working_memory_size = deflate_working_memory_required();
+        threads[i].working_memory = (uint8_t *)malloc_funcptr(
+            threads[i].working_memory_size);
+        threads[i].context = deflate_context_create(
+            malloc_funcptr,
+            free_funcptr,
+            memset_funcptr,
+            memcpy_funcptr);
+        threads_made = i + 1;
+        
+        all_allocated =
+            threads[i].working_memory != NULL &&
+            threads[i].context != NULL;
+    }
+    
+    if (!all_allocated) {
+        #ifndef DEFLATE_SILENCE
+        printf("deflate_parallel() ERROR: malloc_funcptr failed\n");
+        #endif
+    } else {
+        for (uint32_t i = 0; i < chunks_size; i++) {
+            uint64_t at = (uint64_t)i * DEFLATE_PARALLEL_CHUNK_SIZE;
+            shared.chunks[i].input_at = at;
+            shared.chunks[i].input_size =
+                input_size - at > DEFLATE_PARALLEL_CHUNK_SIZE ?
+                    DEFLATE_PARALLEL_CHUNK_SIZE :
+                    input_size - at;
+            shared.chunks[i].output = NULL;
+            shared.chunks[i].output_size = 0;
+            shared.chunks[i].checksum = 0;
+            shared.chunks[i].good = 0;
+        }
+        
+        parallel_tasks_run(
+            /* run_task: */ compress_chunk,
+            /* threads_data: */ threads,
+            /* thread_data_size: */ sizeof(DeflateParallelThread),
+            /* threads_size: */ threads_size,
+            /* tasks_size: */ chunks_size,
+            /* malloc_funcptr: */ malloc_funcptr,
+            /* free_funcptr: */ free_funcptr);
+        
+        /*
+        Now stitch it all together in order: the header, every chunk's
+        output, and the footer with the combined checksum
+        */
+        uint32_t good = 1;
+        uint64_t output_size = 0;
+        if (recipient_size < DEFLATE_PARALLEL_GZIP_HEADER_SIZE) {
+            good = 0;
+        } else {
+            output_size = write_header(format, level, recipient);
+        }
+        
+        for (uint32_t i = 0; good && i < chunks_size; i++) {
+            DeflateParallelChunk * chunk = shared.chunks + i;
+            if (!chunk->good) {
+                good = 0;
+                break;
+            }
+            
+            if (recipient_size - output_size < chunk->output_size) {
+                good = 0;
+                break;
+            }
+            memcpy_funcptr(
+                recipient + output_size,
+                chunk->output,
+                chunk->output_size);
+            output_size += chunk->output_size;
+            
+            if (format == DEFLATE_PARALLEL_ZLIB) {
+                checksum = adler32_combine(
+                    checksum,
+                    chunk->checksum,
+                    chunk->input_size);
+            } else if (format == DEFLATE_PARALLEL_GZIP) {
+                checksum = crc32_combine(
+                    checksum,
+                    chunk->checksum,
+                    chunk->input_size);
+            }
+        }
+        
+        if (
+            good &&
+            recipient_size - output_size < DEFLATE_PARALLEL_GZIP_FOOTER_SIZE)
+        {
+            good = 0;
+        }
+        
+        if (good) {
+            output_size += write_footer(
+                /* format: */ format,
+                /* checksum: */ checksum,
+                /* input_size: */ input_size,
+                /* recipient: */ recipient + output_size);
+            *final_recipient_size = output_size;
+            *out_good = 1;
+        } else {
+            #ifndef DEFLATE_SILENCE
+            printf(
+                "deflate_parallel() ERROR: a chunk failed to compress, or "
+                "recipient_size %llu is too small, deflate_parallel_bound() "
+                "is always enough\n",
+                recipient_size);
+            #endif
+        }
+        
+        for (uint32_t i = 0; i < chunks_size; i++) {
+            if (shared.chunks[i].output != NULL) {
+                free_funcptr(shared.chunks[i].output);
+            }
+        }
+    }
+    
+    for (uint32_t i = 0; i < threads_made; i++) {
+        if (threads[i].working_memory != NULL) {
+            free_funcptr(threads[i].working_memory);
+        }
+        deflate_context_destroy(threads[i].context);
+    }
+    
+    if (threads != NULL) { free_funcptr(threads); }
+    if (shared.chunks != NULL) { free_funcptr(shared.chunks); }
+}
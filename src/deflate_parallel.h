@@ -0,0 +1,90 @@
+#ifndef DEFLATE_PARALLEL_H
+#define DEFLATE_PARALLEL_H
+
+/*
+Compress 1 big input on several threads, into 1 normal stream that any
+inflate(), zlib or gzip can read. This is how pigz does it:
+
+1. Split the input into chunks. Each thread takes a chunk and compresses it
+   with deflate_chunk(), using the 32KiB of input before the chunk as a
+   dictionary, so matches can still reach back into the chunk before it.
+2. Every chunk but the last ends with an empty stored block (a 'sync
+   flush'), so it ends on a byte boundary, and we can simply concatenate the
+   outputs of all chunks.
+3. Each thread also computes the checksum of its chunk, and we combine those
+   into the checksum of the whole input (see crc32_combine() and
+   adler32_combine()).
+
+The output is a little bigger than what deflate() gives you on 1 thread:
+each chunk starts new blocks and costs 5 bytes for the sync flush. With 1MiB
+chunks, that's hardly noticeable.
+
+This file needs parallel_tasks.c, crc32.c, adler32.c and POSIX threads (link
+with -lpthread). If you don't have pthreads, #define
+PARALLEL_TASKS_SINGLE_THREADED and everything will run on the calling thread
+instead.
+*/
+
+/*
+How many bytes of input each thread compresses at once. Smaller chunks give
+more parallelism, but each one costs a few bytes of output, and matches can't
+reach into the chunk before it further than 32KiB.
+*/
+#ifndef DEFLATE_PARALLEL_CHUNK_SIZE
+#define DEFLATE_PARALLEL_CHUNK_SIZE (1024 * 1024)
+#endif
+
+#include "deflate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+What to wrap the DEFLATE data in
+*/
+#define DEFLATE_PARALLEL_RAW 0  // no header, no checksum
+#define DEFLATE_PARALLEL_ZLIB 1 // 2 byte header, adler32 at the end
+#define DEFLATE_PARALLEL_GZIP 2 // 10 byte header, crc32 and size at the end
+
+/*
+The biggest the output of deflate_parallel() can ever be for input_size
+bytes, including the header and footer of any format
+*/
+uint64_t deflate_parallel_bound(
+    const uint64_t input_size);
+
+/*
+The same as deflate(), but on up to threads_count threads (including the
+calling thread), and with a zlib or gzip header and footer if you want.
+
+- threads_count: usually the amount of cores you have
+- level: DEFLATE_MIN_LEVEL to DEFLATE_MAX_LEVEL, see deflate.h
+- format: DEFLATE_PARALLEL_RAW, DEFLATE_PARALLEL_ZLIB or DEFLATE_PARALLEL_GZIP
+- input: the data to compress
+- recipient: the receiving memory to compress to
+- recipient_size: the capacity in bytes of recipient, deflate_parallel_bound()
+  is always enough
+- final_recipient_size: will be set to the amount of bytes written
+- out_good: will be set to 1 on success, and 0 on failure
+*/
+void deflate_parallel(
+    const uint32_t threads_count,
+    const uint32_t level,
+    const uint32_t format,
+    void * (* malloc_funcptr)(uint64_t __size),
+    void (* free_funcptr)(void * to_free),
+    void * (* memset_funcptr)(void * str, int c, uint64_t n),
+    void * (* memcpy_funcptr)(void * dest, const void * src, uint64_t n),
+    uint8_t const * input,
+    const uint64_t input_size,
+    uint8_t * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint32_t * out_good);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // DEFLATE_PARALLEL_H
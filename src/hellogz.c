@@ -56,7 +56,7 @@ int main(int argc, const char * argv[])
     fclose(gzipfile);
     assert(bytes_read == fsize);
     
-    init_decode_gz(malloc, memset, memcpy);
+    init_decode_gz(malloc, realloc, free, memset, memcpy);
     
     printf("contents: %s\n", (char *)buffer);
     
@@ -12,56 +12,35 @@
 #include <assert.h>
 #endif
 
+#if !defined(INFLATE_SCALAR_ONLY) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    defined(__GNUC__)
+#define INFLATE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
 #define FIXED_HCLEN_TABLE_SIZE 288
+#define FIXED_DIST_TABLE_SIZE 30
 #define NUM_UNIQUE_CODELENGTHS 19
-typedef struct InflateState {
-    uint32_t fixed_hclen_table[FIXED_HCLEN_TABLE_SIZE];
-    uint32_t swizzled_HCLEN_table[NUM_UNIQUE_CODELENGTHS];
-} InflateState;
-
-#define INFLATE_MAX_THREADS 10
-static InflateState * ifs[INFLATE_MAX_THREADS];
-
+// dynamic blocks can declare at most this many codes (HLIT and HDIST)
+#define INFLATE_MAX_LITLEN_CODES 286
+#define INFLATE_MAX_DIST_CODES 30
 static const uint32_t swizzle[] = {
 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
 
-static void * (* memset_func)(void * str, int c, uint64_t n) = NULL;
-static void * (* memcpy_func)(void * dest, const void * src, uint64_t n) = NULL;
-
 #ifndef NULL
 #define NULL 0
 #endif
 
-#define MAPARRAY_CODELENGTH_BITS 4 // stores up to 15, we need only 12
-#define MAPARRAY_MAP_BITS 12 // code lengths 12 or less are in the map
-#define HUFFMAN_HASHMAP_SIZE 65536 // 2^16, enough to concatenate 4 + 12
-#define HUFFMAN_LINEAR_ARRAY_SIZE 500 // for code lengths 13 or higher
-
-void inflate_init(
-    void * (* malloc_funcptr)(uint64_t __size),
-    void * (* arg_memset_func)(void *str, int c, uint64_t n),
-    void * (* arg_memcpy_func)(void * dest, const void * src, uint64_t n),
-    const uint32_t thread_id)
-{
-    #ifndef INFLATE_IGNORE_ASSERTS
-    assert(ifs[thread_id] == NULL);
-    #endif
-    
-    if (ifs[thread_id] == NULL) {
-        ifs[thread_id] = malloc_funcptr(sizeof(InflateState));
-    }
-    
-    memset_func = arg_memset_func;
-    memcpy_func = arg_memcpy_func;
-}
-
-void inflate_destroy(
-    void (* free_funcptr)(void * to_free),
-    const uint32_t thread_id)
-{
-    free_funcptr(ifs[thread_id]->fixed_hclen_table);
-    free_funcptr(ifs[thread_id]->swizzled_HCLEN_table);
-}
+#define HUFFMAN_MAX_CODE_LENGTH 15 // the spec never allows longer codes
+#define HUFFMAN_LITLEN_ROOT_BITS 10
+#define HUFFMAN_DIST_ROOT_BITS 8
+#define HUFFMAN_CODELENGTHS_ROOT_BITS 7 // code length codes are max 7 bits
+// Worst case amount of entries (root table + all subtables) for 288
+// symbols with a 10-bit root table and codes of up to 15 bits. The distance
+// table (32 symbols, 8-bit root) needs at most 402 and the code lengths
+// table needs exactly 128, so 1 size fits all of our tables.
+#define HUFFMAN_TABLE_SIZE 1334
 
 static void align_memory(
     uint8_t ** memory_store,
@@ -69,7 +48,10 @@ static void align_memory(
 {
     while ((uintptr_t)(void *)*memory_store % 16 != 0) {
         *memory_store += 1;
-        *memory_store_size_remaining -= 1;
+        // never wrap around, the size check after us will fail instead
+        if (*memory_store_size_remaining > 0) {
+            *memory_store_size_remaining -= 1;
+        }
     }
     
     #ifndef INFLATE_IGNORE_ASSERTS
@@ -80,42 +62,187 @@ static void align_memory(
 /*
 Since we need to consume partial bytes (and leave remaining bits in a buffer),
 we're using this data structure.
+
+bit_buffer holds up to 64 bits that were already loaded from data, the next
+bit of the stream is always the lowest bit of bit_buffer. We refill it 8 bytes
+at a time, so most codes and extra bits can be read without touching data at
+all.
+
+When we're near the end of the input we can't load 8 bytes at a time anymore,
+and we load zeroes instead of reading past data_end. overrun_bytes counts the
+zero bytes we invented that way, so we can tell when a stream was truncated.
 */
 typedef struct DataStream {
     uint8_t * data;
+    uint8_t * data_end;
     
+    uint64_t bit_buffer;
     uint32_t bits_left;
-    uint8_t bit_buffer;
     
-    uint64_t size_left;
+    uint32_t overrun_bytes;
 } DataStream;
 
 /*
-'Huffman encoding' is a famous compression algorithm
+We'll store our huffman codes in a lookup table that is indexed directly with
+the next few bits of the data stream (the 'root' bits).
+
+Every code that is root_bits long or shorter is stored in the root table many
+times over: a 7-bit code in a 10-bit table is stored at every index whose
+lowest 7 bits match the code, so it doesn't matter what the 3 bits after it
+are.
+
+Codes that are longer than root_bits get a 'link' in the root table instead,
+which points to a small subtable that is indexed with the bits that come after
+the root bits. That way we find any code in 1 lookup, or 2 for the (rare)
+long codes.
+*/
+/*
+Each entry also tells us what kind of value we decoded. For lengths and
+distances, the entry holds the base value and the amount of extra bits that
+follow the code, so we don't need to look them up in a second table.
 */
-typedef struct HuffmanEntry {
-    uint32_t key;
-    uint32_t value;
-    uint32_t used;
-    uint16_t code_length;
-} HuffmanEntry;
+#define HUFFMAN_ENTRY_INVALID 0 // no such code (must be 0)
+#define HUFFMAN_ENTRY_LITERAL 1 // value is the decoded symbol itself
+#define HUFFMAN_ENTRY_LENGTH 2 // value is the base length
+#define HUFFMAN_ENTRY_DISTANCE 3 // value is the base distance
+#define HUFFMAN_ENTRY_END_OF_BLOCK 4
+#define HUFFMAN_ENTRY_SUBTABLE 5 // value is the index of a subtable
+typedef struct HuffmanTableEntry {
+    uint16_t value;
+    uint8_t code_length; // bits to discard
+    uint8_t kind;
+    uint8_t extra_bits; // extra bits to read, or bits to index a subtable
+} HuffmanTableEntry;
+
+// Tells build_huffman_table() which kinds of entries to make
+#define HUFFMAN_ALPHABET_CODELENGTHS 0
+#define HUFFMAN_ALPHABET_LITLEN 1
+#define HUFFMAN_ALPHABET_DIST 2
+
+/*
+Most symbols in real data are literals with short codes, so a 10-bit lookup
+often holds the codes of 2 or 3 literals in a row. For literal/length tables,
+inflate() first looks at packed_literals, which has 1 entry per root index:
+
+bits 0-23: up to 3 literals, the first one in the lowest byte
+bits 24-27: the total code length of those literals
+bits 28-29: how many literals there are, 0 if the next symbol isn't a literal
+            (then use entries as usual). Bytes past that count are garbage.
+
+See pack_literals()
+*/
+#define HUFFMAN_PACKED_MAX_LITERALS 3
+#define HUFFMAN_PACKED_LENGTH_SHIFT 24
+#define HUFFMAN_PACKED_COUNT_SHIFT 28
+
+typedef struct HuffmanTable {
+    HuffmanTableEntry entries[HUFFMAN_TABLE_SIZE];
+    uint32_t packed_literals[1 << HUFFMAN_LITLEN_ROOT_BITS];
+    uint32_t root_bits;
+    uint32_t entries_used;
+} HuffmanTable;
 
 /*
-We'll store our huffman codes in an improvised hashmap
+Everything inflate() needs besides its arguments. Callers create 1 per
+thread with inflate_context_create(), and contexts don't share anything with
+each other, so any amount of threads can decode at the same time.
 */
-typedef struct HashedHuffmanEntry {
-   uint32_t key;
-   uint32_t value;
-   uint16_t code_length;
-} HashedHuffmanEntry;
-
-typedef struct HashedHuffman {
-    HashedHuffmanEntry maparray[
-        HUFFMAN_HASHMAP_SIZE + HUFFMAN_LINEAR_ARRAY_SIZE];
-    uint32_t maparray_array_size;
-    uint32_t min_code_length;
-    uint32_t max_code_length;
-} HashedHuffman;
+struct InflateContext {
+    void * (* malloc_func)(uint64_t size);
+    void (* free_func)(void * to_free);
+    void * (* memset_func)(void * str, int c, uint64_t n);
+    void * (* memcpy_func)(void * dest, const void * src, uint64_t n);
+    
+    HuffmanTable fixed_litlen_table;
+    HuffmanTable fixed_dist_table;
+    
+    // the fast decode loop for this CPU, see pick_decode_kernel()
+    uint32_t (* decode_kernel)(
+        struct InflateContext * context,
+        DataStream * data_stream,
+        HuffmanTable * litlen_table,
+        HuffmanTable * dist_table,
+        uint8_t const * recipient,
+        uint8_t ** recipient_cursor,
+        uint8_t const * recipient_end);
+    
+    #ifdef INFLATE_STATS
+    InflateStats * stats; // NULL when we're not collecting
+    #endif
+};
+
+typedef struct ExtraBitsEntry {
+    uint32_t value;
+    uint32_t num_extra_bits;
+    uint32_t base_decoded;
+} ExtraBitsEntry;
+
+// This table is defined in the deflate algorithm specification
+// https://www.ietf.org/rfc/rfc1951.txt
+static ExtraBitsEntry length_extra_bits_table[] = {
+    {257, 0, 3}, // value, length_extra_bits, base_decoded
+    {258, 0, 4},
+    {259, 0, 5},
+    {260, 0, 6},
+    {261, 0, 7},
+    {262, 0, 8},
+    {263, 0, 9},
+    {264, 0, 10},
+    {265, 1, 11},
+    {266, 1, 13},
+    {267, 1, 15}, // index 10
+    {268, 1, 17},
+    {269, 2, 19},
+    {270, 2, 23},
+    {271, 2, 27},
+    {272, 2, 31},
+    {273, 3, 35},
+    {274, 3, 43},
+    {275, 3, 51},
+    {276, 3, 59},
+    {277, 4, 67}, // index 20
+    {278, 4, 83},
+    {279, 4, 99},
+    {280, 4, 115},
+    {281, 5, 131},
+    {282, 5, 163},
+    {283, 5, 195},
+    {284, 5, 227},
+    {285, 0, 258}, // index 28
+};
+
+static ExtraBitsEntry dist_extra_bits_table[] = {
+    {0, 0, 1}, // value, distance_extra_bits, base_decoded
+    {1, 0, 2},
+    {2, 0, 3},
+    {3, 0, 4},
+    {4, 1, 5},
+    {5, 1, 7},
+    {6, 2, 9},
+    {7, 2, 13},
+    {8, 3, 17},
+    {9, 3, 25},
+    {10, 4, 33},
+    {11, 4, 49},
+    {12, 5, 65}, // we want 88? 88 - 65 = 23. 12 + 10111
+    {13, 5, 97},
+    {14, 6, 129},
+    {15, 6, 193},
+    {16, 7, 257},
+    {17, 7, 385},
+    {18, 8, 513},
+    {19, 8, 769},
+    {20, 9, 1025},
+    {21, 9, 1537},
+    {22, 10, 2049},
+    {23, 10, 3073},
+    {24, 11, 4097},
+    {25, 11, 6145},
+    {26, 12, 8193},
+    {27, 12, 12289},
+    {28, 13, 16385},
+    {29, 13, 24577},
+};
 
 inline static uint32_t mask_rightmost_bits(
     const uint32_t input,
@@ -219,146 +346,67 @@ static uint32_t reverse_bit_order(
     return mask_leftmost_bits(return_value, bit_count);
 }
 
-/*
-Look at the top bits of our data stream, but keep them inplace
-*/
-inline static uint32_t peek_bits(
-    DataStream * from,
-    uint32_t bits_to_peek)
+inline static uint64_t load_u64_little_endian(
+    const uint8_t * from)
 {
-    uint32_t return_value = 0;
-    uint32_t bits_in_return = 0;
-    
-    // read from the bit buffer first (up to 7 bits)
-    uint32_t num_to_read_from_bitbuf =
-        ((bits_to_peek  > from->bits_left) * from->bits_left) +
-        ((bits_to_peek <= from->bits_left) * bits_to_peek);
-    
-    return_value =
-        mask_rightmost_bits(
-            /* input: */
-                from->bit_buffer,
-            /* amount: */
-                num_to_read_from_bitbuf);
-    bits_to_peek -= num_to_read_from_bitbuf;
-    bits_in_return += num_to_read_from_bitbuf;
-    
-    // now read from the byte buffer
-    uint8_t * peek_at = from->data;
-    uint32_t bytes_to_peek = bits_to_peek / 8;
-    #ifndef INFLATE_IGNORE_ASSERTS
-    assert(bytes_to_peek < 4);
-    #endif
-    uint32_t next_bytes =
-        (uint32_t)peek_at[0] |
-        ((uint32_t)peek_at[1] << 8) |
-        ((uint32_t)peek_at[2] << 16) |
-        ((uint32_t)peek_at[3] << 24);
-    next_bytes &= ((1 << (bytes_to_peek * 8)) - 1);
-    
-    return_value += (next_bytes << bits_in_return);
-    
-    bits_to_peek   -= bytes_to_peek * 8;
-    bits_in_return += bytes_to_peek * 8;
-    peek_at        += bytes_to_peek;
-    
-    // Add bits from the final byte
-    // here again, if there were bits in the return
-    // the new byte is 'more significant'
-    // so again the return value stays the same and
-    // the new partial byte gets bitshifted left
-    uint32_t partial_new_byte = 
-        mask_rightmost_bits(
-            /* input: */ *peek_at,
-            /* amount: */ bits_to_peek);
-    partial_new_byte <<= bits_in_return;
-    return_value |= partial_new_byte;
-    
-    return return_value;
+    // compilers recognize this pattern and turn it into a single load
+    return
+        ((uint64_t)from[0]      ) |
+        ((uint64_t)from[1] <<  8) |
+        ((uint64_t)from[2] << 16) |
+        ((uint64_t)from[3] << 24) |
+        ((uint64_t)from[4] << 32) |
+        ((uint64_t)from[5] << 40) |
+        ((uint64_t)from[6] << 48) |
+        ((uint64_t)from[7] << 56);
 }
 
 /*
-For our hashmaps, we need a hash function to index them given the key & code
-length (in bits) we're looking for
-
-We'll store the reversed bits of the key, not the key, since that's always what
-we'll be looking for
-
-By definition, a compression algorithm, since it's trying to make stuff smaller,
-will very rarely produce something with a code length of > 8 bits. That's why
-I want to be able to find the keys of few bits very quickly, and am OK with
-sifting through a slower list afterwards for the longer code lengths
-
-The code length itself goes from 2 to and including 19, so we can pretend it's
-1 to 18 if we wanted
+Top up our bit buffer so that it holds at least 56 bits
 
-to store a number of to 15, we need 4 bits with some waste:
-8421
-1111
-
-so we can choose some number of bits (up to 15) + 4 to be our hashmap size
-
-I would guess 11 bits is a good number so it fits in a uint16, and that means
-our reversed key can be a uint16
-
-16-bit KEY for code lengths 11 or smaller:
- LENGTH (4)   KEY (11 bits)
-[ . . . . ] [ . . . . . . . . . . . ]
-
-of course to store this hashmap we need 65,536 entries, and all of them will
-be about 10 bytes, so that will be 650+ kilobytes, and we'll be making multiple
-maps, so our memory use will be a couple of megabytes. I'm OK with that.
-
-This way looking up a value in the map will go like this:
-** If the value has a code length of 11 or less:
- -> insta-lookup without any chance of conflicts (fast)
-** else:
--> find it in a linear list (slow)
+When there are 8 or more bytes left, we load a whole word at once. The bytes
+that fit entirely are consumed, the bits of the byte that didn't fit end up
+above bits_left, and get loaded again (to the same position) next time.
 */
-static uint32_t maparray_compute_hash(
-    HashedHuffman * in_maparray,
-    uint32_t reversed_key,
-    uint32_t code_length_bits)
-{
-    if (code_length_bits <= MAPARRAY_MAP_BITS) {
-        uint16_t concatenated_key =
-            (uint16_t)((code_length_bits << 12) | reversed_key);
-        
-        #ifndef INFLATE_IGNORE_ASSERTS
-        if (in_maparray->maparray[concatenated_key].key != 0) {
-            assert(
-                in_maparray->maparray[concatenated_key].key ==
-                    reversed_key);
-        }
-        if (in_maparray->maparray[concatenated_key].code_length != 0) {
-            assert(
-                in_maparray->maparray[concatenated_key].code_length ==
-                    code_length_bits);
-        }
-        #endif
-        
-        return concatenated_key;
+inline static void refill_bits(
+    DataStream * from)
+{
+    if (from->data_end - from->data >= 8) {
+        from->bit_buffer |=
+            load_u64_little_endian(from->data) << from->bits_left;
+        from->data += (63 - from->bits_left) >> 3;
+        from->bits_left |= 56;
+        return;
     }
     
-    // code length is greater than 12
-    for (uint32_t i = 0; i < in_maparray->maparray_array_size; i++) {
-        if (
-            in_maparray->maparray[i + HUFFMAN_HASHMAP_SIZE].key ==
-                reversed_key &&
-            in_maparray->maparray[i + HUFFMAN_HASHMAP_SIZE].code_length ==
-                code_length_bits)
-        {
-            return i + HUFFMAN_HASHMAP_SIZE;
+    // slow path for the last few bytes of our input
+    while (from->bits_left <= 56) {
+        if (from->data < from->data_end) {
+            from->bit_buffer |= (uint64_t)*from->data << from->bits_left;
+            from->data++;
+        } else {
+            from->overrun_bytes++;
         }
+        from->bits_left += 8;
     }
-    
-    in_maparray->maparray_array_size += 1;
-    
+}
+
+/*
+Look at the top bits of our data stream, but keep them inplace
+*/
+inline static uint32_t peek_bits(
+    DataStream * from,
+    const uint32_t bits_to_peek)
+{
     #ifndef INFLATE_IGNORE_ASSERTS
-    assert(in_maparray->maparray_array_size < HUFFMAN_LINEAR_ARRAY_SIZE);
+    assert(bits_to_peek < 33);
     #endif
     
-    return in_maparray->maparray_array_size + HUFFMAN_HASHMAP_SIZE - 1;
+    if (from->bits_left < bits_to_peek) {
+        refill_bits(from);
+    }
+    
+    return (uint32_t)(from->bit_buffer & ((1ull << bits_to_peek) - 1));
 }
 
 /*
@@ -366,29 +414,14 @@ Throw away the top x bits from our datastream
 */
 inline static void discard_bits(
     DataStream * from,
-    uint32_t amount)
-{
-    uint32_t bits_to_discard =
-        ((from->bits_left > amount) * amount) +
-        (from->bits_left <= amount) * from->bits_left;
-    from->bit_buffer >>= bits_to_discard;
-    from->bits_left -= bits_to_discard;
-    amount -= bits_to_discard;
-    
-    uint32_t full_bytes_to_discard = amount / 8;
-    from->data += full_bytes_to_discard;
-    from->size_left -= full_bytes_to_discard;
-    amount %= 8;
-    
-    from->bit_buffer =
-        (amount > 0) * (*(uint8_t *)from->data) +
-        (amount <= 0) * from->bit_buffer;
-    from->data += amount > 0;
-    from->size_left -= amount > 0;
-    from->bits_left =
-        ((amount > 0) * (8 - amount)) +
-        (amount == 0) * from->bits_left;
+    const uint32_t amount)
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(amount <= from->bits_left);
+    #endif
+    
     from->bit_buffer >>= amount;
+    from->bits_left -= amount;
 }
 
 static uint32_t consume_bits(
@@ -400,1566 +433,4106 @@ static uint32_t consume_bits(
     assert(amount < 33);
     #endif
     
-    uint32_t bits_to_consume = amount;
-    
     uint32_t return_val = peek_bits(
         from,
-        bits_to_consume);
+        amount);
     discard_bits(
         from,
-        bits_to_consume);
+        amount);
     
     return return_val;
 }
 
 /*
-Given a datastream and a hashmap of huffman codes,
-read & decompress/decode the next value
+Drop the bits of a partially consumed byte and hand any whole bytes that are
+still sitting in our bit buffer back to data, so that data points to the
+next unread byte. Stored blocks and the end of the stream need this.
 
-good will be set to 1 on succes, 0 on failure
+returns 0 if we already consumed bits that were past the end of the input
 */
-static uint32_t hashed_huffman_decode(
-    HashedHuffman * dict,
-    DataStream * datastream,
-    uint32_t * good)
+static uint32_t align_to_byte(
+    DataStream * from)
+{
+    discard_bits(from, from->bits_left & 7);
+    
+    uint32_t bytes_in_buffer = from->bits_left >> 3;
+    if (bytes_in_buffer < from->overrun_bytes) {
+        return 0;
+    }
+    
+    from->data -= (bytes_in_buffer - from->overrun_bytes);
+    from->overrun_bytes = 0;
+    from->bit_buffer = 0;
+    from->bits_left = 0;
+    
+    return 1;
+}
+
+/*
+1 if we consumed more bits than the input had, because the stream was
+truncated or corrupted
+*/
+inline static uint32_t read_past_end(
+    DataStream * from)
+{
+    return (from->bits_left >> 3) < from->overrun_bytes;
+}
+
+/*
+Given a datastream and a lookup table of huffman codes,
+read & decompress/decode the next entry
+
+Check the kind of the entry that's returned, it will be HUFFMAN_ENTRY_INVALID
+if the upcoming bits don't match any code in the table
+*/
+inline static HuffmanTableEntry huffman_table_decode(
+    HuffmanTable * table,
+    DataStream * datastream)
 {
     #ifndef INFLATE_IGNORE_ASSERTS
-    assert(dict != NULL);
+    assert(table != NULL);
     assert(datastream != NULL);
     #endif
     
-    uint32_t bitcount = dict->min_code_length - 1;
+    /*
+    Spec:
+    "Huffman codes are packed starting with the most-
+        significant bit of the code."
+    
+    Attention: The table is indexed with reversed codes already,
+    so we can just use the raw upcoming bits as an index
+    */
     uint32_t upcoming_bits = peek_bits(
         /* from: */ datastream,
-        /* bits_to_peek: */ 24);
-    uint32_t raw = 0;
+        /* bits_to_peek: */ HUFFMAN_MAX_CODE_LENGTH);
     
-    while (bitcount < dict->max_code_length) {
-        bitcount += 1;
-        
-        /*
-        Spec:
-        "Huffman codes are packed starting with the most-
-            significant bit of the code."
-        
-        Attention: The hash keys are already reversed,
-        so we can just compare the raw values to the keys 
-        */
-        raw = mask_rightmost_bits(upcoming_bits, bitcount);
-        
-        uint32_t hash = maparray_compute_hash(
-            /* in_maparray: */ dict,
-            /* reversed_key: */ raw,
-            /* code_length: */ bitcount);
-        
-        if (
-            dict->maparray[hash].key == raw
-            && dict->maparray[hash].code_length == bitcount)
-        {
-            discard_bits(datastream, bitcount);
-            *good = 1;
-            return dict->maparray[hash].value;
-        }
+    HuffmanTableEntry entry =
+        table->entries[
+            mask_rightmost_bits(upcoming_bits, table->root_bits)];
+    
+    if (entry.kind == HUFFMAN_ENTRY_SUBTABLE) {
+        entry = table->entries[
+            entry.value +
+                mask_rightmost_bits(
+                    upcoming_bits >> table->root_bits,
+                    entry.extra_bits)];
     }
     
     #ifndef INFLATE_SILENCE 
-    printf(
-        "failed to find raw :%u for codelen: %u in dict\n",
-        raw,
-        bitcount);
+    if (entry.kind == HUFFMAN_ENTRY_INVALID) {
+        printf(
+            "failed to find raw :%u in huffman table\n",
+            mask_rightmost_bits(upcoming_bits, HUFFMAN_MAX_CODE_LENGTH));
+    }
     #endif
-    *good = 0;
     
-    return 0;
+    discard_bits(datastream, entry.code_length);
+    
+    return entry;
 }
 
-static void construct_hashed_huffman(
-    HashedHuffman * to_construct)
+/*
+Read the extra bits that follow a length or distance code, and add them to
+the base value from the table
+*/
+inline static uint32_t decode_extra_bits(
+    HuffmanTableEntry entry,
+    DataStream * datastream)
 {
-    #ifndef INFLATE_IGNORE_ASSERTS
-    assert(to_construct != NULL);
-    #endif
+    uint32_t extra = peek_bits(datastream, entry.extra_bits);
+    discard_bits(datastream, entry.extra_bits);
     
-    memset_func(to_construct, 0, sizeof(HashedHuffman));
-    
-    to_construct->min_code_length = 9999;
-    to_construct->max_code_length = 1;
+    return entry.value + extra;
 }
 
 /*
-Convert an array of huffman codes to a hashmap of huffman codes
-
-working_memory_remaining is both an input & output variable
+What a table entry for a symbol should look like, before we know its code
 */
-static void huffman_to_hashmap(
-    HuffmanEntry * huffman_input,
-    const uint32_t huffman_input_size,
-    HashedHuffman * recipient)
+static HuffmanTableEntry make_table_entry(
+    const uint32_t alphabet,
+    const uint32_t symbol)
 {
-    #ifndef INFLATE_IGNORE_ASSERTS
-    assert(huffman_input  != NULL);
-    assert(huffman_input_size > 0);
-    #endif
+    HuffmanTableEntry entry;
+    entry.value = (uint16_t)symbol;
+    entry.code_length = 0;
+    entry.kind = HUFFMAN_ENTRY_LITERAL;
+    entry.extra_bits = 0;
     
-    construct_hashed_huffman(recipient);
-    
-    for (uint32_t i = 0; i < huffman_input_size; i++)
-    {
-        if (!huffman_input[i].used) {
-            continue;
+    if (alphabet == HUFFMAN_ALPHABET_LITLEN && symbol == 256) {
+        entry.kind = HUFFMAN_ENTRY_END_OF_BLOCK;
+    } else if (alphabet == HUFFMAN_ALPHABET_LITLEN && symbol > 256) {
+        // 286 and 287 have codes in the fixed table, but they will never
+        // actually occur in valid data
+        if (symbol - 257 >= 29) {
+            entry.kind = HUFFMAN_ENTRY_INVALID;
+            return entry;
         }
         
-        // we'll store the reversed key, so that we don't
-        // have to reverse on each lookup
-        uint32_t reversed_key = reverse_bit_order(
-            /* raw: */ huffman_input[i].key,
-            /* size: */ huffman_input[i].code_length);
-        
-        uint32_t hash = maparray_compute_hash(
-            /* HashedHuffman * in_map: */ recipient,
-            /* reversed_key: */ reversed_key,
-            /* code_length: */ huffman_input[i].code_length);
-        
         #ifndef INFLATE_IGNORE_ASSERTS
-        assert(hash <= (HUFFMAN_HASHMAP_SIZE + HUFFMAN_LINEAR_ARRAY_SIZE));
-        assert(hash >= 0);
+        assert(length_extra_bits_table[symbol - 257].value == symbol);
         #endif
-        
-        if (
-            huffman_input[i].code_length < recipient->min_code_length)
-        {
-            recipient->min_code_length = huffman_input[i].code_length;
-        } else if (
-            huffman_input[i].code_length > recipient->max_code_length)
-        {
-            recipient->max_code_length = huffman_input[i].code_length;
-            #ifndef INFLATE_IGNORE_ASSERTS
-            assert(recipient->max_code_length < 30);
-            #endif
+        entry.kind = HUFFMAN_ENTRY_LENGTH;
+        entry.value =
+            (uint16_t)length_extra_bits_table[symbol - 257].base_decoded;
+        entry.extra_bits =
+            (uint8_t)length_extra_bits_table[symbol - 257].num_extra_bits;
+    } else if (alphabet == HUFFMAN_ALPHABET_DIST) {
+        // same for 30 and 31
+        if (symbol >= 30) {
+            entry.kind = HUFFMAN_ENTRY_INVALID;
+            return entry;
         }
         
-        recipient->maparray[hash].key = reversed_key;
-        recipient->maparray[hash].code_length = huffman_input[i].code_length;
-        recipient->maparray[hash].value = huffman_input[i].value;
-        
         #ifndef INFLATE_IGNORE_ASSERTS
-        assert(
-            recipient->maparray_array_size <
-                HUFFMAN_HASHMAP_SIZE + HUFFMAN_LINEAR_ARRAY_SIZE);
+        assert(dist_extra_bits_table[symbol].value == symbol);
         #endif
+        entry.kind = HUFFMAN_ENTRY_DISTANCE;
+        entry.value = (uint16_t)dist_extra_bits_table[symbol].base_decoded;
+        entry.extra_bits =
+            (uint8_t)dist_extra_bits_table[symbol].num_extra_bits;
     }
     
-    #ifndef INFLATE_IGNORE_ASSERTS 
-    assert(
-       recipient->min_code_length <=
-       recipient->max_code_length);
-    #endif
+    return entry;
 }
 
 /*
-Given an array of code lengths, unpack it to
-an array of huffman codes
+Convert an array of code lengths (1 per symbol, 0 for symbols that aren't
+used) straight to a lookup table
+
+We sort the symbols by code length first (a counting sort, the lengths only
+go up to 15). In that order, the canonical codes of the spec are simply
+0, 1, 2, ... with a shift to the left whenever the length goes up, so every
+code is 1 increment away from the one before it and we never look at a
+symbol twice. It also puts all codes that share a root prefix next to each
+other, so each subtable can be handed out right when we reach its first code.
+
+When the code is complete (every sequence of bits decodes to a symbol, which
+is what real encoders write) every entry we use gets written exactly once,
+so we don't need to clear anything first. Only incomplete codes leave holes
+that have to be HUFFMAN_ENTRY_INVALID.
 
 good will be set to 1 on success, 0 on failure
 */
-static void unpack_huffman(
-    uint32_t * array,
-    const uint32_t array_and_recipient_size,
-    HuffmanEntry * recipient,
+static void build_huffman_table(
+    InflateContext * context,
+    uint32_t const * code_lengths,
+    const uint32_t code_lengths_size,
+    const uint32_t alphabet,
+    const uint32_t root_bits,
+    HuffmanTable * recipient,
     uint32_t * good)
 {
     #ifndef INFLATE_IGNORE_ASSERTS
-    assert(array != NULL);
-    assert(array_and_recipient_size > 0);
+    assert(code_lengths != NULL);
+    assert(code_lengths_size > 0);
+    assert(code_lengths_size <= FIXED_HCLEN_TABLE_SIZE);
     assert(recipient != NULL);
+    assert(root_bits > 0);
+    assert(root_bits <= HUFFMAN_LITLEN_ROOT_BITS);
     #endif
     
-    // initialize dict
-    for (uint32_t i = 0; i < array_and_recipient_size; i++) {
-        recipient[i].key = 1234543;
-        recipient[i].value = i;
-        recipient[i].used = 0;
-        recipient[i].code_length = (uint16_t)array[i];
-    }
-    
-    // 1) Count the number of codes for each code length.  Let
-    // bl_count[N] be the number of codes of length N, N >= 1
-    uint32_t bl_count[NUM_UNIQUE_CODELENGTHS];
-    unsigned int min_code_length = 123454321;
-    unsigned int max_code_length = 0;
-    memset_func(
-        bl_count,
-        0,
-        NUM_UNIQUE_CODELENGTHS * sizeof(uint32_t));
-    
-    for (uint32_t i = 0; i < array_and_recipient_size; i++) {
-        
-        uint32_t bl_count_i = array[i];
-        
-        if (bl_count_i >= array_and_recipient_size) {
-            *good = 0;
+    *good = 0;
+    
+    // 1) count the codes of each length
+    uint32_t lengths_count[HUFFMAN_MAX_CODE_LENGTH + 1];
+    for (uint32_t i = 0; i <= HUFFMAN_MAX_CODE_LENGTH; i++) {
+        lengths_count[i] = 0;
+    }
+    for (uint32_t i = 0; i < code_lengths_size; i++) {
+        if (code_lengths[i] > HUFFMAN_MAX_CODE_LENGTH) {
             return;
         }
-        
-        if (bl_count[bl_count_i] == 0) {
+        lengths_count[code_lengths[i]] += 1;
+    }
+    lengths_count[0] = 0;
+    
+    /*
+    2) check that there aren't too many short codes: each code of length n
+    takes 1/2^n of all bit sequences, and that can't add up to more than 1
+    */
+    int32_t codes_left = 1;
+    uint32_t max_code_length = 0;
+    for (uint32_t i = 1; i <= HUFFMAN_MAX_CODE_LENGTH; i++) {
+        codes_left = (codes_left << 1) - (int32_t)lengths_count[i];
+        if (codes_left < 0) {
+            #ifndef INFLATE_SILENCE
+            printf(
+                "ERROR: too many codes of length %u, the code lengths are "
+                "invalid\n",
+                i);
+            #endif
+            return;
         }
-        if (bl_count_i > max_code_length) {
-            max_code_length = bl_count_i;
+        if (lengths_count[i] > 0) {
+            max_code_length = i;
         }
-        if (bl_count_i < min_code_length && bl_count_i > 0) {
-            min_code_length = bl_count_i;
+    }
+    uint32_t is_complete = codes_left == 0;
+    
+    // 3) sort the symbols by code length, and by value within a length
+    uint32_t offsets[HUFFMAN_MAX_CODE_LENGTH + 1];
+    offsets[1] = 0;
+    for (uint32_t i = 1; i < HUFFMAN_MAX_CODE_LENGTH; i++) {
+        offsets[i + 1] = offsets[i] + lengths_count[i];
+    }
+    uint16_t sorted_symbols[FIXED_HCLEN_TABLE_SIZE];
+    for (uint32_t i = 0; i < code_lengths_size; i++) {
+        if (code_lengths[i] > 0) {
+            sorted_symbols[offsets[code_lengths[i]]++] = (uint16_t)i;
         }
-        bl_count[bl_count_i] += 1;
     }
+    // each offset is now the end of its length, so the last one is the end
+    uint32_t symbols_used = offsets[HUFFMAN_MAX_CODE_LENGTH];
     
-    // Spec: 
-    // 2) "Find the numerical value of the smallest code for each
-    //    code length:"
-    uint32_t smallest_code[NUM_UNIQUE_CODELENGTHS];
+    uint32_t root_size = 1 << root_bits;
+    recipient->root_bits = root_bits;
+    recipient->entries_used = root_size;
     
-    /*
-        this code is yanked straight from the spec
-        code = 0;
-        bl_count[0] = 0;
-        for (bits = 1; bits <= MAX_BITS; bits++) {
-            code = (code + bl_count[bits-1]) << 1;
-            next_code[bits] = code;
-        }
-    */
-    unsigned int code = 0;
-    bl_count[0] = 0;
+    if (!is_complete) {
+        context->memset_func(
+            recipient->entries,
+            0,
+            sizeof(HuffmanTableEntry) * root_size);
+    }
     
-    #ifndef INFLATE_IGNORE_ASSERTS 
-    assert(max_code_length < array_and_recipient_size);
-    #endif
+    // 4) hand out the codes in order, and fill in the table
+    uint32_t code = 0;
+    uint32_t code_length = 0;
+    uint32_t subtable_prefix = root_size; // no subtable yet
+    uint32_t subtable_at = 0;
+    uint32_t subtable_bits = 0;
     
-    for (
-        uint32_t bits = 1;
-        bits <= max_code_length; 
-        bits++)
-    {
-        code = (code + bl_count[bits-1]) << 1;
-        smallest_code[bits] = code;
+    for (uint32_t i = 0; i < symbols_used; i++) {
+        uint32_t symbol = sorted_symbols[i];
+        
+        if (code_lengths[symbol] != code_length) {
+            code <<= code_lengths[symbol] - code_length;
+            code_length = code_lengths[symbol];
+        }
+        
+        // the table is indexed with the reversed code, see DataStream
+        uint32_t reversed_code = reverse_bit_order(
+            /* original: */ code,
+            /* bit_count: */ code_length);
+        code += 1;
         
-        // this algorithm is very tight
-        // smallest_code[bits] may get a value too big
-        // to fit inside bits, but that only happens when
-        // there are no values for that bit size (and many codes
-        // are taken up for smaller bit lengths). It could also
-        // happen when the PNG is corrupted and the code lengths
-        // are wrong (too many small code lengths)
-        if (smallest_code[bits] >= (1 << bits)) {
-            uint32_t actually_used = 0;
-            for (uint32_t i = 0; i < array_and_recipient_size; i++) {
-                if (recipient[i].code_length == bits) {
-                    actually_used = 1;
+        HuffmanTableEntry entry = make_table_entry(
+            /* alphabet: */ alphabet,
+            /* symbol: */ symbol);
+        entry.code_length = (uint8_t)code_length;
+        
+        if (code_length <= root_bits) {
+            for (
+                uint32_t j = reversed_code;
+                j < root_size;
+                j += (1 << code_length))
+            {
+                recipient->entries[j] = entry;
+            }
+            continue;
+        }
+        
+        uint32_t prefix = mask_rightmost_bits(reversed_code, root_bits);
+        if (prefix != subtable_prefix) {
+            /*
+            The first code with this prefix, and the shortest. The subtable
+            needs as many bits as the longest code that shares the prefix,
+            which we find by counting how many of the codes that are left
+            (this one included) fit under the prefix, like zlib does.
+            */
+            subtable_bits = code_length - root_bits;
+            int32_t room = 1 << subtable_bits;
+            while (subtable_bits + root_bits < max_code_length) {
+                room -= (int32_t)lengths_count[subtable_bits + root_bits];
+                if (room <= 0) {
+                    break;
                 }
+                subtable_bits += 1;
+                room <<= 1;
             }
             
-            if (actually_used) {
-                #ifndef INFLATE_SILENCE 
+            uint32_t subtable_size = 1 << subtable_bits;
+            if (recipient->entries_used + subtable_size > HUFFMAN_TABLE_SIZE) {
+                #ifndef INFLATE_SILENCE
                 printf(
-                    "ERROR: smallest_code[%u] was %u%s",
-                    bits,
-                    smallest_code[bits],
-                    " - value can't fit in that few bits!\n");
-                #endif
-                
-                #ifndef INFLATE_IGNORE_ASSERTS
-                assert(0);
+                    "huffman table overflow, the code lengths are invalid\n");
                 #endif
+                return;
             }
-        }
-    }
-    
-    // Spec: 
-    // 3) "Assign numerical values to all codes, using
-    //    consecutive values for all codes of the same length
-    //    with the base values determined at step 2. Codes that
-    //    are never used (which have a bit length of zero) must
-    //    not be assigned a value."
-    for (uint32_t n = 0; n < array_and_recipient_size; n++) {
-        
-        uint32_t len = recipient[n].code_length;
-        
-        if (len >= min_code_length) {
-            recipient[n].key = smallest_code[len];
-            recipient[n].used = 1;
             
-            smallest_code[len]++;
+            subtable_prefix = prefix;
+            subtable_at = recipient->entries_used;
+            recipient->entries_used += subtable_size;
+            if (!is_complete) {
+                context->memset_func(
+                    recipient->entries + subtable_at,
+                    0,
+                    sizeof(HuffmanTableEntry) * subtable_size);
+            }
+            
+            HuffmanTableEntry link;
+            link.value = (uint16_t)subtable_at;
+            link.code_length = 0;
+            link.kind = HUFFMAN_ENTRY_SUBTABLE;
+            link.extra_bits = (uint8_t)subtable_bits;
+            recipient->entries[prefix] = link;
         }
-    }
-    
-    #ifndef INFLATE_IGNORE_ASSERTS
-    uint32_t found_used = 0;
-    for (uint32_t i = 0; i < array_and_recipient_size; i++) {
         
-        if (recipient[i].used) {
-            found_used = 1;
-            break;
+        for (
+            uint32_t j = reversed_code >> root_bits;
+            j < (1u << subtable_bits);
+            j += (1 << (code_length - root_bits)))
+        {
+            recipient->entries[subtable_at + j] = entry;
         }
+        
+        // only long codes need this, for the subtable sizes above
+        lengths_count[code_length] -= 1;
     }
-    assert(found_used);
-    #endif
     
     *good = 1;
 }
 
-typedef struct ExtraBitsEntry {
-    uint32_t value;
-    uint32_t num_extra_bits;
-    uint32_t base_decoded;
-} ExtraBitsEntry;
+/*
+How many bits a table entry takes if it's a literal, or more than any root
+table has if it's not (so it never 'fits')
+*/
+inline static uint32_t literal_code_length(
+    const HuffmanTableEntry entry)
+{
+    return entry.kind == HUFFMAN_ENTRY_LITERAL ?
+        entry.code_length :
+        HUFFMAN_LITLEN_ROOT_BITS + 1;
+}
 
-// This table is defined in the deflate algorithm specification
-// https://www.ietf.org/rfc/rfc1951.txt
-static ExtraBitsEntry length_extra_bits_table[] = {
-    {257, 0, 3}, // value, length_extra_bits, base_decoded
-    {258, 0, 4},
-    {259, 0, 5},
-    {260, 0, 6},
-    {261, 0, 7},
-    {262, 0, 8},
-    {263, 0, 9},
-    {264, 0, 10},
-    {265, 1, 11},
-    {266, 1, 13},
-    {267, 1, 15}, // index 10
-    {268, 1, 17},
-    {269, 2, 19},
-    {270, 2, 23},
-    {271, 2, 27},
-    {272, 2, 31},
-    {273, 3, 35},
-    {274, 3, 43},
-    {275, 3, 51},
-    {276, 3, 59},
-    {277, 4, 67}, // index 20
-    {278, 4, 83},
-    {279, 4, 99},
-    {280, 4, 115},
-    {281, 5, 131},
-    {282, 5, 163},
-    {283, 5, 195},
-    {284, 5, 227},
-    {285, 0, 258}, // index 28
-};
+/*
+Fill in packed_literals for a literal/length table that build_huffman_table()
+just made
 
-static ExtraBitsEntry dist_extra_bits_table[] = {
-    {0, 0, 1}, // value, distance_extra_bits, base_decoded
-    {1, 0, 2},
-    {2, 0, 3},
-    {3, 0, 4},
-    {4, 1, 5},
-    {5, 1, 7},
-    {6, 2, 9},
-    {7, 2, 13},
-    {8, 3, 17},
-    {9, 3, 25},
-    {10, 4, 33},
-    {11, 4, 49},
-    {12, 5, 65}, // we want 88? 88 - 65 = 23. 12 + 10111
-    {13, 5, 97},
-    {14, 6, 129},
-    {15, 6, 193},
-    {16, 7, 257},
-    {17, 7, 385},
-    {18, 8, 513},
-    {19, 8, 769},
-    {20, 9, 1025},
-    {21, 9, 1537},
-    {22, 10, 2049},
-    {23, 10, 3073},
-    {24, 11, 4097},
-    {25, 11, 6145},
-    {26, 12, 8193},
-    {27, 12, 12289},
-    {28, 13, 16385},
-    {29, 13, 24577},
-};
+For every root index, we decode as many literals as we can without looking
+past the root bits. A literal with a code of l bits leaves root_bits - l bits
+that are already known, and if the next code fits in those, the entry at
+those bits (with the unknown bits above them as 0) is the right one.
 
-// This is the 'API method' provided by this file
-// Given some data that was compressed using the DEFLATE
-// or 'zlib' algorithm, you can 'INFLATE' it back 
-// to the original
-// returns 1 when failed, 0 when succesful
-void inflate(
-    uint8_t const * recipient,
-    const uint64_t recipient_size,
-    uint64_t * final_recipient_size,
-    uint8_t * temp_working_memory,
-    const uint64_t temp_working_memory_size,
-    uint8_t const * compressed_input,
-    const uint64_t compressed_input_size,
-    uint32_t * out_good,
-    const uint32_t thread_id)
+We do this for every dynamic block, and small blocks are common, so there
+are no branches in here: we always look at 3 entries, count how many of them
+fit, and don't care what ends up in the bytes after the last literal that
+fits (inflate() skips those).
+*/
+static void pack_literals(
+    HuffmanTable * table)
 {
-    if (recipient == NULL) {
-        #ifndef INFLATE_SILENCE
-        printf(
-            "inflate() ERROR: was passed a NULL recipient, cant write data\n");
-        #endif
-        *out_good = 0;
-        return;
-    }
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(table->root_bits <= HUFFMAN_LITLEN_ROOT_BITS);
+    #endif
     
-    if (final_recipient_size == NULL) {
-        #ifndef INFLATE_SILENCE
-        printf(
-            "inflate() ERROR: was passed a NULL final_recipient_size, cant "
-            " store the size of the uncompressed data\n");
-        #endif
-        *out_good = 0;
-        return;
-    }
+    uint32_t root_bits = table->root_bits;
+    uint32_t root_size = 1 << root_bits;
     
-    if (compressed_input == NULL) {
-        #ifndef INFLATE_SILENCE
-        printf(
-            "inflate() ERROR: was passed a NULL compressed_input, cant read "
-            " data to uncompress\n");
-        #endif
-        *out_good = 0;
-        return;
+    for (uint32_t i = 0; i < root_size; i++) {
+        HuffmanTableEntry first = table->entries[i];
+        uint32_t bits_1 = literal_code_length(first);
+        HuffmanTableEntry second = table->entries[i >> bits_1];
+        uint32_t bits_2 = bits_1 + literal_code_length(second);
+        HuffmanTableEntry third = table->entries[i >> bits_2];
+        uint32_t bits_3 = bits_2 + literal_code_length(third);
+        
+        // the bits only go up, so this is how many literals fit in a row
+        uint32_t literals_size =
+            (bits_1 <= root_bits) +
+            (bits_2 <= root_bits) +
+            (bits_3 <= root_bits);
+        uint32_t total_bits[HUFFMAN_PACKED_MAX_LITERALS + 1] = {
+            0, bits_1, bits_2, bits_3 };
+        
+        table->packed_literals[i] =
+            (uint32_t)(first.value & 0xFF) |
+            (uint32_t)(second.value & 0xFF) << 8 |
+            (uint32_t)(third.value & 0xFF) << 16 |
+            total_bits[literals_size] << HUFFMAN_PACKED_LENGTH_SHIFT |
+            literals_size << HUFFMAN_PACKED_COUNT_SHIFT;
     }
+}
+
+#define INFLATE_MAX_MATCH_LENGTH 258
+// copy_match() may write up to this many bytes past the end of a match
+#define INFLATE_MATCH_COPY_OVERSHOOT 32
+
+/*
+inflate() decodes without checking the buffer edges for every symbol while at
+least this much input and output are left (see the fast loop in inflate())
+*/
+#define INFLATE_FAST_LOOP_MIN_INPUT 8
+#define INFLATE_FAST_LOOP_MIN_OUTPUT \
+    (INFLATE_MAX_MATCH_LENGTH + INFLATE_MATCH_COPY_OVERSHOOT)
+
+// what the fast loop (decode_huffman_fast()) stopped for
+#define INFLATE_FAST_LOOP_NEAR_EDGE 0
+#define INFLATE_FAST_LOOP_END_OF_BLOCK 1
+#define INFLATE_FAST_LOOP_FAILED 2
+
+// inflate_growable() never grows the recipient to less than this
+#define INFLATE_MIN_GROWN_SIZE 65536
+
+#ifdef __GNUC__
+#define INFLATE_ALWAYS_INLINE __attribute__((always_inline)) inline static
+#else
+#define INFLATE_ALWAYS_INLINE inline static
+#endif
+
+inline static void store_u64(
+    uint8_t * to,
+    const uint64_t value)
+{
+    // compilers recognize this pattern and turn it into a single store
+    to[0] = (uint8_t)(value      );
+    to[1] = (uint8_t)(value >>  8);
+    to[2] = (uint8_t)(value >> 16);
+    to[3] = (uint8_t)(value >> 24);
+    to[4] = (uint8_t)(value >> 32);
+    to[5] = (uint8_t)(value >> 40);
+    to[6] = (uint8_t)(value >> 48);
+    to[7] = (uint8_t)(value >> 56);
+}
+
+/*
+Repeat length bytes that we already wrote distance bytes ago, e.g.
+"abc" + (distance 3, length 7) = "abcabcabca"
+
+The source and the destination overlap whenever distance < length, so we can't
+just memcpy, but copying 1 byte at a time is slow for long runs of the same
+color in images etc.
+
+Instead we copy 8 bytes at a time, and don't care if we write a little too far:
+the caller makes sure there are at least INFLATE_MATCH_COPY_OVERSHOOT bytes of
+room after the match, and those bytes will be overwritten by whatever we
+decode next.
+*/
+inline static void copy_match_fast(
+    uint8_t * to,
+    const uint32_t distance,
+    const uint32_t length)
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(distance > 0);
+    assert(length > 0);
+    #endif
     
-    if (recipient_size < compressed_input_size) {
-        #ifndef INFLATE_SILENCE
-        printf(
-            "inflate() ERROR: recipient size was smaller than input, no "
-            "room to uncompress\n");
-        #endif
-        *out_good = 0;
+    uint8_t * from = to - distance;
+    uint8_t * to_end = to + length;
+    
+    if (distance >= 8) {
+        // every 8 bytes we read were written before we store them, even when
+        // the distance is exactly 8, so we can copy 32 bytes per iteration
+        do {
+            store_u64(to +  0, load_u64_little_endian(from +  0));
+            store_u64(to +  8, load_u64_little_endian(from +  8));
+            store_u64(to + 16, load_u64_little_endian(from + 16));
+            store_u64(to + 24, load_u64_little_endian(from + 24));
+            to += 32;
+            from += 32;
+        } while (to < to_end);
         return;
     }
     
-    if (compressed_input_size < 5) {
-        #ifndef INFLATE_SILENCE
-        printf(
-            "inflate() ERROR: compressed_input_size was only %llu\n",
-            compressed_input_size);
-        #endif
-        *out_good = 0;
+    if (distance == 1) {
+        // a run of the same byte, very common for flat colors & padding
+        uint64_t pattern = (uint64_t)from[0] * 0x0101010101010101ull;
+        do {
+            store_u64(to + 0, pattern);
+            store_u64(to + 8, pattern);
+            to += 16;
+        } while (to < to_end);
         return;
     }
     
-    #ifndef INFLATE_SILENCE
-    printf(
-        "\t\tstart INFLATE expecting %llu bytes of compressed data\n",
-        compressed_input_size);
-    #endif
-    uint8_t * recipient_at = (uint8_t *)recipient;
-    *final_recipient_size = 0;
+    // A distance of 2-7 is a repeating pattern that's shorter than a word.
+    // We write the first 8 bytes 1 at a time, which repeats the pattern
+    // naturally, then keep storing that word. We advance by the largest
+    // multiple of the distance that fits in 8 bytes so every store starts at
+    // the same position in the pattern. (e.g. 6 bytes at a time for distance
+    // 3: "abcabcab" + "abcabcab" overlap into "abcabcabcabcab")
+    for (uint32_t i = 0; i < 8; i++) {
+        to[i] = from[i];
+    }
+    uint64_t pattern = load_u64_little_endian(to);
+    uint32_t step = 8 - (8 % distance);
+    to += step;
+    while (to < to_end) {
+        store_u64(to, pattern);
+        to += step;
+    }
+}
+
+/*
+The same as copy_match_fast, but for when we're near the end of our recipient
+and can't write past the end of the match
+*/
+static void copy_match_careful(
+    uint8_t * to,
+    const uint32_t distance,
+    const uint32_t length)
+{
+    uint8_t * from = to - distance;
     
-    DataStream data_stream;
-    data_stream.data       = (uint8_t *)compressed_input;
-    data_stream.size_left  = compressed_input_size;
-    data_stream.bits_left  = 0;
-    data_stream.bit_buffer = 0;
+    for (uint32_t i = 0; i < length; i++) {
+        to[i] = from[i];
+    }
+}
+
+#ifdef INFLATE_STATS
+static void stats_add_match(
+    InflateStats * stats,
+    const uint32_t length,
+    const uint32_t distance)
+{
+    uint32_t distance_bucket = 0;
+    while ((distance >> (distance_bucket + 1)) != 0) {
+        distance_bucket++;
+    }
     
-    #ifndef INFLATE_IGNORE_ASSERTS
-    assert(data_stream.data      != NULL);
-    assert(data_stream.size_left >= compressed_input_size);
-    assert(data_stream.bits_left == 0);
+    stats->matches += 1;
+    stats->match_lengths[length] += 1;
+    stats->match_distances[distance_bucket] += 1;
+}
+#endif
+
+/*
+The fast part of decoding a huffman block, see the fast loop in inflate().
+Every kernel below is this same function, compiled for a different CPU.
+
+It stops when it finds the end of the block, when the data is corrupt, or
+when it gets close to the end of either buffer. recipient_cursor is the
+position in recipient we start at, and is updated to where we stopped.
+
+copy_match is a constant for each kernel, so after inlining it's a direct
+call that gets inlined too
+*/
+INFLATE_ALWAYS_INLINE uint32_t decode_huffman_fast(
+    InflateContext * context,
+    DataStream * data_stream,
+    HuffmanTable * litlen_table,
+    HuffmanTable * dist_table,
+    uint8_t const * recipient,
+    uint8_t ** recipient_cursor,
+    uint8_t const * recipient_end,
+    void (* copy_match)(
+        uint8_t * to,
+        const uint32_t distance,
+        const uint32_t length))
+{
+    #ifndef INFLATE_STATS
+    (void)context;
     #endif
     
-    memset_func(temp_working_memory, 0, temp_working_memory_size);
+    uint8_t * recipient_at = *recipient_cursor;
     
-    int read_more_deflate_blocks = 1;
-    
-    while (read_more_deflate_blocks) {
-        // reset working memory and overwrite previous hash tables
-        uint8_t * working_memory_at = (uint8_t *)temp_working_memory;
-        uint64_t working_memory_remaining = temp_working_memory_size;
-        
-        #ifndef INFLATE_SILENCE
-        printf("\t\treading new DEFLATE block...\n");
-        #endif
-        
-        /*
-        Each block of compressed data begins with 3 header
-        bits containing the following data:
+    while (
+        data_stream->data_end - data_stream->data >=
+            INFLATE_FAST_LOOP_MIN_INPUT &&
+        recipient_end - recipient_at >=
+            INFLATE_FAST_LOOP_MIN_OUTPUT)
+    {
+        refill_bits(data_stream);
         
-        1st bit         BFINAL
-        next 2 bits     BTYPE
+        uint32_t packed = litlen_table->packed_literals[
+            mask_rightmost_bits(
+                (uint32_t)data_stream->bit_buffer,
+                litlen_table->root_bits)];
+        if (packed >= (1u << HUFFMAN_PACKED_COUNT_SHIFT)) {
+            uint32_t literals_size =
+                packed >> HUFFMAN_PACKED_COUNT_SHIFT;
+            recipient_at[0] = (uint8_t)(packed      );
+            recipient_at[1] = (uint8_t)(packed >>  8);
+            recipient_at[2] = (uint8_t)(packed >> 16);
+            recipient_at += literals_size;
+            #ifdef INFLATE_STATS
+            if (context->stats != NULL) {
+                context->stats->literals += literals_size;
+            }
+            #endif
+            discard_bits(
+                /* from: */
+                    data_stream,
+                /* amount: */
+                    (packed >> HUFFMAN_PACKED_LENGTH_SHIFT) & 15);
+            continue;
+        }
         
-        Note that the header bits do not necessarily begin
-        on a byte boundary, since a block does not
-        necessarily occupy an integral number of bytes.
+        HuffmanTableEntry litlen = huffman_table_decode(
+            /* table: */
+                litlen_table,
+            /* raw data: */
+                data_stream);
         
-        BFINAL is set if and only if this is the last
-        block of the data set.
+        if (litlen.kind == HUFFMAN_ENTRY_LITERAL) {
+            *recipient_at = (uint8_t)litlen.value;
+            recipient_at++;
+            #ifdef INFLATE_STATS
+            if (context->stats != NULL) {
+                context->stats->literals += 1;
+            }
+            #endif
+            continue;
+        }
         
-        BTYPE specifies how the data are compressed,
-        as follows:
+        if (litlen.kind != HUFFMAN_ENTRY_LENGTH) {
+            if (litlen.kind == HUFFMAN_ENTRY_END_OF_BLOCK) {
+                #ifndef INFLATE_SILENCE
+                printf("\t\tend of ltln found!\n");
+                #endif
+                *recipient_cursor = recipient_at;
+                return INFLATE_FAST_LOOP_END_OF_BLOCK;
+            }
+            #ifndef INFLATE_SILENCE
+            printf(
+                "inflate() failed, bad huffman decode\n");
+            #endif
+            return INFLATE_FAST_LOOP_FAILED;
+        }
         
-        00 - no compression
-        01 - compressed with fixed Huffman codes
-        10 - compressed with dynamic Huffman codes
-        11 - reserved (error) 
-        */
-        uint32_t BFINAL = consume_bits(
-            /* buffer: */ &data_stream,
-            /* size  : */ 1);
-        #ifndef INFLATE_IGNORE_ASSERTS
-        assert(BFINAL < 2);
-        #endif
+        uint32_t total_length = decode_extra_bits(
+            /* entry: */ litlen,
+            /* from: */ data_stream);
         
-        #ifndef INFLATE_SILENCE
-        printf(
-            "\t\t\tBFINAL (flag for final block): %u\n",
-            BFINAL);
-        #endif
-        if (BFINAL) { read_more_deflate_blocks = 0; }
+        HuffmanTableEntry dist = huffman_table_decode(
+            /* table: */
+                dist_table,
+            /* raw data: */
+                data_stream);
+        if (dist.kind != HUFFMAN_ENTRY_DISTANCE) {
+            #ifndef INFLATE_SILENCE
+            printf(
+                "inflate() failed, "
+                "bad dist huffman decode\n");
+            #endif
+            return INFLATE_FAST_LOOP_FAILED;
+        }
         
-        uint32_t BTYPE = consume_bits(
-            /* buffer: */ &data_stream,
-            /* size  : */ 2);
+        uint32_t total_dist = decode_extra_bits(
+            /* entry: */ dist,
+            /* from: */ data_stream);
         
-        if (BTYPE == 0) {
+        if (total_dist > (uint64_t)(recipient_at - recipient)) {
             #ifndef INFLATE_SILENCE
-            printf("\t\t\tBTYPE 0 - No compression\n");
+            printf(
+                "ERROR - can't repeat data from %u bytes before, "
+                "address is out of bounds\n",
+                total_dist);
             #endif
-            
+            return INFLATE_FAST_LOOP_FAILED;
+        }
+        
+        copy_match(
+            /* to: */ recipient_at,
+            /* distance: */ total_dist,
+            /* length: */ total_length);
+        recipient_at += total_length;
+        #ifdef INFLATE_STATS
+        if (context->stats != NULL) {
+            stats_add_match(
+                /* stats: */ context->stats,
+                /* length: */ total_length,
+                /* distance: */ total_dist);
+        }
+        #endif
+    }
+    
+    *recipient_cursor = recipient_at;
+    return INFLATE_FAST_LOOP_NEAR_EDGE;
+}
+
+static uint32_t decode_kernel_portable(
+    InflateContext * context,
+    DataStream * data_stream,
+    HuffmanTable * litlen_table,
+    HuffmanTable * dist_table,
+    uint8_t const * recipient,
+    uint8_t ** recipient_cursor,
+    uint8_t const * recipient_end)
+{
+    return decode_huffman_fast(
+        context,
+        data_stream,
+        litlen_table,
+        dist_table,
+        recipient,
+        recipient_cursor,
+        recipient_end,
+        /* copy_match: */ copy_match_fast);
+}
+
+#ifdef INFLATE_X86_KERNELS
+/*
+The same as copy_match_fast, but when the distance is at least 32, we copy
+32 bytes per instruction instead of 8. That's the exact amount of overshoot
+we're allowed, and since each 32 bytes we read were written before we store
+them, the overlap doesn't matter.
+*/
+__attribute__((target("avx2")))
+inline static void copy_match_avx2(
+    uint8_t * to,
+    const uint32_t distance,
+    const uint32_t length)
+{
+    if (distance < 32) {
+        copy_match_fast(to, distance, length);
+        return;
+    }
+    
+    uint8_t * from = to - distance;
+    uint8_t * to_end = to + length;
+    do {
+        _mm256_storeu_si256(
+            (__m256i *)to,
+            _mm256_loadu_si256((__m256i const *)from));
+        to += 32;
+        from += 32;
+    } while (to < to_end);
+}
+
+/*
+With BMI2, the compiler turns our variable shifts and masks (the bit reader
+and the table lookups) into shrx & bzhi, which don't need the shift amount
+in cl and don't touch the flags
+*/
+__attribute__((target("bmi2,avx2")))
+static uint32_t decode_kernel_bmi2_avx2(
+    InflateContext * context,
+    DataStream * data_stream,
+    HuffmanTable * litlen_table,
+    HuffmanTable * dist_table,
+    uint8_t const * recipient,
+    uint8_t ** recipient_cursor,
+    uint8_t const * recipient_end)
+{
+    return decode_huffman_fast(
+        context,
+        data_stream,
+        litlen_table,
+        dist_table,
+        recipient,
+        recipient_cursor,
+        recipient_end,
+        /* copy_match: */ copy_match_avx2);
+}
+#endif // INFLATE_X86_KERNELS
+
+/*
+Check what this CPU supports once, when we create a context, so 1 binary
+runs well on every x86-64 machine without having to be rebuilt
+*/
+static void pick_decode_kernel(
+    InflateContext * context)
+{
+    context->decode_kernel = decode_kernel_portable;
+    
+    #ifdef INFLATE_X86_KERNELS
+    __builtin_cpu_init();
+    if (
+        __builtin_cpu_supports("bmi2") &&
+        __builtin_cpu_supports("avx2"))
+    {
+        context->decode_kernel = decode_kernel_bmi2_avx2;
+    }
+    #endif
+}
+
+/*
+The Huffman codes for the two alphabets of a BTYPE 1 block
+are fixed, and are not represented explicitly
+in the data.
+
+The Huffman code lengths for the literal/length
+alphabet are:
+
+Lit Value    Bits   Codes
+---------    ----   -----
+0   - 143     8     00110000 through 10111111
+144 - 255     9     110010000 through 111111111
+256 - 279     7     0000000 through 0010111
+280 - 287     8     11000000 through 11000111
+
+Distance codes 0-31 are represented by (fixed-length) 5-bit
+codes. (30 and 31 will never actually occur)
+
+Since they never change, we build their tables once in
+inflate_context_create()
+*/
+static void build_fixed_tables(
+    InflateContext * context)
+{
+    uint32_t fixed_hclen_table[FIXED_HCLEN_TABLE_SIZE];
+    
+    for (uint32_t i = 0; i < FIXED_HCLEN_TABLE_SIZE; i++) {
+        if (i < 144) {
+            fixed_hclen_table[i] = 8;
+        } else if (i < 256) {
+            fixed_hclen_table[i] = 9;
+        } else if (i < 280) {
+            fixed_hclen_table[i] = 7;
+        } else {
+            fixed_hclen_table[i] = 8;
+        }
+    }
+    
+    uint32_t litlen_table_good = 0;
+    build_huffman_table(
+        /* context: */
+            context,
+        /* code_lengths: */
+            fixed_hclen_table,
+        /* code_lengths_size: */
+            FIXED_HCLEN_TABLE_SIZE,
+        /* alphabet: */
+            HUFFMAN_ALPHABET_LITLEN,
+        /* root_bits: */
+            HUFFMAN_LITLEN_ROOT_BITS,
+        /* recipient: */
+            &context->fixed_litlen_table,
+        /* good: */
+            &litlen_table_good);
+    pack_literals(&context->fixed_litlen_table);
+    
+    /*
+    Spot checks against the codes in the table above, at their reversed
+    positions (e.g. 0 is 00110000, so it's at 00001100 = 12)
+    */
+    #ifndef INFLATE_IGNORE_ASSERTS
+    HuffmanTableEntry * fixed_entries = context->fixed_litlen_table.entries;
+    assert(fixed_entries[12].kind == HUFFMAN_ENTRY_LITERAL);
+    assert(fixed_entries[12].value == 0);
+    assert(fixed_entries[12].code_length == 8);
+    assert(fixed_entries[511].kind == HUFFMAN_ENTRY_LITERAL);
+    assert(fixed_entries[511].value == 255);
+    assert(fixed_entries[511].code_length == 9);
+    assert(fixed_entries[0].kind == HUFFMAN_ENTRY_END_OF_BLOCK);
+    assert(fixed_entries[0].code_length == 7);
+    assert(fixed_entries[227].kind == HUFFMAN_ENTRY_INVALID);
+    assert(fixed_entries[227].code_length == 8);
+    #endif
+    
+    for (uint32_t i = 0; i < FIXED_DIST_TABLE_SIZE; i++) {
+        fixed_hclen_table[i] = 5;
+    }
+    
+    uint32_t dist_table_good = 0;
+    build_huffman_table(
+        /* context: */
+            context,
+        /* code_lengths: */
+            fixed_hclen_table,
+        /* code_lengths_size: */
+            FIXED_DIST_TABLE_SIZE,
+        /* alphabet: */
+            HUFFMAN_ALPHABET_DIST,
+        /* root_bits: */
+            HUFFMAN_DIST_ROOT_BITS,
+        /* recipient: */
+            &context->fixed_dist_table,
+        /* good: */
+            &dist_table_good);
+    
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(litlen_table_good);
+    assert(dist_table_good);
+    #endif
+}
+
+InflateContext * inflate_context_create(
+    void * (* malloc_funcptr)(uint64_t __size),
+    void (* free_funcptr)(void * to_free),
+    void * (* memset_funcptr)(void * str, int c, uint64_t n),
+    void * (* memcpy_funcptr)(void * dest, const void * src, uint64_t n))
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(malloc_funcptr != NULL);
+    assert(free_funcptr != NULL);
+    assert(memset_funcptr != NULL);
+    assert(memcpy_funcptr != NULL);
+    #endif
+    
+    InflateContext * context = malloc_funcptr(sizeof(InflateContext));
+    if (context == NULL) {
+        return NULL;
+    }
+    
+    context->malloc_func = malloc_funcptr;
+    context->free_func = free_funcptr;
+    context->memset_func = memset_funcptr;
+    context->memcpy_func = memcpy_funcptr;
+    
+    build_fixed_tables(context);
+    pick_decode_kernel(context);
+    
+    #ifdef INFLATE_STATS
+    context->stats = NULL;
+    #endif
+    
+    return context;
+}
+
+void inflate_context_destroy(
+    InflateContext * context)
+{
+    if (context == NULL) {
+        return;
+    }
+    
+    context->free_func(context);
+}
+
+#ifdef INFLATE_STATS
+void inflate_context_set_stats(
+    InflateContext * context,
+    InflateStats * stats)
+{
+    context->stats = stats;
+}
+
+/*
+The time from the stats' clock, or 0 if there's no clock
+*/
+static uint64_t stats_clock(
+    InflateContext * context)
+{
+    if (context->stats == NULL || context->stats->clock_funcptr == NULL) {
+        return 0;
+    }
+    
+    return context->stats->clock_funcptr();
+}
+#endif
+
+/*
+1 if a set of code lengths describes a complete prefix code: every sequence
+of bits decodes to some symbol. Valid encoders only write complete codes,
+except for a distance code with 0 or 1 symbols in it, which allow_tiny
+accepts.
+
+Starting from a random bit in the middle of a stream, most garbage fails
+this, so it's the main way we tell real block headers from noise.
+*/
+static uint32_t code_lengths_are_complete(
+    uint32_t const * code_lengths,
+    const uint32_t code_lengths_size,
+    const uint32_t allow_tiny)
+{
+    uint32_t bl_count[HUFFMAN_MAX_CODE_LENGTH + 1];
+    for (uint32_t i = 0; i <= HUFFMAN_MAX_CODE_LENGTH; i++) {
+        bl_count[i] = 0;
+    }
+    
+    for (uint32_t i = 0; i < code_lengths_size; i++) {
+        if (code_lengths[i] > HUFFMAN_MAX_CODE_LENGTH) {
+            return 0;
+        }
+        bl_count[code_lengths[i]] += 1;
+    }
+    
+    // how many codes of the current length are still unassigned
+    int32_t codes_left = 1;
+    uint32_t codes_used = 0;
+    for (uint32_t bits = 1; bits <= HUFFMAN_MAX_CODE_LENGTH; bits++) {
+        codes_left = (codes_left * 2) - (int32_t)bl_count[bits];
+        codes_used += bl_count[bits];
+        if (codes_left < 0) {
+            return 0;
+        }
+    }
+    
+    if (codes_left == 0) {
+        return 1;
+    }
+    
+    return allow_tiny && codes_used <= 1;
+}
+
+/*
+Hand out size bytes of 16-byte aligned working memory, or NULL if there isn't
+enough left
+*/
+static void * take_working_memory(
+    uint8_t ** working_memory_at,
+    uint64_t * working_memory_remaining,
+    const uint64_t size)
+{
+    align_memory(working_memory_at, working_memory_remaining);
+    if (*working_memory_remaining < size) {
+        return NULL;
+    }
+    
+    void * taken = *working_memory_at;
+    *working_memory_at += size;
+    *working_memory_remaining -= size;
+    
+    return taken;
+}
+
+/*
+Read the code lengths at the start of a dynamic block (everything after
+BTYPE) and build its tables in temp_working_memory.
+
+It's always silent. If strict is 1, anything that a real encoder wouldn't
+write fails (incomplete codes, or no end of block code), because we also use
+it to test random bit positions. If strict is 0, it accepts everything that
+inflate() accepts, because inflate() itself reads its dynamic blocks with it.
+
+returns 1 on success, and 0 on failure
+*/
+static uint32_t read_dynamic_tables(
+    InflateContext * context,
+    DataStream * data_stream,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    const uint32_t strict,
+    HuffmanTable ** litlen_table,
+    HuffmanTable ** dist_table)
+{
+    uint8_t * working_memory_at = temp_working_memory;
+    uint64_t working_memory_remaining = temp_working_memory_size;
+    
+    uint32_t * code_lengths = take_working_memory(
+        &working_memory_at,
+        &working_memory_remaining,
+        sizeof(uint32_t) *
+            (INFLATE_MAX_LITLEN_CODES + INFLATE_MAX_DIST_CODES));
+    HuffmanTable * codelengths_table = take_working_memory(
+        &working_memory_at,
+        &working_memory_remaining,
+        sizeof(HuffmanTable));
+    *litlen_table = take_working_memory(
+        &working_memory_at,
+        &working_memory_remaining,
+        sizeof(HuffmanTable));
+    *dist_table = take_working_memory(
+        &working_memory_at,
+        &working_memory_remaining,
+        sizeof(HuffmanTable));
+    
+    if (
+        code_lengths == NULL ||
+        codelengths_table == NULL ||
+        *litlen_table == NULL ||
+        *dist_table == NULL)
+    {
+        return 0;
+    }
+    
+    refill_bits(data_stream);
+    uint32_t HLIT = consume_bits(data_stream, 5) + 257;
+    uint32_t HDIST = consume_bits(data_stream, 5) + 1;
+    uint32_t HCLEN = consume_bits(data_stream, 4) + 4;
+    if (HLIT > INFLATE_MAX_LITLEN_CODES || HDIST > INFLATE_MAX_DIST_CODES) {
+        return 0;
+    }
+    
+    uint32_t codelength_lengths[NUM_UNIQUE_CODELENGTHS];
+    for (uint32_t i = 0; i < NUM_UNIQUE_CODELENGTHS; i++) {
+        codelength_lengths[i] = 0;
+    }
+    for (uint32_t i = 0; i < HCLEN; i++) {
+        codelength_lengths[swizzle[i]] = consume_bits(data_stream, 3);
+    }
+    
+    if (
+        strict &&
+        !code_lengths_are_complete(
+            /* code_lengths: */ codelength_lengths,
+            /* code_lengths_size: */ NUM_UNIQUE_CODELENGTHS,
+            /* allow_tiny: */ 0))
+    {
+        return 0;
+    }
+    
+    uint32_t good = 0;
+    build_huffman_table(
+        /* context: */ context,
+        /* code_lengths: */ codelength_lengths,
+        /* code_lengths_size: */ NUM_UNIQUE_CODELENGTHS,
+        /* alphabet: */ HUFFMAN_ALPHABET_CODELENGTHS,
+        /* root_bits: */ HUFFMAN_CODELENGTHS_ROOT_BITS,
+        /* recipient: */ codelengths_table,
+        /* good: */ &good);
+    if (!good) {
+        return 0;
+    }
+    
+    uint32_t two_dicts_size = HLIT + HDIST;
+    uint32_t len_i = 0;
+    while (len_i < two_dicts_size) {
+        refill_bits(data_stream);
+        HuffmanTableEntry entry = huffman_table_decode(
+            /* table: */ codelengths_table,
+            /* datastream: */ data_stream);
+        
+        uint32_t repeat_value = 0;
+        uint32_t repeats = 0;
+        if (entry.kind == HUFFMAN_ENTRY_INVALID) {
+            return 0;
+        } else if (entry.value <= 15) {
+            code_lengths[len_i++] = entry.value;
+            continue;
+        } else if (entry.value == 16) {
+            if (len_i == 0) {
+                return 0;
+            }
+            repeat_value = code_lengths[len_i - 1];
+            repeats = consume_bits(data_stream, 2) + 3;
+        } else if (entry.value == 17) {
+            repeats = consume_bits(data_stream, 3) + 3;
+        } else {
+            repeats = consume_bits(data_stream, 7) + 11;
+        }
+        
+        if (len_i + repeats > two_dicts_size) {
+            return 0;
+        }
+        for (uint32_t i = 0; i < repeats; i++) {
+            code_lengths[len_i++] = repeat_value;
+        }
+    }
+    
+    if (read_past_end(data_stream)) {
+        return 0;
+    }
+    
+    // without an end of block code, the block could never end
+    if (
+        strict &&
+        (code_lengths[256] == 0 ||
+            !code_lengths_are_complete(
+                /* code_lengths: */ code_lengths,
+                /* code_lengths_size: */ HLIT,
+                /* allow_tiny: */ 1) ||
+            !code_lengths_are_complete(
+                /* code_lengths: */ code_lengths + HLIT,
+                /* code_lengths_size: */ HDIST,
+                /* allow_tiny: */ 1)))
+    {
+        return 0;
+    }
+    
+    build_huffman_table(
+        /* context: */ context,
+        /* code_lengths: */ code_lengths,
+        /* code_lengths_size: */ HLIT,
+        /* alphabet: */ HUFFMAN_ALPHABET_LITLEN,
+        /* root_bits: */ HUFFMAN_LITLEN_ROOT_BITS,
+        /* recipient: */ *litlen_table,
+        /* good: */ &good);
+    if (!good) {
+        return 0;
+    }
+    
+    build_huffman_table(
+        /* context: */ context,
+        /* code_lengths: */ code_lengths + HLIT,
+        /* code_lengths_size: */ HDIST,
+        /* alphabet: */ HUFFMAN_ALPHABET_DIST,
+        /* root_bits: */ HUFFMAN_DIST_ROOT_BITS,
+        /* recipient: */ *dist_table,
+        /* good: */ &good);
+    
+    return good;
+}
+
+/*
+read_dynamic_tables() carves these out of temp_working_memory for each
+dynamic block, in this order, and each one may need up to 15 bytes of padding
+in front so that it's 16-byte aligned. Fixed and stored blocks don't use any
+of it.
+*/
+uint64_t inflate_working_memory_required(void)
+{
+    uint64_t sizes[4] = {
+        // the code lengths for both the literal/length and distance codes
+        sizeof(uint32_t) * (INFLATE_MAX_LITLEN_CODES + INFLATE_MAX_DIST_CODES),
+        // the code lengths code
+        sizeof(HuffmanTable),
+        // the literal/length code
+        sizeof(HuffmanTable),
+        // the distance code
+        sizeof(HuffmanTable),
+    };
+    
+    uint64_t required = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+        required += sizes[i] + 15;
+    }
+    
+    return required;
+}
+
+/*
+Make room for at least needed_size bytes of output in total, for
+inflate_growable(). We at least double the capacity every time, so all the
+copying realloc() may do adds up to less than twice the final output size.
+
+The new recipient and its capacity are also written to grown_recipient and
+grown_capacity right away, so the caller always knows which buffer to free,
+even if we fail later on.
+
+returns 0 if realloc_funcptr failed (the old recipient is still valid then)
+*/
+static uint32_t grow_recipient(
+    void * (* realloc_funcptr)(void * to_grow, uint64_t new_size),
+    uint8_t ** recipient,
+    uint8_t ** recipient_at,
+    uint64_t * recipient_size,
+    const uint64_t needed_size,
+    uint8_t ** grown_recipient,
+    uint64_t * grown_capacity)
+{
+    uint64_t used_size = (uint64_t)(*recipient_at - *recipient);
+    
+    uint64_t new_size = *recipient_size * 2;
+    if (new_size < INFLATE_MIN_GROWN_SIZE) {
+        new_size = INFLATE_MIN_GROWN_SIZE;
+    }
+    if (new_size < needed_size) {
+        new_size = needed_size;
+    }
+    
+    uint8_t * grown = (uint8_t *)realloc_funcptr(*recipient, new_size);
+    if (grown == NULL) {
+        #ifndef INFLATE_SILENCE
+        printf(
+            "inflate_growable() ERROR: failed to grow the recipient to %llu "
+            "bytes\n",
+            new_size);
+        #endif
+        return 0;
+    }
+    
+    *recipient = grown;
+    *recipient_at = grown + used_size;
+    *recipient_size = new_size;
+    *grown_recipient = grown;
+    *grown_capacity = new_size;
+    
+    return 1;
+}
+
+/*
+inflate() and inflate_growable() in 1. realloc_funcptr is NULL for inflate(),
+then recipient can never grow and grown_recipient & grown_capacity are unused.
+*/
+static void inflate_internal(
+    InflateContext * context,
+    uint8_t * recipient,
+    uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    void * (* realloc_funcptr)(void * to_grow, uint64_t new_size),
+    uint8_t ** grown_recipient,
+    uint64_t * grown_capacity,
+    uint32_t * out_good)
+{
+    if (recipient == NULL && realloc_funcptr == NULL) {
+        #ifndef INFLATE_SILENCE
+        printf(
+            "inflate() ERROR: was passed a NULL recipient, cant write data\n");
+        #endif
+        *out_good = 0;
+        return;
+    }
+    
+    if (final_recipient_size == NULL) {
+        #ifndef INFLATE_SILENCE
+        printf(
+            "inflate() ERROR: was passed a NULL final_recipient_size, cant "
+            " store the size of the uncompressed data\n");
+        #endif
+        *out_good = 0;
+        return;
+    }
+    
+    if (compressed_input == NULL) {
+        #ifndef INFLATE_SILENCE
+        printf(
+            "inflate() ERROR: was passed a NULL compressed_input, cant read "
+            " data to uncompress\n");
+        #endif
+        *out_good = 0;
+        return;
+    }
+    
+    if (compressed_input_size < 2) {
+        #ifndef INFLATE_SILENCE
+        printf(
+            "inflate() ERROR: compressed_input_size was only %llu\n",
+            compressed_input_size);
+        #endif
+        *out_good = 0;
+        return;
+    }
+    
+    #ifndef INFLATE_SILENCE
+    printf(
+        "\t\tstart INFLATE expecting %llu bytes of compressed data\n",
+        compressed_input_size);
+    #endif
+    uint8_t * recipient_at = recipient;
+    *final_recipient_size = 0;
+    
+    DataStream data_stream;
+    data_stream.data          = (uint8_t *)compressed_input;
+    data_stream.data_end      = data_stream.data + compressed_input_size;
+    data_stream.bit_buffer    = 0;
+    data_stream.bits_left     = 0;
+    data_stream.overrun_bytes = 0;
+    
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(data_stream.data      != NULL);
+    assert(data_stream.bits_left == 0);
+    #endif
+    
+    int read_more_deflate_blocks = 1;
+    
+    while (read_more_deflate_blocks) {
+        #ifndef INFLATE_SILENCE
+        printf("\t\treading new DEFLATE block...\n");
+        #endif
+        
+        /*
+        Each block of compressed data begins with 3 header
+        bits containing the following data:
+        
+        1st bit         BFINAL
+        next 2 bits     BTYPE
+        
+        Note that the header bits do not necessarily begin
+        on a byte boundary, since a block does not
+        necessarily occupy an integral number of bytes.
+        
+        BFINAL is set if and only if this is the last
+        block of the data set.
+        
+        BTYPE specifies how the data are compressed,
+        as follows:
+        
+        00 - no compression
+        01 - compressed with fixed Huffman codes
+        10 - compressed with dynamic Huffman codes
+        11 - reserved (error) 
+        */
+        uint32_t BFINAL = consume_bits(
+            /* buffer: */ &data_stream,
+            /* size  : */ 1);
+        #ifndef INFLATE_IGNORE_ASSERTS
+        assert(BFINAL < 2);
+        #endif
+        
+        #ifndef INFLATE_SILENCE
+        printf(
+            "\t\t\tBFINAL (flag for final block): %u\n",
+            BFINAL);
+        #endif
+        if (BFINAL) { read_more_deflate_blocks = 0; }
+        
+        uint32_t BTYPE = consume_bits(
+            /* buffer: */ &data_stream,
+            /* size  : */ 2);
+        
+        #ifdef INFLATE_STATS
+        if (context->stats != NULL && BTYPE < 3) {
+            context->stats->blocks[BTYPE] += 1;
+        }
+        #endif
+        
+        if (BTYPE == 0) {
+            #ifndef INFLATE_SILENCE
+            printf("\t\t\tBTYPE 0 - No compression\n");
+            #endif
+            
             // spec says to ditch remaining bits
-            if (data_stream.bits_left > 0) {
+            #ifndef INFLATE_SILENCE
+            printf(
+                "\t\t\tditching %u bits to get to a byte boundary...\n",
+                data_stream.bits_left & 7);
+            #endif
+            discard_bits(
+                /* from: */ &data_stream,
+                /* amount: */ data_stream.bits_left & 7);
+            
+            uint16_t LEN = (uint16_t)consume_bits(&data_stream, 16);
+            #ifndef INFLATE_SILENCE
+            printf(
+                "\t\t\tuncompr. block has LEN: %u bytes\n",
+                LEN);
+            #endif
+            
+            uint16_t NLEN = (uint16_t)consume_bits(&data_stream, 16);
+            if ((uint16_t)LEN != (uint16_t)~NLEN) {
+                #ifndef INFLATE_SILENCE
+                printf(
+                    "inflate() ERROR: LEN didn't match NLEN\n");
+                #endif
+                *out_good = 0;
+                return;
+            }
+            
+            // the raw bytes come straight from data, not from our buffer
+            if (!align_to_byte(&data_stream)) {
+                #ifndef INFLATE_SILENCE
+                printf(
+                    "inflate() ERROR: ran out of input in a stored block\n");
+                #endif
+                *out_good = 0;
+                return;
+            }
+            
+            /*
+            Check LEN against what's left once, then copy the whole block in
+            1 call, so blocks of incompressible data go at memcpy speed
+            */
+            if ((uint64_t)(data_stream.data_end - data_stream.data) < LEN) {
+                #ifndef INFLATE_SILENCE
+                printf(
+                    "inflate() ERROR: ran out of input in a stored block\n");
+                #endif
+                *out_good = 0;
+                return;
+            }
+            
+            uint64_t space_left =
+                recipient_size - (uint64_t)(recipient_at - recipient);
+            if (space_left < LEN && realloc_funcptr != NULL) {
+                if (
+                    !grow_recipient(
+                        /* realloc_funcptr: */
+                            realloc_funcptr,
+                        /* recipient: */
+                            &recipient,
+                        /* recipient_at: */
+                            &recipient_at,
+                        /* recipient_size: */
+                            &recipient_size,
+                        /* needed_size: */
+                            (uint64_t)(recipient_at - recipient) + LEN,
+                        /* grown_recipient: */
+                            grown_recipient,
+                        /* grown_capacity: */
+                            grown_capacity))
+                {
+                    *out_good = 0;
+                    return;
+                }
+                space_left =
+                    recipient_size - (uint64_t)(recipient_at - recipient);
+            }
+            if (space_left < LEN) {
                 #ifndef INFLATE_SILENCE
                 printf(
-                    "\t\t\tditching a byte with %u%s\n",
-                    data_stream.bits_left,
-                    " bits left...");
+                    "ERROR - recipient overflow! need %u bytes for a stored "
+                    "block, but only %llu left\n",
+                    LEN,
+                    space_left);
+                #endif
+                *out_good = 0;
+                return;
+            }
+            
+            context->memcpy_func(
+                recipient_at,
+                data_stream.data,
+                LEN);
+            recipient_at += LEN;
+            *final_recipient_size += LEN;
+            data_stream.data += LEN;
+        } else if (BTYPE > 2) {
+            #ifndef INFLATE_SILENCE
+            printf(
+                "\t\t\tERROR - unexpected deflate BTYPE %u\n",
+                BTYPE);
+            #endif
+            #ifndef INFLATE_IGNORE_ASSERTS
+            assert(0);
+            #endif
+            *out_good = 0;
+            return;
+        } else {
+            #ifndef INFLATE_IGNORE_ASSERTS
+            assert(BTYPE >= 1 && BTYPE <= 2);
+            #endif
+            
+            // used in both dynamic & fixed huffman encoded files
+            HuffmanTable * litlen_table = NULL;
+            HuffmanTable * dist_table = NULL;
+            
+            if (BTYPE == 1) {
+                #ifndef INFLATE_SILENCE
+                printf("\t\t\tBTYPE 1 - Fixed Huffman\n");
                 #endif
                 
-                discard_bits(
-                    /* from: */ &data_stream,
-                    /* amount: */ data_stream.bits_left);
+                // the fixed tables never change,
+                // inflate_context_create() built them
+                litlen_table = &context->fixed_litlen_table;
+                dist_table = &context->fixed_dist_table;
+            } else {
                 #ifndef INFLATE_IGNORE_ASSERTS
-                assert(data_stream.bits_left == 0);
+                assert(BTYPE == 2);
+                #endif
+                
+                #ifndef INFLATE_SILENCE
+                printf("\t\t\tBTYPE 2 - Dynamic Huffman\n");
+                printf("\t\t\tRead code trees...\n");
+                #endif
+                
+                #ifdef INFLATE_STATS
+                uint64_t table_build_started = stats_clock(context);
+                #endif
+                
+                /*
+                The Huffman codes for the two alphabets
+                appear in the block immediately after the
+                header bits and before the actual compressed
+                data, first the literal/length code and then
+                the distance code. Each code is defined by a
+                sequence of code lengths, which are compressed
+                with a 3rd huffman code. See read_dynamic_tables().
+                */
+                if (
+                    !read_dynamic_tables(
+                        /* context: */
+                            context,
+                        /* data_stream: */
+                            &data_stream,
+                        /* temp_working_memory: */
+                            temp_working_memory,
+                        /* temp_working_memory_size: */
+                            temp_working_memory_size,
+                        /* strict: */
+                            0,
+                        /* litlen_table: */
+                            &litlen_table,
+                        /* dist_table: */
+                            &dist_table))
+                {
+                    #ifndef INFLATE_SILENCE
+                    printf(
+                        "inflate() failed, bad dynamic huffman tables (or "
+                        "not enough working memory)\n");
+                    #endif
+                    *out_good = 0;
+                    return;
+                }
+                pack_literals(litlen_table);
+                
+                #ifdef INFLATE_STATS
+                if (context->stats != NULL) {
+                    context->stats->table_build_time +=
+                        stats_clock(context) - table_build_started;
+                }
                 #endif
             }
             
-            uint16_t LEN = (uint16_t)consume_bits(&data_stream, 16);
+            // the remaining part of the algorithm is the
+            // same whether we're using dynamic huffman tables
+            // or fixed huffman tables - we just use different
+            // tables.
+            #ifndef INFLATE_IGNORE_ASSERTS
+            assert(litlen_table != NULL);
+            assert(dist_table != NULL);
+            #endif
+            
+            #ifdef INFLATE_STATS
+            uint64_t decode_started = stats_clock(context);
+            #endif
+            
+            /*
+            The fast loop: as long as there's room for the longest match
+            (plus what copy_match_fast() may write past it) in recipient, and
+            at least 8 bytes of input, we let the decode kernel for this CPU
+            run without checking the buffer edges for every symbol.
+            
+            When it stops near the end of our recipient and we're allowed to
+            grow it (see inflate_growable()), we do that and go right back to
+            the fast loop. Otherwise, we decode the next symbol carefully
+            below, checking everything, and give the fast loop another try.
+            */
+            uint32_t end_of_block = 0;
+            while (!end_of_block) {
+                uint32_t fast_result = context->decode_kernel(
+                    /* context: */
+                        context,
+                    /* data_stream: */
+                        &data_stream,
+                    /* litlen_table: */
+                        litlen_table,
+                    /* dist_table: */
+                        dist_table,
+                    /* recipient: */
+                        recipient,
+                    /* recipient_at: */
+                        &recipient_at,
+                    /* recipient_end: */
+                        recipient + recipient_size);
+                if (fast_result == INFLATE_FAST_LOOP_FAILED) {
+                    *out_good = 0;
+                    return;
+                }
+                if (fast_result == INFLATE_FAST_LOOP_END_OF_BLOCK) {
+                    break;
+                }
+                
+                if (
+                    realloc_funcptr != NULL &&
+                    recipient_size - (uint64_t)(recipient_at - recipient) <
+                        INFLATE_FAST_LOOP_MIN_OUTPUT)
+                {
+                    if (
+                        !grow_recipient(
+                            /* realloc_funcptr: */
+                                realloc_funcptr,
+                            /* recipient: */
+                                &recipient,
+                            /* recipient_at: */
+                                &recipient_at,
+                            /* recipient_size: */
+                                &recipient_size,
+                            /* needed_size: */
+                                (uint64_t)(recipient_at - recipient) +
+                                    INFLATE_FAST_LOOP_MIN_OUTPUT,
+                            /* grown_recipient: */
+                                grown_recipient,
+                            /* grown_capacity: */
+                                grown_capacity))
+                    {
+                        *out_good = 0;
+                        return;
+                    }
+                    continue;
+                }
+                
+                // we should normally break from this loop
+                // because we hit the magical value 256,
+                // not because of running out of bytes
+                
+                if (read_past_end(&data_stream)) {
+                    #ifndef INFLATE_SILENCE
+                    printf(
+                        "inflate() ERROR: ran out of input before finding the "
+                        "end of litlen (256), compressed_input_size was: "
+                        "%llu\n",
+                        compressed_input_size);
+                    #endif
+                    *out_good = 0;
+                    return;
+                }
+                
+                // 1 refill is enough for a whole length + distance pair:
+                // 15 + 5 + 15 + 13 = 48 bits
+                refill_bits(&data_stream);
+                
+                uint64_t space_left =
+                    recipient_size - (uint64_t)(recipient_at - recipient);
+                
+                /*
+                Up to 3 literals in 1 lookup. We always store 3 bytes and
+                then only advance by the amount of literals we really had,
+                the bytes after that get overwritten by what comes next.
+                */
+                uint32_t packed = litlen_table->packed_literals[
+                    mask_rightmost_bits(
+                        (uint32_t)data_stream.bit_buffer,
+                        litlen_table->root_bits)];
+                if (
+                    packed >= (1u << HUFFMAN_PACKED_COUNT_SHIFT) &&
+                    space_left >= HUFFMAN_PACKED_MAX_LITERALS)
+                {
+                    uint32_t literals_size =
+                        packed >> HUFFMAN_PACKED_COUNT_SHIFT;
+                    recipient_at[0] = (uint8_t)(packed      );
+                    recipient_at[1] = (uint8_t)(packed >>  8);
+                    recipient_at[2] = (uint8_t)(packed >> 16);
+                    recipient_at += literals_size;
+                    #ifdef INFLATE_STATS
+                    if (context->stats != NULL) {
+                        context->stats->literals += literals_size;
+                    }
+                    #endif
+                    discard_bits(
+                        /* from: */
+                            &data_stream,
+                        /* amount: */
+                            (packed >> HUFFMAN_PACKED_LENGTH_SHIFT) & 15);
+                    continue;
+                }
+                
+                HuffmanTableEntry litlen = huffman_table_decode(
+                    /* table: */
+                        litlen_table,
+                    /* raw data: */
+                        &data_stream);
+                
+                if (litlen.kind == HUFFMAN_ENTRY_LITERAL) {
+                    if (space_left < 1) {
+                        #ifndef INFLATE_SILENCE
+                        printf(
+                            "ERROR - recipient overflow! no room left for a "
+                            "literal\n");
+                        #endif
+                        *out_good = 0;
+                        return;
+                    }
+                    *recipient_at = (uint8_t)litlen.value;
+                    recipient_at++;
+                    #ifdef INFLATE_STATS
+                    if (context->stats != NULL) {
+                        context->stats->literals += 1;
+                    }
+                    #endif
+                    
+                    #ifndef INFLATE_IGNORE_ASSERTS
+                    assert(
+                        (uint64_t)(recipient_at - recipient)
+                            <= recipient_size);
+                    #endif
+                    
+                } else if (litlen.kind == HUFFMAN_ENTRY_LENGTH) {
+                    /*
+                    The table entry already holds the base length and the
+                    number of extra bits, so there's no second lookup into
+                    length_extra_bits_table here
+                    */
+                    uint32_t total_length = decode_extra_bits(
+                        /* entry: */ litlen,
+                        /* from: */ &data_stream);
+                    
+                    #ifndef INFLATE_IGNORE_ASSERTS
+                    assert(total_length >= 3);
+                    assert(total_length <= INFLATE_MAX_MATCH_LENGTH);
+                    #endif
+                    
+                    HuffmanTableEntry dist = huffman_table_decode(
+                        /* table: */
+                            dist_table,
+                        /* raw data: */
+                            &data_stream);
+                    if (dist.kind != HUFFMAN_ENTRY_DISTANCE) {
+                        #ifndef INFLATE_SILENCE
+                        printf(
+                            "inflate() failed, "
+                            "bad dist huffman decode\n");
+                        #endif
+                        *out_good = 0;
+                        return;
+                    }
+                    
+                    uint32_t total_dist = decode_extra_bits(
+                        /* entry: */ dist,
+                        /* from: */ &data_stream);
+                    
+                    // go back dist bytes, then copy length bytes
+                    uint64_t bytes_written =
+                        (uint64_t)(recipient_at - recipient);
+                    if (total_dist > bytes_written) {
+                        #ifndef INFLATE_SILENCE
+                        printf(
+                            "ERROR - can't repeat data from %u bytes before, "
+                            "address is out of bounds\n",
+                            total_dist);
+                        #endif
+                        *out_good = 0;
+                        return;
+                    }
+                    
+                    if (
+                        space_left >=
+                            INFLATE_MAX_MATCH_LENGTH +
+                                INFLATE_MATCH_COPY_OVERSHOOT)
+                    {
+                        copy_match_fast(
+                            /* to: */ recipient_at,
+                            /* distance: */ total_dist,
+                            /* length: */ total_length);
+                    } else if (total_length <= space_left) {
+                        copy_match_careful(
+                            /* to: */ recipient_at,
+                            /* distance: */ total_dist,
+                            /* length: */ total_length);
+                    } else {
+                        #ifndef INFLATE_SILENCE
+                        printf(
+                            "ERROR - recipient overflow! need %u bytes for a "
+                            "match, but only %llu left\n",
+                            total_length,
+                            space_left);
+                        #endif
+                        *out_good = 0;
+                        return;
+                    }
+                    recipient_at += total_length;
+                    #ifdef INFLATE_STATS
+                    if (context->stats != NULL) {
+                        stats_add_match(
+                            /* stats: */ context->stats,
+                            /* length: */ total_length,
+                            /* distance: */ total_dist);
+                    }
+                    #endif
+                } else if (litlen.kind == HUFFMAN_ENTRY_END_OF_BLOCK) {
+                    
+                    #ifndef INFLATE_SILENCE
+                    printf("\t\tend of ltln found!\n");
+                    #endif
+                    
+                    end_of_block = 1;
+                } else {
+                    #ifndef INFLATE_SILENCE
+                    printf(
+                        "inflate() failed, bad huffman decode\n");
+                    #endif
+                    *out_good = 0;
+                    return;
+                }
+            }
+            
+            // the output size lives in recipient_at while we decode
+            *final_recipient_size = (uint64_t)(recipient_at - recipient);
+            
+            #ifdef INFLATE_STATS
+            if (context->stats != NULL) {
+                context->stats->decode_time +=
+                    stats_clock(context) - decode_started;
+            }
+            #endif
+        }
+    }
+    
+    #ifndef INFLATE_SILENCE
+    if ((data_stream.bits_left & 7) != 0) {
+        printf(
+            "\t\tpartial byte left after DEFLATE\n");
+        printf(
+            "\t\tdiscarding: %u bits\n",
+            data_stream.bits_left & 7);
+    }
+    #endif
+    
+    if (!align_to_byte(&data_stream)) {
+        #ifndef INFLATE_SILENCE
+        printf(
+            "inflate() ERROR: the last block ended after the end of the "
+            "input\n");
+        #endif
+        *out_good = 0;
+        return;
+    }
+    
+    uint64_t bytes_read = (uint64_t)(data_stream.data - compressed_input);
+    if (bytes_read != compressed_input_size) {
+        #ifndef INFLATE_SILENCE
+        printf(
+           "Warning: expected to read %llu bytes but got %llu, ignoring the "
+           "rest\n",
+            compressed_input_size,
+            bytes_read);
+        #endif
+        
+        #ifndef INFLATE_IGNORE_ASSERTS
+        assert(compressed_input_size > bytes_read);
+        #endif
+    }
+    
+    #ifndef INFLATE_SILENCE 
+    printf("\t\tend of succesful inflate..\n");
+    #endif
+    
+    #ifdef INFLATE_STATS
+    if (context->stats != NULL) {
+        context->stats->input_bytes += bytes_read;
+        context->stats->output_bytes += *final_recipient_size;
+    }
+    #endif
+    
+    *out_good = 1;
+    return;
+}
+
+void inflate(
+    InflateContext * context,
+    uint8_t const * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    uint32_t * out_good)
+{
+    inflate_internal(
+        /* context: */
+            context,
+        /* recipient: */
+            (uint8_t *)recipient,
+        /* recipient_size: */
+            recipient_size,
+        /* final_recipient_size: */
+            final_recipient_size,
+        /* temp_working_memory: */
+            temp_working_memory,
+        /* temp_working_memory_size: */
+            temp_working_memory_size,
+        /* compressed_input: */
+            compressed_input,
+        /* compressed_input_size: */
+            compressed_input_size,
+        /* realloc_funcptr: */
+            NULL,
+        /* grown_recipient: */
+            NULL,
+        /* grown_capacity: */
+            NULL,
+        /* out_good: */
+            out_good);
+}
+
+void inflate_growable(
+    InflateContext * context,
+    void * (* realloc_funcptr)(void * to_grow, uint64_t new_size),
+    uint8_t ** recipient,
+    uint64_t * recipient_capacity,
+    uint64_t * final_recipient_size,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    uint32_t * out_good)
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(realloc_funcptr != NULL);
+    assert(recipient != NULL);
+    assert(recipient_capacity != NULL);
+    #endif
+    
+    if (*recipient == NULL) {
+        *recipient = (uint8_t *)realloc_funcptr(NULL, INFLATE_MIN_GROWN_SIZE);
+        if (*recipient == NULL) {
             #ifndef INFLATE_SILENCE
             printf(
-                "\t\t\tuncompr. block has LEN: %u bytes\n",
-                LEN);
+                "inflate_growable() ERROR: failed to allocate a "
+                "recipient\n");
             #endif
-            
-            uint16_t NLEN = (uint16_t)consume_bits(&data_stream, 16);
-            if ((uint16_t)LEN != (uint16_t)~NLEN) {
-                #ifndef INFLATE_SILENCE
-                printf(
-                    "inflate() ERROR: LEN didn't match NLEN\n");
-                #endif
-                *out_good = 0;
-                return;
+            *out_good = 0;
+            return;
+        }
+        *recipient_capacity = INFLATE_MIN_GROWN_SIZE;
+    }
+    
+    inflate_internal(
+        /* context: */
+            context,
+        /* recipient: */
+            *recipient,
+        /* recipient_size: */
+            *recipient_capacity,
+        /* final_recipient_size: */
+            final_recipient_size,
+        /* temp_working_memory: */
+            temp_working_memory,
+        /* temp_working_memory_size: */
+            temp_working_memory_size,
+        /* compressed_input: */
+            compressed_input,
+        /* compressed_input_size: */
+            compressed_input_size,
+        /* realloc_funcptr: */
+            realloc_funcptr,
+        /* grown_recipient: */
+            recipient,
+        /* grown_capacity: */
+            recipient_capacity,
+        /* out_good: */
+            out_good);
+}
+
+/*
+The streaming version of inflate() below can't see the whole input or the
+whole output at once. It decodes the same format, but:
+
+- input arrives in slices of any size, so every step of the decoder first
+  checks that the bits it needs are actually there. If not, we remember
+  where we were (mode) and return, and the next inflate_stream_feed() picks
+  up at the same spot
+- output goes to whatever buffer the caller hands us this time, so
+  back-references can't point into it. Instead we keep the last 32KiB of
+  output (the furthest a DEFLATE distance can reach) in a circular window
+*/
+#define INFLATE_WINDOW_SIZE 32768
+#define INFLATE_WINDOW_MASK (INFLATE_WINDOW_SIZE - 1)
+
+// we reject anything above INFLATE_MAX_LITLEN_CODES / INFLATE_MAX_DIST_CODES
+#define INFLATE_MAX_CODE_LENGTHS \
+    (INFLATE_MAX_LITLEN_CODES + INFLATE_MAX_DIST_CODES)
+
+#define STREAM_MODE_BLOCK_HEADER 0
+#define STREAM_MODE_STORED_HEADER 1
+#define STREAM_MODE_STORED_COPY 2
+#define STREAM_MODE_TABLE_SIZES 3
+#define STREAM_MODE_CODELENGTH_LENGTHS 4
+#define STREAM_MODE_CODE_LENGTHS 5
+#define STREAM_MODE_CODE_LENGTH_REPEAT 6
+#define STREAM_MODE_LITLEN 7
+#define STREAM_MODE_LENGTH_EXTRA 8
+#define STREAM_MODE_DIST 9
+#define STREAM_MODE_DIST_EXTRA 10
+#define STREAM_MODE_MATCH_COPY 11
+#define STREAM_MODE_DONE 12
+#define STREAM_MODE_ERROR 13
+
+struct InflateStream {
+    InflateContext * context; // allocators and the fixed huffman tables
+    
+    // the current input slice, only valid during inflate_stream_feed()
+    uint8_t const * next_in;
+    uint8_t const * in_end;
+    
+    // unlike DataStream, we only load bytes into here when we need them
+    uint64_t bit_buffer;
+    uint32_t bits_left;
+    
+    uint32_t mode;
+    uint32_t is_final_block;
+    
+    // stored blocks
+    uint32_t stored_bytes_left;
+    
+    // dynamic huffman headers
+    uint32_t HLIT;
+    uint32_t HDIST;
+    uint32_t HCLEN;
+    uint32_t lengths_read;
+    uint32_t repeat_symbol;
+    uint32_t code_lengths[INFLATE_MAX_CODE_LENGTHS];
+    uint32_t codelength_lengths[NUM_UNIQUE_CODELENGTHS];
+    
+    // the tables of the current block
+    HuffmanTable * litlen_table;
+    HuffmanTable * dist_table;
+    HuffmanTable dynamic_litlen_table;
+    HuffmanTable dynamic_dist_table;
+    HuffmanTable codelengths_table;
+    
+    // a length or distance symbol whose extra bits didn't arrive yet
+    HuffmanTableEntry pending_entry;
+    uint32_t match_length;
+    uint32_t match_dist;
+    
+    uint64_t total_out;
+    uint8_t window[INFLATE_WINDOW_SIZE];
+    
+    /*
+    Only for building an InflateIndex: return STREAM_PAUSED_AT_BLOCK before
+    each block header, so the caller can record where that block starts
+    */
+    uint32_t pause_at_blocks;
+    uint32_t paused_at_block;
+};
+
+// never returned to users, only when pause_at_blocks is set
+#define STREAM_PAUSED_AT_BLOCK 4
+
+/*
+Load bytes from the current input slice until we have at least
+bits_needed bits, or until the slice is empty
+
+returns 1 if we have enough bits now, 0 if we need more input
+*/
+inline static uint32_t stream_pull_bits(
+    InflateStream * stream,
+    const uint32_t bits_needed)
+{
+    while (stream->bits_left < bits_needed) {
+        if (stream->next_in >= stream->in_end) {
+            return 0;
+        }
+        
+        stream->bit_buffer |=
+            (uint64_t)*stream->next_in << stream->bits_left;
+        stream->next_in++;
+        stream->bits_left += 8;
+    }
+    
+    return 1;
+}
+
+/*
+Consume bits that stream_pull_bits() already made sure were available
+*/
+inline static uint32_t stream_take_bits(
+    InflateStream * stream,
+    const uint32_t amount)
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(amount <= stream->bits_left);
+    assert(amount < 33);
+    #endif
+    
+    uint32_t return_val =
+        (uint32_t)(stream->bit_buffer & ((1ull << amount) - 1));
+    stream->bit_buffer >>= amount;
+    stream->bits_left -= amount;
+    
+    return return_val;
+}
+
+#define STREAM_DECODE_NEEDS_INPUT 0
+#define STREAM_DECODE_OK 1
+#define STREAM_DECODE_BAD 2
+
+/*
+Decode the next huffman code from our stream
+
+Most codes are shorter than the 15 bits we'd like to peek at, so when the
+input runs dry we still try a lookup with what we have. If the code we find
+fits inside the bits we really have it's the right one, otherwise we have
+to wait for more input.
+*/
+static uint32_t stream_decode(
+    InflateStream * stream,
+    HuffmanTable * table,
+    HuffmanTableEntry * recipient)
+{
+    uint32_t have_all_bits = stream_pull_bits(
+        /* stream: */ stream,
+        /* bits_needed: */ HUFFMAN_MAX_CODE_LENGTH);
+    
+    uint32_t upcoming_bits =
+        (uint32_t)(stream->bit_buffer & ((1 << HUFFMAN_MAX_CODE_LENGTH) - 1));
+    
+    HuffmanTableEntry entry =
+        table->entries[
+            mask_rightmost_bits(upcoming_bits, table->root_bits)];
+    
+    if (entry.kind == HUFFMAN_ENTRY_SUBTABLE) {
+        entry = table->entries[
+            entry.value +
+                mask_rightmost_bits(
+                    upcoming_bits >> table->root_bits,
+                    entry.extra_bits)];
+    }
+    
+    if (
+        entry.kind == HUFFMAN_ENTRY_INVALID ||
+        entry.code_length > stream->bits_left)
+    {
+        return have_all_bits ?
+            STREAM_DECODE_BAD :
+            STREAM_DECODE_NEEDS_INPUT;
+    }
+    
+    stream_take_bits(stream, entry.code_length);
+    *recipient = entry;
+    
+    return STREAM_DECODE_OK;
+}
+
+/*
+Copy decoded bytes into our window, so later blocks and later calls can
+still refer back to them
+*/
+static void stream_update_window(
+    InflateStream * stream,
+    uint8_t const * from,
+    uint64_t size)
+{
+    if (size > INFLATE_WINDOW_SIZE) {
+        from += size - INFLATE_WINDOW_SIZE;
+        stream->total_out += size - INFLATE_WINDOW_SIZE;
+        size = INFLATE_WINDOW_SIZE;
+    }
+    
+    uint32_t window_at = (uint32_t)(stream->total_out & INFLATE_WINDOW_MASK);
+    
+    // inflate_to_sink() decodes straight into the window, nothing to copy
+    if (from == stream->window + window_at) {
+        stream->total_out += size;
+        return;
+    }
+    
+    uint64_t first_part = INFLATE_WINDOW_SIZE - window_at;
+    if (first_part > size) {
+        first_part = size;
+    }
+    
+    stream->context->memcpy_func(
+        stream->window + window_at,
+        from,
+        first_part);
+    if (size > first_part) {
+        stream->context->memcpy_func(
+            stream->window,
+            from + first_part,
+            size - first_part);
+    }
+    
+    stream->total_out += size;
+}
+
+InflateStream * inflate_stream_begin(
+    InflateContext * context)
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(context != NULL);
+    #endif
+    
+    InflateStream * stream = context->malloc_func(sizeof(InflateStream));
+    if (stream == NULL) {
+        return NULL;
+    }
+    
+    // the window and the tables don't need to be zeroed
+    stream->context = context;
+    stream->next_in = NULL;
+    stream->in_end = NULL;
+    stream->bit_buffer = 0;
+    stream->bits_left = 0;
+    stream->mode = STREAM_MODE_BLOCK_HEADER;
+    stream->is_final_block = 0;
+    stream->litlen_table = NULL;
+    stream->dist_table = NULL;
+    stream->match_length = 0;
+    stream->match_dist = 0;
+    stream->total_out = 0;
+    stream->pause_at_blocks = 0;
+    stream->paused_at_block = 0;
+    
+    return stream;
+}
+
+uint32_t inflate_stream_feed(
+    InflateStream * stream,
+    uint8_t const * input,
+    const uint64_t input_size,
+    uint64_t * input_consumed,
+    uint8_t * output,
+    const uint64_t output_size,
+    uint64_t * output_written)
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(stream != NULL);
+    assert(input != NULL || input_size == 0);
+    assert(output != NULL || output_size == 0);
+    #endif
+    
+    stream->next_in = input;
+    stream->in_end = input + input_size;
+    
+    uint8_t * output_at = output;
+    uint8_t * output_end = output + output_size;
+    
+    uint32_t status = INFLATE_STREAM_ERROR;
+    
+    while (1) {
+        switch (stream->mode) {
+            case STREAM_MODE_BLOCK_HEADER: {
+                if (stream->pause_at_blocks && !stream->paused_at_block) {
+                    stream->paused_at_block = 1;
+                    status = STREAM_PAUSED_AT_BLOCK;
+                    goto suspend;
+                }
+                
+                // BFINAL (1 bit) then BTYPE (2 bits), see inflate()
+                if (!stream_pull_bits(stream, 3)) {
+                    status = INFLATE_STREAM_NEEDS_INPUT;
+                    goto suspend;
+                }
+                
+                stream->paused_at_block = 0;
+                stream->is_final_block = stream_take_bits(stream, 1);
+                uint32_t BTYPE = stream_take_bits(stream, 2);
+                
+                if (BTYPE == 0) {
+                    stream->mode = STREAM_MODE_STORED_HEADER;
+                } else if (BTYPE == 1) {
+                    stream->litlen_table = &stream->context->fixed_litlen_table;
+                    stream->dist_table = &stream->context->fixed_dist_table;
+                    stream->mode = STREAM_MODE_LITLEN;
+                } else if (BTYPE == 2) {
+                    stream->mode = STREAM_MODE_TABLE_SIZES;
+                } else {
+                    #ifndef INFLATE_SILENCE
+                    printf(
+                        "inflate_stream_feed() ERROR - unexpected deflate "
+                        "BTYPE %u\n",
+                        BTYPE);
+                    #endif
+                    goto fail;
+                }
+                break;
             }
-            
-            for (int _ = 0; _ < LEN; _++) {
-                *recipient_at = *(uint8_t *)data_stream.data;
-                recipient_at++;
-                *final_recipient_size += 1;
-                #ifndef INFLATE_IGNORE_ASSERTS
-                assert(*final_recipient_size <= recipient_size);
-                #endif
+            case STREAM_MODE_STORED_HEADER: {
+                // the 2 lengths start at the next byte boundary
+                stream_take_bits(stream, stream->bits_left & 7);
+                
+                if (!stream_pull_bits(stream, 32)) {
+                    status = INFLATE_STREAM_NEEDS_INPUT;
+                    goto suspend;
+                }
+                
+                uint32_t LEN = stream_take_bits(stream, 16);
+                uint32_t NLEN = stream_take_bits(stream, 16);
+                if (LEN != (~NLEN & 0xffff)) {
+                    #ifndef INFLATE_SILENCE
+                    printf(
+                        "inflate_stream_feed() ERROR: LEN didn't match "
+                        "NLEN\n");
+                    #endif
+                    goto fail;
+                }
+                
+                stream->stored_bytes_left = LEN;
+                stream->mode = STREAM_MODE_STORED_COPY;
+                break;
+            }
+            case STREAM_MODE_STORED_COPY: {
+                // we may have pulled a byte or 2 of the block already
+                while (
+                    stream->stored_bytes_left > 0 &&
+                    stream->bits_left >= 8 &&
+                    output_at < output_end)
+                {
+                    *output_at = (uint8_t)stream_take_bits(stream, 8);
+                    stream_update_window(stream, output_at, 1);
+                    output_at++;
+                    stream->stored_bytes_left--;
+                }
+                
+                uint64_t size = stream->stored_bytes_left;
+                if (size > (uint64_t)(output_end - output_at)) {
+                    size = (uint64_t)(output_end - output_at);
+                }
+                if (size > (uint64_t)(stream->in_end - stream->next_in)) {
+                    size = (uint64_t)(stream->in_end - stream->next_in);
+                }
+                
+                if (size > 0) {
+                    stream->context->memcpy_func(
+                        output_at,
+                        stream->next_in,
+                        size);
+                    stream_update_window(stream, output_at, size);
+                    output_at += size;
+                    stream->next_in += size;
+                    stream->stored_bytes_left -= (uint32_t)size;
+                }
+                
+                if (stream->stored_bytes_left > 0) {
+                    status = output_at >= output_end ?
+                        INFLATE_STREAM_NEEDS_OUTPUT :
+                        INFLATE_STREAM_NEEDS_INPUT;
+                    goto suspend;
+                }
+                
+                stream->mode = stream->is_final_block ?
+                    STREAM_MODE_DONE :
+                    STREAM_MODE_BLOCK_HEADER;
+                break;
+            }
+            case STREAM_MODE_TABLE_SIZES: {
+                // HLIT (5 bits), HDIST (5 bits), HCLEN (4 bits)
+                if (!stream_pull_bits(stream, 14)) {
+                    status = INFLATE_STREAM_NEEDS_INPUT;
+                    goto suspend;
+                }
                 
-                if ((uint64_t)(recipient_at - recipient)
-                    >= recipient_size)
+                stream->HLIT = stream_take_bits(stream, 5) + 257;
+                stream->HDIST = stream_take_bits(stream, 5) + 1;
+                stream->HCLEN = stream_take_bits(stream, 4) + 4;
+                
+                if (
+                    stream->HLIT > INFLATE_MAX_LITLEN_CODES ||
+                    stream->HDIST > INFLATE_MAX_DIST_CODES)
                 {
                     #ifndef INFLATE_SILENCE
                     printf(
-                        "ERROR - recipient overflow! recipient_at: %p - "
-                        "recipient: %p = %llu, but recipient_size only: %llu\n",
-                        (void *)recipient_at,
-                        (void *)recipient,
-                        (uint64_t)((ptrdiff_t)recipient_at -
-                            (ptrdiff_t)recipient),
-                        recipient_size);
-                    *out_good = 0;
-                    return;
+                        "inflate_stream_feed() ERROR: HLIT %u / HDIST %u "
+                        "out of range\n",
+                        stream->HLIT,
+                        stream->HDIST);
                     #endif
+                    goto fail;
                 }
                 
-                #ifndef INFLATE_IGNORE_ASSERTS
-                assert(
-                    (recipient_at - recipient) <= (uint32_t)recipient_size);
-                #endif
-                data_stream.data++;
-                data_stream.size_left--;
+                for (uint32_t i = 0; i < NUM_UNIQUE_CODELENGTHS; i++) {
+                    stream->codelength_lengths[i] = 0;
+                }
+                stream->lengths_read = 0;
+                stream->mode = STREAM_MODE_CODELENGTH_LENGTHS;
+                break;
             }
-        } else if (BTYPE > 2) {
-            #ifndef INFLATE_SILENCE
-            printf(
-                "\t\t\tERROR - unexpected deflate BTYPE %u\n",
-                BTYPE);
-            #endif
-            #ifndef INFLATE_IGNORE_ASSERTS
-            assert(0);
-            #endif
-        } else {
-            #ifndef INFLATE_IGNORE_ASSERTS
-            assert(BTYPE >= 1 && BTYPE <= 2);
-            #endif
-            
-            // used in both dynamic & fixed huffman encoded files
-            HuffmanEntry * literal_length_huffman = NULL;
-            HashedHuffman * hashed_litlen_huffman = NULL;
-            
-            // only used in dynamic, keep NULL for fixed 
-            HuffmanEntry * distance_huffman = NULL;
-            HashedHuffman * hashed_dist_huffman = NULL;
-            
-            // will be overwritten in dynamic
-            // leave 288 for fixed
-            uint32_t HLIT = 288; 
-            // only used in dynamic, keep 0 for fixed
-            uint32_t HDIST = 0;
-            
-            if (BTYPE == 1) {
-                #ifndef INFLATE_SILENCE
-                printf("\t\t\tBTYPE 1 - Fixed Huffman\n");
-                #endif
+            case STREAM_MODE_CODELENGTH_LENGTHS: {
+                // (HCLEN) x 3 bits, in swizzled order
+                while (stream->lengths_read < stream->HCLEN) {
+                    if (!stream_pull_bits(stream, 3)) {
+                        status = INFLATE_STREAM_NEEDS_INPUT;
+                        goto suspend;
+                    }
+                    
+                    stream->codelength_lengths[
+                        swizzle[stream->lengths_read]] =
+                            stream_take_bits(stream, 3);
+                    stream->lengths_read++;
+                }
                 
-                #ifndef INFLATE_IGNORE_ASSERTS
-                assert(distance_huffman == NULL);
-                #endif
+                uint32_t codelengths_good = 0;
+                build_huffman_table(
+                    /* context: */
+                        stream->context,
+                    /* code_lengths: */
+                        stream->codelength_lengths,
+                    /* code_lengths_size: */
+                        NUM_UNIQUE_CODELENGTHS,
+                    /* alphabet: */
+                        HUFFMAN_ALPHABET_CODELENGTHS,
+                    /* root_bits: */
+                        HUFFMAN_CODELENGTHS_ROOT_BITS,
+                    /* recipient: */
+                        &stream->codelengths_table,
+                    /* good: */
+                        &codelengths_good);
+                if (!codelengths_good) {
+                    #ifndef INFLATE_SILENCE
+                    printf("inflate_stream_feed() failed, bad huffman table\n");
+                    #endif
+                    goto fail;
+                }
                 
-                /*
-                The Huffman codes for the two alphabets
-                are fixed, and are not represented explicitly
-                in the data.
+                stream->lengths_read = 0;
+                stream->mode = STREAM_MODE_CODE_LENGTHS;
+                break;
+            }
+            case STREAM_MODE_CODE_LENGTHS: {
+                uint32_t two_dicts_size = stream->HLIT + stream->HDIST;
+                
+                while (stream->lengths_read < two_dicts_size) {
+                    HuffmanTableEntry entry;
+                    uint32_t decoded = stream_decode(
+                        /* stream: */ stream,
+                        /* table: */ &stream->codelengths_table,
+                        /* recipient: */ &entry);
+                    if (decoded == STREAM_DECODE_NEEDS_INPUT) {
+                        status = INFLATE_STREAM_NEEDS_INPUT;
+                        goto suspend;
+                    } else if (decoded == STREAM_DECODE_BAD) {
+                        #ifndef INFLATE_SILENCE
+                        printf(
+                            "inflate_stream_feed() failed, bad huffman "
+                            "decode\n");
+                        #endif
+                        goto fail;
+                    }
+                    
+                    if (entry.value <= 15) {
+                        stream->code_lengths[stream->lengths_read] =
+                            entry.value;
+                        stream->lengths_read++;
+                    } else {
+                        // 16, 17 and 18 are followed by a repeat count
+                        stream->repeat_symbol = entry.value;
+                        stream->mode = STREAM_MODE_CODE_LENGTH_REPEAT;
+                        break;
+                    }
+                }
+                
+                if (stream->mode == STREAM_MODE_CODE_LENGTH_REPEAT) {
+                    break;
+                }
+                
+                uint32_t litlen_good = 0;
+                build_huffman_table(
+                    /* context: */
+                        stream->context,
+                    /* code_lengths: */
+                        stream->code_lengths,
+                    /* code_lengths_size: */
+                        stream->HLIT,
+                    /* alphabet: */
+                        HUFFMAN_ALPHABET_LITLEN,
+                    /* root_bits: */
+                        HUFFMAN_LITLEN_ROOT_BITS,
+                    /* recipient: */
+                        &stream->dynamic_litlen_table,
+                    /* good: */
+                        &litlen_good);
+                
+                uint32_t dist_good = 0;
+                if (litlen_good) {
+                    build_huffman_table(
+                        /* context: */
+                            stream->context,
+                        /* code_lengths: */
+                            stream->code_lengths + stream->HLIT,
+                        /* code_lengths_size: */
+                            stream->HDIST,
+                        /* alphabet: */
+                            HUFFMAN_ALPHABET_DIST,
+                        /* root_bits: */
+                            HUFFMAN_DIST_ROOT_BITS,
+                        /* recipient: */
+                            &stream->dynamic_dist_table,
+                        /* good: */
+                            &dist_good);
+                }
+                
+                if (!dist_good) {
+                    #ifndef INFLATE_SILENCE
+                    printf("inflate_stream_feed() failed, bad huffman table\n");
+                    #endif
+                    goto fail;
+                }
                 
-                The Huffman code lengths for the literal/length
-                alphabet are:
+                stream->litlen_table = &stream->dynamic_litlen_table;
+                stream->dist_table = &stream->dynamic_dist_table;
+                stream->mode = STREAM_MODE_LITLEN;
+                break;
+            }
+            case STREAM_MODE_CODE_LENGTH_REPEAT: {
+                /*
+                16: Copy previous code length 3-6 times (2 extra bits)
+                17: Repeat a code length of 0 for 3 - 10 times (3 extra bits)
+                18: Repeat a code length of 0 for 11 - 138 times (7 extra bits)
+                */
+                uint32_t extra_bits = 2;
+                uint32_t min_repeats = 3;
+                uint32_t repeated_length = 0;
+                if (stream->repeat_symbol == 16) {
+                    if (stream->lengths_read == 0) {
+                        #ifndef INFLATE_SILENCE
+                        printf(
+                            "inflate_stream_feed() ERROR: code length 16 "
+                            "with nothing to repeat\n");
+                        #endif
+                        goto fail;
+                    }
+                    repeated_length =
+                        stream->code_lengths[stream->lengths_read - 1];
+                } else if (stream->repeat_symbol == 17) {
+                    extra_bits = 3;
+                } else {
+                    extra_bits = 7;
+                    min_repeats = 11;
+                }
                 
-                Lit Value    Bits   Codes
-                ---------    ----   -----
-                0   - 143     8     00110000 through 10111111
-                144 - 255     9     110010000 through 111111111
-                256 - 279     7     0000000 through 0010111
-                280 - 287     8     11000000 through 11000111
-                */
-                ifs[thread_id]->fixed_hclen_table[0] = 8; //  32bit
-                ifs[thread_id]->fixed_hclen_table[1] = 8; //  64bit
-                ifs[thread_id]->fixed_hclen_table[2] = 8; //
-                ifs[thread_id]->fixed_hclen_table[3] = 8; // 128bit
-                for (int i = 4; i < 144; i+=4) {
-                    memcpy_func(
-                        ifs[thread_id]->fixed_hclen_table + i,
-                        ifs[thread_id]->fixed_hclen_table,
-                        16);
+                if (!stream_pull_bits(stream, extra_bits)) {
+                    status = INFLATE_STREAM_NEEDS_INPUT;
+                    goto suspend;
                 }
                 
-                ifs[thread_id]->fixed_hclen_table[144] = 9; //  32bit
-                ifs[thread_id]->fixed_hclen_table[145] = 9; //  64bit
-                ifs[thread_id]->fixed_hclen_table[146] = 9; //
-                ifs[thread_id]->fixed_hclen_table[147] = 9; // 128bit
-                for (int i = 148; i < 256; i+=4) {
-                    memcpy_func(
-                        ifs[thread_id]->fixed_hclen_table + i,
-                        ifs[thread_id]->fixed_hclen_table + 144,
-                        16);
+                uint32_t repeats =
+                    stream_take_bits(stream, extra_bits) + min_repeats;
+                if (
+                    stream->lengths_read + repeats >
+                        stream->HLIT + stream->HDIST)
+                {
+                    #ifndef INFLATE_SILENCE
+                    printf(
+                        "inflate_stream_feed() ERROR: code lengths repeat "
+                        "past the end of the table\n");
+                    #endif
+                    goto fail;
                 }
                 
-                ifs[thread_id]->fixed_hclen_table[256] = 7; //  32bit
-                ifs[thread_id]->fixed_hclen_table[257] = 7; //  64bit
-                ifs[thread_id]->fixed_hclen_table[258] = 7; //
-                ifs[thread_id]->fixed_hclen_table[259] = 7; // 128bit
-                for (int i = 260; i < 280; i+=4) {
-                    memcpy_func(
-                        ifs[thread_id]->fixed_hclen_table + i,
-                        ifs[thread_id]->fixed_hclen_table + 256,
-                        16);
+                for (uint32_t i = 0; i < repeats; i++) {
+                    stream->code_lengths[stream->lengths_read] =
+                        repeated_length;
+                    stream->lengths_read++;
                 }
                 
-                ifs[thread_id]->fixed_hclen_table[280] = 8; //  32bit
-                ifs[thread_id]->fixed_hclen_table[281] = 8; //  64bit
-                ifs[thread_id]->fixed_hclen_table[282] = 8; //
-                ifs[thread_id]->fixed_hclen_table[283] = 8; // 128bit
-                for (int i = 284; i < 288; i+=4) {
-                    memcpy_func(
-                        ifs[thread_id]->fixed_hclen_table + i,
-                        ifs[thread_id]->fixed_hclen_table + 280,
-                        16);
+                stream->mode = STREAM_MODE_CODE_LENGTHS;
+                break;
+            }
+            case STREAM_MODE_LITLEN: {
+                // don't decode a literal we'd have nowhere to put
+                if (output_at >= output_end) {
+                    status = INFLATE_STREAM_NEEDS_OUTPUT;
+                    goto suspend;
                 }
                 
-                uint32_t ll_good = 0;
-                if (working_memory_remaining < sizeof(HuffmanEntry) * 288) {
+                HuffmanTableEntry entry;
+                uint32_t decoded = stream_decode(
+                    /* stream: */ stream,
+                    /* table: */ stream->litlen_table,
+                    /* recipient: */ &entry);
+                if (decoded == STREAM_DECODE_NEEDS_INPUT) {
+                    status = INFLATE_STREAM_NEEDS_INPUT;
+                    goto suspend;
+                } else if (decoded == STREAM_DECODE_BAD) {
                     #ifndef INFLATE_SILENCE
-                    printf("inflate() failing - ran out of working memory\n");
+                    printf(
+                        "inflate_stream_feed() failed, bad huffman decode\n");
                     #endif
-                    *out_good = 0;
-                    return;
+                    goto fail;
                 }
                 
-                align_memory(&working_memory_at, &working_memory_remaining);
-                literal_length_huffman = (HuffmanEntry *)working_memory_at;
-                working_memory_at += sizeof(HuffmanEntry) * 288;
-                working_memory_remaining -= sizeof(HuffmanEntry) * 288;
-                unpack_huffman(
-                    /* array:     : */
-                        ifs[thread_id]->fixed_hclen_table,
-                    /* array_and_recipient_size : */
-                        288,
-                    /* recipient: */
-                        literal_length_huffman,
-                    /* good:      : */
-                        &ll_good);
-                
-                if (!ll_good) {
-                    #ifndef INFLATE_SILENCE
-                    printf(
-                        "INFLATE failed, "
-                        "bad literal length huffman unpack\n");
+                if (entry.kind == HUFFMAN_ENTRY_LITERAL) {
+                    *output_at = (uint8_t)entry.value;
+                    stream->window[stream->total_out & INFLATE_WINDOW_MASK] =
+                        *output_at;
+                    stream->total_out++;
+                    output_at++;
+                } else if (entry.kind == HUFFMAN_ENTRY_LENGTH) {
+                    stream->pending_entry = entry;
+                    stream->mode = STREAM_MODE_LENGTH_EXTRA;
+                } else {
+                    #ifndef INFLATE_IGNORE_ASSERTS
+                    assert(entry.kind == HUFFMAN_ENTRY_END_OF_BLOCK);
                     #endif
-                    *out_good = 0;
-                    return;
+                    stream->mode = stream->is_final_block ?
+                        STREAM_MODE_DONE :
+                        STREAM_MODE_BLOCK_HEADER;
+                }
+                break;
+            }
+            case STREAM_MODE_LENGTH_EXTRA: {
+                if (!stream_pull_bits(stream, stream->pending_entry.extra_bits))
+                {
+                    status = INFLATE_STREAM_NEEDS_INPUT;
+                    goto suspend;
                 }
-               
-                #ifndef INFLATE_IGNORE_ASSERTS 
-                assert(literal_length_huffman[0].value == 0);
-                assert(
-                    literal_length_huffman[0].code_length == 8);
-                assert(literal_length_huffman[0].key == 48);
-                assert(literal_length_huffman[143].value == 143);
-                assert(
-                    literal_length_huffman[143].code_length == 8);
-                assert(literal_length_huffman[143].key == 191);
-                assert(literal_length_huffman[144].value == 144);
-                assert(
-                    literal_length_huffman[144].code_length == 9);
-                assert(literal_length_huffman[144].key == 400);
-                assert(literal_length_huffman[255].value == 255);
-                assert(
-                    literal_length_huffman[255].code_length == 9);
-                assert(literal_length_huffman[255].key == 511);
-                assert(literal_length_huffman[256].value == 256);
-                assert(
-                    literal_length_huffman[256].code_length == 7);
-                assert(literal_length_huffman[256].key == 0);
-                assert(literal_length_huffman[279].value == 279);
-                assert(
-                    literal_length_huffman[279].code_length == 7);
-                assert(literal_length_huffman[279].key == 23);
-                assert(literal_length_huffman[280].value == 280);
-                assert(
-                    literal_length_huffman[280].code_length == 8);
-                assert(literal_length_huffman[280].key == 192);
-                assert(literal_length_huffman[287].value == 287);
-                assert(
-                    literal_length_huffman[287].code_length == 8);
-                assert(literal_length_huffman[287].key == 199);
-                #endif
                 
-                if (working_memory_remaining < sizeof(HashedHuffman)) {
+                stream->match_length =
+                    stream->pending_entry.value +
+                        stream_take_bits(
+                            stream,
+                            stream->pending_entry.extra_bits);
+                stream->mode = STREAM_MODE_DIST;
+                break;
+            }
+            case STREAM_MODE_DIST: {
+                HuffmanTableEntry entry;
+                uint32_t decoded = stream_decode(
+                    /* stream: */ stream,
+                    /* table: */ stream->dist_table,
+                    /* recipient: */ &entry);
+                if (decoded == STREAM_DECODE_NEEDS_INPUT) {
+                    status = INFLATE_STREAM_NEEDS_INPUT;
+                    goto suspend;
+                } else if (
+                    decoded == STREAM_DECODE_BAD ||
+                    entry.kind != HUFFMAN_ENTRY_DISTANCE)
+                {
                     #ifndef INFLATE_SILENCE
-                    printf("inflate() failing - ran out of working memory\n");
+                    printf(
+                        "inflate_stream_feed() failed, bad dist huffman "
+                        "decode\n");
                     #endif
-                    *out_good = 0;
-                    return;
+                    goto fail;
                 }
-                align_memory(&working_memory_at, &working_memory_remaining);
-                hashed_litlen_huffman = (HashedHuffman *)working_memory_at;
-                working_memory_at += sizeof(HashedHuffman);
-                working_memory_remaining -= sizeof(HashedHuffman);
-                
-                huffman_to_hashmap(
-                    /* huffman_input: */
-                        literal_length_huffman,
-                    /* huffman_input_size: */
-                        HLIT,
-                    /* recipient: */
-                        hashed_litlen_huffman);
                 
-                if (hashed_litlen_huffman == NULL) {
-                    *out_good = 0;
-                    return;
+                stream->pending_entry = entry;
+                stream->mode = STREAM_MODE_DIST_EXTRA;
+                break;
+            }
+            case STREAM_MODE_DIST_EXTRA: {
+                if (!stream_pull_bits(stream, stream->pending_entry.extra_bits))
+                {
+                    status = INFLATE_STREAM_NEEDS_INPUT;
+                    goto suspend;
                 }
                 
-                #ifndef INFLATE_SILENCE 
-                printf("\t\t\tcreated fixed huffman dict.\n");
-                #endif
-            } else {
-                #ifndef INFLATE_IGNORE_ASSERTS
-                assert(BTYPE == 2);
-                #endif
-                
-                #ifndef INFLATE_SILENCE
-                printf("\t\t\tBTYPE 2 - Dynamic Huffman\n");
-                printf("\t\t\tRead code trees...\n");
-                #endif
-                
-                /*
-                The Huffman codes for the two alphabets
-                appear in the block immediately after the
-                header bits and before the actual compressed
-                data, first the literal/length code and then
-                the distance code. Each code is defined by a
-                sequence of code lengths.
-                */
-                
-                // 5 Bits: HLIT (huffman literal)
-                // number of Literal/Length codes - 257
-                // (257 - 286)
-                HLIT = consume_bits(
-                    /* from: */ &data_stream,
-                    /* size: */ 5)
-                        + 257;
-                
-                #ifndef INFLATE_SILENCE
-                printf(
-                    "\t\t\tHLIT : %u (expect 257-286)\n",
-                    HLIT);
-                #endif
-                
-                #ifndef INFLATE_IGNORE_ASSERTS
-                assert(HLIT >= 257 && HLIT <= 286);
-                #endif
-                
-                // 5 Bits: HDIST (huffman distance?)
-                // # of Distance codes - 1
-                // (1 - 32)
-                HDIST = consume_bits(
-                    /* from: */ &data_stream,
-                    /* size: */ 5)
-                        + 1;
-                
-                #ifndef INFLATE_SILENCE
-                printf(
-                    "\t\t\tHDIST: %u (expect 1-32)\n",
-                    HDIST);
-                #endif
-                
-                #ifndef INFLATE_IGNORE_ASSERTS
-                assert(HDIST >= 1 && HDIST <= 32);
-                #endif
-                
-                // 4 Bits: HCLEN (huffman code length)
-                // # of Code Length codes - 4
-                // (4 - 19)
-                uint32_t HCLEN = consume_bits(
-                    /* from: */ &data_stream,
-                    /* size: */ 4)
-                        + 4;
-                
-                #ifndef INFLATE_SILENCE
-                printf(
-                    "\t\t\tHCLEN: %u (4-19 vals of 0-6)\n",
-                     HCLEN);
-                #endif
-               
-                #ifndef INFLATE_IGNORE_ASSERTS 
-                assert(
-                    HCLEN >= 4
-                    && HCLEN <= 19);
-                #endif
-                
-                
-                
-                // read (HCLEN + 4) x 3 bits
-                // these are code lengths for the code length
-                // dictionary,
-                // and they'll come in "swizzled" order
-                #ifndef INFLATE_SILENCE
-                printf("\t\t\tReading raw code lengths\n");
-                #endif
-                
-                // 0-init swizzled HCLEN table
-                memset_func(
-                    ifs[thread_id]->swizzled_HCLEN_table,
-                    0,
-                    4 * NUM_UNIQUE_CODELENGTHS);
+                stream->match_dist =
+                    stream->pending_entry.value +
+                        stream_take_bits(
+                            stream,
+                            stream->pending_entry.extra_bits);
                 
-                for (uint32_t i = 0; i < HCLEN; i++) {
-                    #ifndef INFLATE_IGNORE_ASSERTS
-                    assert(swizzle[i] < NUM_UNIQUE_CODELENGTHS);
-                    #endif
-                    
-                    ifs[thread_id]->swizzled_HCLEN_table[swizzle[i]] =
-                            consume_bits(
-                                /* from: */ &data_stream,
-                                /* size: */ 3);
-                    
-                    #ifndef INFLATE_IGNORE_ASSERTS
-                    assert(
-                        ifs[thread_id]->swizzled_HCLEN_table[swizzle[i]] <= 7);
-                    assert(
-                        ifs[thread_id]->swizzled_HCLEN_table[swizzle[i]] >= 0);
+                if (stream->match_dist > stream->total_out) {
+                    #ifndef INFLATE_SILENCE
+                    printf(
+                        "inflate_stream_feed() ERROR - can't repeat data "
+                        "from %u bytes before, address is out of bounds\n",
+                        stream->match_dist);
                     #endif
+                    goto fail;
                 }
                 
+                stream->mode = STREAM_MODE_MATCH_COPY;
+                break;
+            }
+            case STREAM_MODE_MATCH_COPY: {
                 /*
-                We now have some values in HCLEN_table,
-                but these are themselves 'compressed'
-                and need to be unpacked
+                The distance is never more than 32KiB, so the source is
+                always still in our window. Reading the window before
+                writing it also takes care of overlapping matches.
                 */
-                #ifndef INFLATE_SILENCE
-                printf("\t\t\tUnpack codelengths table...\n");
-                #endif
-                
-                if (working_memory_remaining <
-                    sizeof(HuffmanEntry) * NUM_UNIQUE_CODELENGTHS)
-                {
-                    #ifndef INFLATE_SILENCE
-                    printf("inflate() failing - ran out of working memory\n");
-                    #endif
-                    *out_good = 0;
-                    return;
+                while (stream->match_length > 0 && output_at < output_end) {
+                    uint8_t copied = stream->window[
+                        (stream->total_out - stream->match_dist) &
+                            INFLATE_WINDOW_MASK];
+                    stream->window[stream->total_out & INFLATE_WINDOW_MASK] =
+                        copied;
+                    *output_at = copied;
+                    output_at++;
+                    stream->total_out++;
+                    stream->match_length--;
                 }
-                uint32_t cl_good = 0;
-                align_memory(&working_memory_at, &working_memory_remaining);
-                HuffmanEntry * codelengths_huffman =
-                    (HuffmanEntry *)working_memory_at;
-                working_memory_at +=
-                    sizeof(HuffmanEntry) * NUM_UNIQUE_CODELENGTHS;
-                working_memory_remaining -=
-                    sizeof(HuffmanEntry) * NUM_UNIQUE_CODELENGTHS;
-                
-                unpack_huffman(
-                    /* array:     : */
-                        ifs[thread_id]->swizzled_HCLEN_table,
-                    /* array_and_recipient_size : */
-                        NUM_UNIQUE_CODELENGTHS,
-                    /* recipient: */
-                        codelengths_huffman,
-                    /* good: */
-                        &cl_good);
                 
-                if (!cl_good) {
-                    #ifndef INFLATE_SILENCE
-                    printf("INFLATE failed, bad huffman unpack\n");
-                    #endif
-                    *out_good = 0;
-                    return;
+                if (stream->match_length > 0) {
+                    status = INFLATE_STREAM_NEEDS_OUTPUT;
+                    goto suspend;
                 }
                 
-                if (working_memory_remaining < sizeof(HashedHuffman))
-                {
-                    #ifndef INFLATE_SILENCE
-                    printf("inflate() failing - ran out of working memory\n");
-                    #endif
-                    *out_good = 0;
-                    return;
+                stream->mode = STREAM_MODE_LITLEN;
+                break;
+            }
+            case STREAM_MODE_DONE: {
+                /*
+                Whatever whole bytes we pulled past the end of the deflate
+                stream belong to the caller (a gzip footer for example), so
+                we give them back if they came from this slice
+                */
+                stream_take_bits(stream, stream->bits_left & 7);
+                uint64_t unused_bytes = stream->bits_left >> 3;
+                if (unused_bytes <= (uint64_t)(stream->next_in - input)) {
+                    stream->next_in -= unused_bytes;
+                    stream->bit_buffer = 0;
+                    stream->bits_left = 0;
                 }
-                align_memory(&working_memory_at, &working_memory_remaining);
-                HashedHuffman * hashed_clen_huffman =
-                    (HashedHuffman *)working_memory_at;
-                working_memory_at += sizeof(HashedHuffman);
-                working_memory_remaining -= sizeof(HashedHuffman);
-                huffman_to_hashmap(
-                    /* huffman_input: */
-                        codelengths_huffman,
-                    /* huffman_input_size: */
-                        NUM_UNIQUE_CODELENGTHS,
-                    /* recipient: */
-                        hashed_clen_huffman);
                 
-                if (hashed_clen_huffman == NULL) {
-                    *out_good = 0;
-                    return;
+                status = INFLATE_STREAM_FINISHED;
+                goto suspend;
+            }
+            default: {
+                #ifndef INFLATE_IGNORE_ASSERTS
+                assert(stream->mode == STREAM_MODE_ERROR);
+                #endif
+                goto fail;
+            }
+        }
+    }
+    
+    fail:
+    stream->mode = STREAM_MODE_ERROR;
+    status = INFLATE_STREAM_ERROR;
+    
+    suspend:
+    if (input_consumed != NULL) {
+        *input_consumed = (uint64_t)(stream->next_in - input);
+    }
+    if (output_written != NULL) {
+        *output_written = (uint64_t)(output_at - output);
+    }
+    stream->next_in = NULL;
+    stream->in_end = NULL;
+    
+    return status;
+}
+
+void inflate_stream_finish(
+    InflateStream * stream,
+    uint32_t * out_good)
+{
+    if (stream == NULL) {
+        *out_good = 0;
+        return;
+    }
+    
+    *out_good = stream->mode == STREAM_MODE_DONE;
+    
+    #ifndef INFLATE_SILENCE
+    if (!*out_good) {
+        printf(
+            "inflate_stream_finish() - the stream ended before its final "
+            "block\n");
+    }
+    #endif
+    
+    stream->context->free_func(stream);
+}
+
+void inflate_to_sink(
+    InflateContext * context,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    uint32_t (* sink_funcptr)(
+        void * sink_data,
+        uint8_t const * bytes,
+        const uint64_t bytes_size),
+    void * sink_data,
+    uint64_t * final_output_size,
+    uint32_t * out_good)
+{
+    *out_good = 0;
+    *final_output_size = 0;
+    
+    InflateStream * stream = inflate_stream_begin(context);
+    if (stream == NULL) {
+        #ifndef INFLATE_SILENCE
+        printf("inflate_to_sink() ERROR: failed to allocate a stream\n");
+        #endif
+        return;
+    }
+    
+    /*
+    The stream's own window is our output buffer. We always hand it the part
+    of the window from the current position up to the end, which is exactly
+    where it would have copied our output to anyway, and flush that part to
+    the sink before it wraps around and gets overwritten.
+    */
+    uint64_t input_used = 0;
+    uint32_t status = INFLATE_STREAM_NEEDS_OUTPUT;
+    while (
+        status == INFLATE_STREAM_NEEDS_OUTPUT ||
+        status == INFLATE_STREAM_NEEDS_INPUT)
+    {
+        uint32_t window_at =
+            (uint32_t)(stream->total_out & INFLATE_WINDOW_MASK);
+        
+        uint64_t input_consumed = 0;
+        uint64_t output_written = 0;
+        status = inflate_stream_feed(
+            /* stream: */
+                stream,
+            /* input: */
+                compressed_input + input_used,
+            /* input_size: */
+                compressed_input_size - input_used,
+            /* input_consumed: */
+                &input_consumed,
+            /* output: */
+                stream->window + window_at,
+            /* output_size: */
+                INFLATE_WINDOW_SIZE - window_at,
+            /* output_written: */
+                &output_written);
+        input_used += input_consumed;
+        
+        if (output_written > 0) {
+            *final_output_size += output_written;
+            if (
+                !sink_funcptr(
+                    sink_data,
+                    stream->window + window_at,
+                    output_written))
+            {
+                #ifndef INFLATE_SILENCE
+                printf("inflate_to_sink() - the sink asked us to stop\n");
+                #endif
+                break;
+            }
+        }
+        
+        if (
+            status == INFLATE_STREAM_NEEDS_INPUT &&
+            input_used >= compressed_input_size)
+        {
+            #ifndef INFLATE_SILENCE
+            printf(
+                "inflate_to_sink() ERROR: ran out of input before the end of "
+                "the final block\n");
+            #endif
+            break;
+        }
+    }
+    
+    inflate_stream_finish(stream, out_good);
+}
+
+void inflate_partial(
+    InflateContext * context,
+    uint8_t * recipient,
+    const uint64_t output_limit,
+    uint64_t * final_recipient_size,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    uint64_t * input_consumed,
+    uint32_t * reached_final_block,
+    uint32_t * out_good)
+{
+    *out_good = 0;
+    *final_recipient_size = 0;
+    *input_consumed = 0;
+    *reached_final_block = 0;
+    
+    InflateStream * stream = inflate_stream_begin(context);
+    if (stream == NULL) {
+        #ifndef INFLATE_SILENCE
+        printf("inflate_partial() ERROR: failed to allocate a stream\n");
+        #endif
+        return;
+    }
+    
+    /*
+    The stream already stops when its output is full, in the middle of a
+    match or a stored block if it has to, and tells us how much input it
+    read to get there. So we give it all of our input, and recipient as the
+    output.
+    */
+    uint64_t output_written = 0;
+    uint32_t status = inflate_stream_feed(
+        /* stream: */
+            stream,
+        /* input: */
+            compressed_input,
+        /* input_size: */
+            compressed_input_size,
+        /* input_consumed: */
+            input_consumed,
+        /* output: */
+            recipient,
+        /* output_size: */
+            output_limit,
+        /* output_written: */
+            &output_written);
+    *final_recipient_size = output_written;
+    
+    /*
+    If the output is full right before the end of the stream, we'd like to
+    know that there's nothing more to come. The stream won't decode anything
+    without room for at least 1 byte, so we give it 1 more byte. If it finishes
+    without writing it, we're done. If it does write it, we just ignore it and
+    the input it took to get it.
+    */
+    if (status == INFLATE_STREAM_NEEDS_OUTPUT) {
+        uint8_t extra_byte = 0;
+        uint64_t extra_consumed = 0;
+        uint64_t extra_written = 0;
+        uint32_t extra_status = inflate_stream_feed(
+            /* stream: */
+                stream,
+            /* input: */
+                compressed_input + *input_consumed,
+            /* input_size: */
+                compressed_input_size - *input_consumed,
+            /* input_consumed: */
+                &extra_consumed,
+            /* output: */
+                &extra_byte,
+            /* output_size: */
+                1,
+            /* output_written: */
+                &extra_written);
+        if (
+            extra_status == INFLATE_STREAM_FINISHED &&
+            extra_written == 0)
+        {
+            *input_consumed += extra_consumed;
+            status = INFLATE_STREAM_FINISHED;
+        }
+    }
+    
+    if (status == INFLATE_STREAM_FINISHED) {
+        *reached_final_block = 1;
+        *out_good = 1;
+    } else if (status == INFLATE_STREAM_NEEDS_OUTPUT) {
+        // we decoded exactly output_limit bytes, and there's more to come
+        *out_good = 1;
+    } else {
+        #ifndef INFLATE_SILENCE
+        printf(
+            "inflate_partial() ERROR: the data is invalid or ended after %llu "
+            "bytes of output\n",
+            *final_recipient_size);
+        #endif
+    }
+    
+    // not inflate_stream_finish(), stopping early isn't an error here
+    context->free_func(stream);
+}
+
+/*
+Speculative decoding, for inflate_parallel.c
+
+When we start decoding in the middle of a stream, we don't know the 32KiB of
+output that came before, but matches can still refer to it. So instead of
+bytes we write 16-bit symbols: a byte value, or INFLATE_PLACEHOLDER + i for
+'byte i of the window before we started', which can be filled in later once
+the previous part of the stream is decoded.
+*/
+
+/*
+Point a DataStream at any bit of our input
+*/
+static void data_stream_seek(
+    DataStream * data_stream,
+    uint8_t const * input,
+    const uint64_t input_size,
+    const uint64_t bit)
+{
+    data_stream->data = (uint8_t *)input + (bit >> 3);
+    data_stream->data_end = (uint8_t *)input + input_size;
+    data_stream->bit_buffer = 0;
+    data_stream->bits_left = 0;
+    data_stream->overrun_bytes = 0;
+    
+    if (bit & 7) {
+        consume_bits(data_stream, bit & 7);
+    }
+}
+
+/*
+How many bits of input we've consumed
+*/
+static uint64_t data_stream_tell(
+    DataStream * data_stream,
+    uint8_t const * input)
+{
+    return
+        ((uint64_t)(data_stream->data - input) +
+            data_stream->overrun_bytes) * 8 -
+        data_stream->bits_left;
+}
+
+uint64_t inflate_find_block(
+    InflateContext * context,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    const uint64_t from_bit,
+    const uint64_t until_bit,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size)
+{
+    for (uint64_t bit = from_bit; bit < until_bit; bit++) {
+        // we need at least the 17 bits of a dynamic header, or the 35 of a
+        // stored header after the 3 bits of BFINAL and BTYPE
+        uint64_t byte_i = bit >> 3;
+        if (byte_i + 8 > compressed_input_size) {
+            break;
+        }
+        uint64_t upcoming =
+            load_u64_little_endian(compressed_input + byte_i) >> (bit & 7);
+        
+        uint32_t BTYPE = (upcoming >> 1) & 3;
+        if (BTYPE == 2) {
+            // HLIT and HDIST can't be more than 29 (286 and 30 codes)
+            if (((upcoming >> 3) & 31) > 29 || ((upcoming >> 8) & 31) > 29) {
+                continue;
+            }
+            
+            DataStream data_stream;
+            data_stream_seek(
+                /* data_stream: */ &data_stream,
+                /* input: */ compressed_input,
+                /* input_size: */ compressed_input_size,
+                /* bit: */ bit + 3);
+            
+            HuffmanTable * litlen_table = NULL;
+            HuffmanTable * dist_table = NULL;
+            if (
+                read_dynamic_tables(
+                    /* context: */ context,
+                    /* data_stream: */ &data_stream,
+                    /* temp_working_memory: */ temp_working_memory,
+                    /* temp_working_memory_size: */ temp_working_memory_size,
+                    /* strict: */ 1,
+                    /* litlen_table: */ &litlen_table,
+                    /* dist_table: */ &dist_table))
+            {
+                return bit;
+            }
+        } else if (BTYPE == 0) {
+            /*
+            The header is followed by padding up to the next byte, then LEN
+            and NLEN = ~LEN. Encoders pad with zeroes, so we insist on that.
+            */
+            uint64_t len_byte = (bit + 3 + 7) >> 3;
+            uint32_t padding_bits = (uint32_t)((len_byte << 3) - (bit + 3));
+            if (
+                ((upcoming >> 3) & ((1u << padding_bits) - 1)) != 0 ||
+                len_byte + 4 > compressed_input_size)
+            {
+                continue;
+            }
+            
+            uint32_t LEN =
+                compressed_input[len_byte] |
+                ((uint32_t)compressed_input[len_byte + 1] << 8);
+            uint32_t NLEN =
+                compressed_input[len_byte + 2] |
+                ((uint32_t)compressed_input[len_byte + 3] << 8);
+            if (
+                LEN == (~NLEN & 0xffff) &&
+                len_byte + 4 + LEN <= compressed_input_size)
+            {
+                return bit;
+            }
+        }
+        
+        /*
+        We skip fixed blocks (BTYPE 1), their header is just 3 bits so
+        almost every position would look like one. A real stream that uses
+        them still decodes fine, the block before will just decode through
+        them.
+        */
+    }
+    
+    return until_bit;
+}
+
+/*
+Make sure there's room for at least needed symbols
+*/
+static uint32_t grow_symbols(
+    InflateContext * context,
+    uint16_t ** symbols,
+    uint64_t * symbols_capacity,
+    const uint64_t symbols_size,
+    const uint64_t needed)
+{
+    if (*symbols_capacity >= needed) {
+        return 1;
+    }
+    
+    uint64_t new_capacity = *symbols_capacity * 2;
+    if (new_capacity < needed) {
+        new_capacity = needed;
+    }
+    
+    uint16_t * new_symbols = (uint16_t *)context->malloc_func(
+        sizeof(uint16_t) * new_capacity);
+    if (new_symbols == NULL) {
+        return 0;
+    }
+    
+    if (*symbols != NULL) {
+        context->memcpy_func(
+            new_symbols,
+            *symbols,
+            sizeof(uint16_t) * symbols_size);
+        context->free_func(*symbols);
+    }
+    
+    *symbols = new_symbols;
+    *symbols_capacity = new_capacity;
+    
+    return 1;
+}
+
+void inflate_speculative(
+    InflateContext * context,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    const uint64_t start_bit,
+    const uint64_t stop_bit,
+    const uint32_t history_size,
+    uint16_t ** symbols,
+    uint64_t * symbols_size,
+    uint64_t * end_bit,
+    uint32_t * reached_final_block,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    uint32_t * out_good)
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(history_size <= INFLATE_WINDOW_SIZE);
+    #endif
+    
+    *out_good = 0;
+    *symbols = NULL;
+    *symbols_size = 0;
+    *end_bit = start_bit;
+    *reached_final_block = 0;
+    
+    // most data compresses somewhere around 3:1, we'll grow if needed
+    uint64_t symbols_capacity = 0;
+    uint64_t expected_bits =
+        stop_bit > start_bit && stop_bit < compressed_input_size * 8 ?
+            stop_bit - start_bit :
+            compressed_input_size * 8 - start_bit;
+    if (
+        !grow_symbols(
+            /* context: */ context,
+            /* symbols: */ symbols,
+            /* symbols_capacity: */ &symbols_capacity,
+            /* symbols_size: */ 0,
+            /* needed: */ (expected_bits / 8) * 4 + 65536))
+    {
+        return;
+    }
+    
+    uint16_t * output = *symbols;
+    uint64_t output_size = 0;
+    
+    DataStream data_stream;
+    data_stream_seek(
+        /* data_stream: */ &data_stream,
+        /* input: */ compressed_input,
+        /* input_size: */ compressed_input_size,
+        /* bit: */ start_bit);
+    
+    while (1) {
+        refill_bits(&data_stream);
+        uint32_t BFINAL = consume_bits(&data_stream, 1);
+        uint32_t BTYPE = consume_bits(&data_stream, 2);
+        
+        HuffmanTable * litlen_table = NULL;
+        HuffmanTable * dist_table = NULL;
+        
+        if (BTYPE == 0) {
+            if (!align_to_byte(&data_stream)) {
+                break;
+            }
+            uint8_t const * at = data_stream.data;
+            if (at + 4 > data_stream.data_end) {
+                break;
+            }
+            uint32_t LEN = at[0] | ((uint32_t)at[1] << 8);
+            uint32_t NLEN = at[2] | ((uint32_t)at[3] << 8);
+            at += 4;
+            if (LEN != (~NLEN & 0xffff) || at + LEN > data_stream.data_end) {
+                break;
+            }
+            
+            if (
+                !grow_symbols(
+                    /* context: */ context,
+                    /* symbols: */ symbols,
+                    /* symbols_capacity: */ &symbols_capacity,
+                    /* symbols_size: */ output_size,
+                    /* needed: */ output_size + LEN))
+            {
+                break;
+            }
+            output = *symbols;
+            
+            for (uint32_t i = 0; i < LEN; i++) {
+                output[output_size++] = at[i];
+            }
+            data_stream.data = (uint8_t *)at + LEN;
+        } else if (BTYPE == 1) {
+            litlen_table = &context->fixed_litlen_table;
+            dist_table = &context->fixed_dist_table;
+        } else if (BTYPE == 2) {
+            if (
+                !read_dynamic_tables(
+                    /* context: */ context,
+                    /* data_stream: */ &data_stream,
+                    /* temp_working_memory: */ temp_working_memory,
+                    /* temp_working_memory_size: */ temp_working_memory_size,
+                    /* strict: */ 1,
+                    /* litlen_table: */ &litlen_table,
+                    /* dist_table: */ &dist_table))
+            {
+                break;
+            }
+        } else {
+            break;
+        }
+        
+        uint32_t block_good = 1;
+        while (litlen_table != NULL) {
+            if (
+                !grow_symbols(
+                    /* context: */ context,
+                    /* symbols: */ symbols,
+                    /* symbols_capacity: */ &symbols_capacity,
+                    /* symbols_size: */ output_size,
+                    /* needed: */ output_size + INFLATE_MAX_MATCH_LENGTH))
+            {
+                block_good = 0;
+                break;
+            }
+            output = *symbols;
+            
+            refill_bits(&data_stream);
+            if (read_past_end(&data_stream)) {
+                block_good = 0;
+                break;
+            }
+            
+            HuffmanTableEntry litlen = huffman_table_decode(
+                /* table: */ litlen_table,
+                /* datastream: */ &data_stream);
+            
+            if (litlen.kind == HUFFMAN_ENTRY_LITERAL) {
+                output[output_size++] = litlen.value;
+            } else if (litlen.kind == HUFFMAN_ENTRY_LENGTH) {
+                uint32_t length = decode_extra_bits(litlen, &data_stream);
+                HuffmanTableEntry dist = huffman_table_decode(
+                    /* table: */ dist_table,
+                    /* datastream: */ &data_stream);
+                if (dist.kind != HUFFMAN_ENTRY_DISTANCE) {
+                    block_good = 0;
+                    break;
                 }
-                
-                #ifndef INFLATE_IGNORE_ASSERTS
-                for (
-                    int i = 0;
-                    i < NUM_UNIQUE_CODELENGTHS;
-                    i++)
-                {
-                    if (codelengths_huffman[i].used == 1) {
-                        assert(
-                          codelengths_huffman[i].key >= 0);
-                        assert(
-                          codelengths_huffman[i].value >= 0);
-                        assert(
-                          codelengths_huffman[i].value < 19);
-                    }
+                uint32_t distance = decode_extra_bits(dist, &data_stream);
+                if (distance > output_size + history_size) {
+                    block_good = 0;
+                    break;
                 }
-                #endif
                 
                 /*
-                Now we have an unpacked table with code
-                lengths from 0 to 18. Each code length
-                implies a different action, see below.
-                
-                We need to use this 'code length' table
-                to create 2 new tables of codes before we
-                can finally fully unpack:
-                - HLIT + 257 code lengths for the
-                  literal/length alphabet, encoded using
-                  the code length Huffman code
-                - HDIST + 1 code lengths for the distance
-                  alphabet, encoded using the code length
-                  Huffman code
+                Anything before our own output is the unknown window, which
+                ends right where we started
                 */
-                uint32_t len_i = 0;
-                uint32_t two_dicts_size = HLIT + HDIST;
-                
-                if (working_memory_remaining < sizeof(uint32_t) *
-                    two_dicts_size)
-                {
-                    #ifndef INFLATE_SILENCE
-                    printf(
-                        "ERROR - inflate() ran out of working memory, need %lu "
-                        "for literal length distance table, but only have %llu "
-                        "left.\n",
-                        sizeof(uint32_t) * two_dicts_size,
-                        working_memory_remaining); 
-                    #endif
-                    *out_good = 0;
-                    return;
-                }
-                align_memory(&working_memory_at, &working_memory_remaining);
-                uint32_t * litlendist_table = (uint32_t *)working_memory_at;
-                working_memory_at += sizeof(uint32_t) * two_dicts_size;
-                working_memory_remaining -= sizeof(uint32_t) * two_dicts_size;
-                
-                while (len_i < two_dicts_size) {
-                    uint32_t clen_good = 0;
-                    uint32_t encoded_len =
-                        hashed_huffman_decode(
-                            /* dict: */
-                                hashed_clen_huffman,
-                            /* raw data: */
-                                &data_stream,
-                            /* good: */
-                                &clen_good);
-                    
-                    if (!clen_good) {
-                        #ifndef INFLATE_SILENCE
-                        printf(
-                            "inflate() failed, bad huffman decode\n");
-                        #endif
-                        *out_good = 0;
-                        return;
-                    }
-                    
-                    if (encoded_len <= 15) {
-                        litlendist_table[len_i] = encoded_len;
-                        len_i++;
-                    } else if (encoded_len == 16) {
-                        /*
-                        16: Copy previous code length 3-6 times.
-                            2 extra bits for repeat length
-                            (0 = 3, ... , 3 = 6)
-                        */
-                        uint32_t extra_bits_repeat = consume_bits(
-                            /* from: */ &data_stream,
-                            /* size: */ 2);
-                        uint32_t repeats = extra_bits_repeat + 3;
-                        
-                        #ifndef INFLATE_IGNORE_ASSERTS
-                        assert(repeats >= 3);
-                        assert(repeats <= 6);
-                        assert(len_i > 0);
-                        #endif
-                        
-                        for (
-                            uint32_t i = 0;
-                            i < repeats;
-                            i++)
-                        {
-                            memcpy_func(
-                                /* dest: */
-                                    (void *)(litlendist_table + len_i + i),
-                                /* src: */
-                                    (void *)(litlendist_table + len_i - 1),
-                                /* size_bytes: */
-                                    4);
-                        }
-                        len_i += repeats;
-                        
-                    } else if (encoded_len == 17) {
-                        /*
-                        17: Repeat a code length of 0 for 3 - 10
-                            times.
-                            3 extra bits for length
-                        */
-                        uint32_t extra_bits_repeat = consume_bits(
-                            /* from: */ &data_stream,
-                            /* size: */ 3);
-                        uint32_t repeats = extra_bits_repeat + 3;
-                       
-                        #ifndef INFLATE_IGNORE_ASSERTS 
-                        assert(repeats >= 3);
-                        assert(repeats < 11);
-                        #endif
-                        
-                        memset_func(litlendist_table + len_i, 0, 4 * repeats);
-                        len_i += repeats;
-                        
-                    } else if (encoded_len == 18) {
-                        /*
-                        18: Repeat a code length of 0 for
-                            11 - 138 times
-                            7 extra bits for length
-                        */
-                        uint32_t extra_bits_repeat =
-                            consume_bits(
-                                /* from: */ &data_stream,
-                                /* size: */ 7);
-                        uint32_t repeats =
-                            extra_bits_repeat + 11;
-                        
-                        #ifndef INFLATE_IGNORE_ASSERTS
-                        assert(repeats >= 11);
-                        assert(repeats < 139);
-                        #endif
-                        
-                        memset_func(litlendist_table + len_i, 0, 4 * repeats);
-                        len_i += repeats;
+                for (uint32_t i = 0; i < length; i++) {
+                    if (distance <= output_size) {
+                        output[output_size] = output[output_size - distance];
                     } else {
-                        #ifndef INFLATE_SILENCE
-                        printf(
-                            "ERROR : encoded_len %u\n",
-                            encoded_len);
-                        #endif
-                        #ifndef INFLATE_IGNORE_ASSERTS
-                        assert(0);
-                        #endif
-                    }
-                }
-                
-                #ifndef INFLATE_SILENCE
-                printf("\t\t\tfinished reading two dicts\n");
-                #endif
-                
-                #ifndef INFLATE_IGNORE_ASSERTS
-                assert(len_i == two_dicts_size);
-                #endif
-                
-                if (working_memory_remaining < sizeof(HuffmanEntry) * HLIT)
-                {
-                    #ifndef INFLATE_SILENCE
-                    printf("inflate() failing - ran out of working memory\n");
-                    #endif
-                    *out_good = 0;
-                    return;
-                }
-                uint32_t litlen_good = 0;
-                align_memory(&working_memory_at, &working_memory_remaining);
-                literal_length_huffman = (HuffmanEntry *)working_memory_at;
-                working_memory_at += sizeof(HuffmanEntry) * HLIT;
-                working_memory_remaining -= sizeof(HuffmanEntry) * HLIT;
-                unpack_huffman(
-                    /* array:     : */
-                        litlendist_table,
-                    /* array_size : */
-                        HLIT,
-                    /* recipient: */
-                        literal_length_huffman,
-                    /* good       : */
-                        &litlen_good);
-                if (!litlen_good) {
-                    #ifndef INFLATE_SILENCE
-                    printf("INFLATE failed, bad huffman unpack\n");
-                    #endif
-                    *out_good = 0;
-                    return;
-                }
-                
-                if (working_memory_remaining < sizeof(HashedHuffman))
-                {
-                    #ifndef INFLATE_SILENCE
-                    printf("inflate() failing - ran out of working memory\n");
-                    #endif
-                    *out_good = 0;
-                    return;
-                }
-                align_memory(&working_memory_at, &working_memory_remaining);
-                hashed_litlen_huffman = (HashedHuffman *)working_memory_at;
-                working_memory_at += sizeof(HashedHuffman);
-                working_memory_remaining -= sizeof(HashedHuffman); 
-                huffman_to_hashmap(
-                    /* huffman_input: */
-                        literal_length_huffman,
-                    /* huffman_input_size: */
-                        HLIT,
-                    /* recipient: */
-                        hashed_litlen_huffman);
-                if (hashed_litlen_huffman == NULL) {
-                    *out_good = 0;
-                    return;
-                }
-                
-                #ifndef INFLATE_SILENCE 
-                printf(
-                    "\t\t\tunpacked lit/len dict\n");
-                #endif
-                
-                #ifndef INFLATE_IGNORE_ASSERTS
-                for (uint32_t i = 0; i < HLIT; i++) {
-                    if (literal_length_huffman[i].used == 1) {
-                        
-                        assert(
-                            literal_length_huffman[i].value
-                                == i);
-                        assert(
-                            literal_length_huffman[i].key
-                                < 99999);
+                        output[output_size] = (uint16_t)(
+                            INFLATE_PLACEHOLDER + INFLATE_WINDOW_SIZE -
+                                (distance - output_size));
                     }
+                    output_size++;
                 }
-                #endif
-                
-                uint32_t dist_good = 0;
-                if (working_memory_remaining < sizeof(HashedHuffman)) {
-                    #ifndef INFLATE_SILENCE
-                    printf("inflate() failing - ran out of working memory\n");
-                    #endif
-                    *out_good = 0;
-                    return;
-                }
-                align_memory(&working_memory_at, &working_memory_remaining);
-                distance_huffman = (HuffmanEntry *)working_memory_at;
-                working_memory_at += sizeof(HashedHuffman);
-                working_memory_remaining -= sizeof(HashedHuffman);
-                unpack_huffman(
-                    /* array:     : */
-                        litlendist_table + HLIT,
-                    /* array_size : */
-                        HDIST,
-                    /* recipient: */
-                        distance_huffman,
-                    /* good       : */
-                        &dist_good);
-                if (!dist_good) {
-                    #ifndef INFLATE_SILENCE
-                    printf("INFLATE failed, bad huffman unpack\n");
-                    #endif
-                    *out_good = 0;
-                    return;
-                }
-                
-                if (working_memory_remaining < sizeof(HashedHuffman)) {
-                    #ifndef INFLATE_SILENCE
-                    printf("inflate() failing - ran out of working memory\n");
-                    #endif
-                    *out_good = 0;
-                    return;
-                }
-                align_memory(&working_memory_at, &working_memory_remaining);
-                hashed_dist_huffman = (HashedHuffman *)working_memory_at;
-                working_memory_at += sizeof(HashedHuffman);
-                working_memory_remaining -= sizeof(HashedHuffman);
-                huffman_to_hashmap(
-                    /* huffman_input: */
-                        distance_huffman,
-                    /* huffman_input_size: */
-                        HDIST,
-                    /* recipient: */
-                        hashed_dist_huffman);
-                if (hashed_dist_huffman == NULL) {
-                    *out_good = 0;
-                    return;
+            } else if (litlen.kind == HUFFMAN_ENTRY_END_OF_BLOCK) {
+                break;
+            } else {
+                block_good = 0;
+                break;
+            }
+        }
+        
+        if (!block_good || read_past_end(&data_stream)) {
+            break;
+        }
+        
+        *end_bit = data_stream_tell(&data_stream, compressed_input);
+        *symbols_size = output_size;
+        
+        if (BFINAL) {
+            *reached_final_block = 1;
+            *out_good = 1;
+            break;
+        }
+        if (*end_bit >= stop_bit) {
+            *out_good = 1;
+            break;
+        }
+    }
+    
+    if (!*out_good) {
+        context->free_func(*symbols);
+        *symbols = NULL;
+        *symbols_size = 0;
+    }
+}
+
+void inflate_measure(
+    InflateContext * context,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    uint64_t * decompressed_size,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    uint32_t * out_good)
+{
+    *out_good = 0;
+    *decompressed_size = 0;
+    
+    /*
+    This is inflate() without a recipient. We decode every symbol (we have to,
+    to know where the next one starts), but we only add up how many bytes
+    they would have written. A match only needs its length, and the check
+    that its distance doesn't reach back before the start of the output.
+    */
+    uint64_t output_size = 0;
+    
+    DataStream data_stream;
+    data_stream_seek(
+        /* data_stream: */ &data_stream,
+        /* input: */ compressed_input,
+        /* input_size: */ compressed_input_size,
+        /* bit: */ 0);
+    
+    uint32_t BFINAL = 0;
+    while (!BFINAL) {
+        refill_bits(&data_stream);
+        BFINAL = consume_bits(&data_stream, 1);
+        uint32_t BTYPE = consume_bits(&data_stream, 2);
+        
+        HuffmanTable * litlen_table = NULL;
+        HuffmanTable * dist_table = NULL;
+        
+        if (BTYPE == 0) {
+            if (!align_to_byte(&data_stream)) {
+                break;
+            }
+            uint8_t const * at = data_stream.data;
+            if (at + 4 > data_stream.data_end) {
+                break;
+            }
+            uint32_t LEN = at[0] | ((uint32_t)at[1] << 8);
+            uint32_t NLEN = at[2] | ((uint32_t)at[3] << 8);
+            at += 4;
+            if (LEN != (~NLEN & 0xffff) || at + LEN > data_stream.data_end) {
+                break;
+            }
+            
+            // we don't even have to look at the bytes
+            output_size += LEN;
+            data_stream.data = (uint8_t *)at + LEN;
+        } else if (BTYPE == 1) {
+            litlen_table = &context->fixed_litlen_table;
+            dist_table = &context->fixed_dist_table;
+        } else if (BTYPE == 2) {
+            if (
+                !read_dynamic_tables(
+                    /* context: */ context,
+                    /* data_stream: */ &data_stream,
+                    /* temp_working_memory: */ temp_working_memory,
+                    /* temp_working_memory_size: */ temp_working_memory_size,
+                    /* strict: */ 0,
+                    /* litlen_table: */ &litlen_table,
+                    /* dist_table: */ &dist_table))
+            {
+                break;
+            }
+            pack_literals(litlen_table);
+        } else {
+            break;
+        }
+        
+        uint32_t block_good = 1;
+        while (litlen_table != NULL) {
+            refill_bits(&data_stream);
+            if (read_past_end(&data_stream)) {
+                block_good = 0;
+                break;
+            }
+            
+            // up to 3 literals in 1 lookup, see pack_literals()
+            uint32_t packed = litlen_table->packed_literals[
+                mask_rightmost_bits(
+                    (uint32_t)data_stream.bit_buffer,
+                    litlen_table->root_bits)];
+            if (packed >= (1u << HUFFMAN_PACKED_COUNT_SHIFT)) {
+                output_size += packed >> HUFFMAN_PACKED_COUNT_SHIFT;
+                discard_bits(
+                    /* from: */
+                        &data_stream,
+                    /* amount: */
+                        (packed >> HUFFMAN_PACKED_LENGTH_SHIFT) & 15);
+                continue;
+            }
+            
+            HuffmanTableEntry litlen = huffman_table_decode(
+                /* table: */ litlen_table,
+                /* datastream: */ &data_stream);
+            
+            if (litlen.kind == HUFFMAN_ENTRY_LITERAL) {
+                output_size++;
+            } else if (litlen.kind == HUFFMAN_ENTRY_LENGTH) {
+                uint32_t length = decode_extra_bits(litlen, &data_stream);
+                HuffmanTableEntry dist = huffman_table_decode(
+                    /* table: */ dist_table,
+                    /* datastream: */ &data_stream);
+                if (dist.kind != HUFFMAN_ENTRY_DISTANCE) {
+                    block_good = 0;
+                    break;
                 }
-                
-                #ifndef INFLATE_SILENCE
-                printf("\t\t\tunpacked distance dictionary\n");
-                #endif
-                
-                #ifndef INFLATE_IGNORE_ASSERTS
-                for (uint32_t i = 0; i < HDIST; i++) {
-                    if (distance_huffman[i].used == 1) {
-                        assert(distance_huffman[i].value == i);
-                        assert(distance_huffman[i].key < 99999);
-                    }
+                uint32_t distance = decode_extra_bits(dist, &data_stream);
+                if (distance > output_size) {
+                    block_good = 0;
+                    break;
                 }
-                #endif
+                output_size += length;
+            } else if (litlen.kind == HUFFMAN_ENTRY_END_OF_BLOCK) {
+                break;
+            } else {
+                block_good = 0;
+                break;
+            }
+        }
+        
+        if (!block_good || read_past_end(&data_stream)) {
+            break;
+        }
+        
+        if (BFINAL) {
+            *decompressed_size = output_size;
+            *out_good = 1;
+        }
+    }
+    
+    #ifndef INFLATE_SILENCE
+    if (!*out_good) {
+        printf(
+            "inflate_measure() ERROR: the data is invalid or truncated after "
+            "%llu bytes of output\n",
+            output_size);
+    }
+    #endif
+}
+
+/*
+Random access, see InflateIndex in inflate.h
+
+An access point is everything a stream needs to resume at the start of a
+block: where that block starts in the input (in bits, blocks don't start on
+byte boundaries), how much output came before it, and the last 32KiB of that
+output for matches to refer back to.
+*/
+typedef struct InflateAccessPoint {
+    uint64_t input_bit;
+    uint64_t output_offset;
+    uint32_t window_size;
+    uint8_t window[INFLATE_WINDOW_SIZE];
+} InflateAccessPoint;
+
+struct InflateIndex {
+    void * (* malloc_func)(uint64_t size);
+    void (* free_func)(void * to_free);
+    
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint64_t span;
+    
+    InflateAccessPoint * points;
+    uint64_t points_size;
+    uint64_t points_capacity;
+};
+
+/*
+"INFLIDX" and a version byte, then 4 little endian uint64's:
+compressed_size, uncompressed_size, span and points_size. Then for each
+point 2 uint64's (input_bit, output_offset), a uint32 window_size and the
+window itself.
+*/
+#define INFLATE_INDEX_MAGIC "INFLIDX\1"
+#define INFLATE_INDEX_MAGIC_SIZE 8
+#define INFLATE_INDEX_HEADER_SIZE (INFLATE_INDEX_MAGIC_SIZE + 4 * 8)
+#define INFLATE_INDEX_POINT_HEADER_SIZE (2 * 8 + 4)
+
+static InflateIndex * index_create(
+    InflateContext * context)
+{
+    InflateIndex * index = (InflateIndex *)context->malloc_func(
+        sizeof(InflateIndex));
+    if (index == NULL) {
+        return NULL;
+    }
+    
+    index->malloc_func = context->malloc_func;
+    index->free_func = context->free_func;
+    index->compressed_size = 0;
+    index->uncompressed_size = 0;
+    index->span = 0;
+    index->points = NULL;
+    index->points_size = 0;
+    index->points_capacity = 0;
+    
+    return index;
+}
+
+/*
+returns the new point (with only its window_size set), or NULL if malloc
+failed
+*/
+static InflateAccessPoint * index_add_point(
+    InflateContext * context,
+    InflateIndex * index,
+    const uint64_t input_bit,
+    const uint64_t output_offset)
+{
+    if (index->points_size >= index->points_capacity) {
+        uint64_t new_capacity =
+            index->points_capacity < 8 ? 8 : index->points_capacity * 2;
+        InflateAccessPoint * new_points =
+            (InflateAccessPoint *)context->malloc_func(
+                sizeof(InflateAccessPoint) * new_capacity);
+        if (new_points == NULL) {
+            return NULL;
+        }
+        
+        if (index->points != NULL) {
+            context->memcpy_func(
+                new_points,
+                index->points,
+                sizeof(InflateAccessPoint) * index->points_size);
+            context->free_func(index->points);
+        }
+        
+        index->points = new_points;
+        index->points_capacity = new_capacity;
+    }
+    
+    InflateAccessPoint * point = index->points + index->points_size;
+    index->points_size++;
+    
+    point->input_bit = input_bit;
+    point->output_offset = output_offset;
+    point->window_size = output_offset < INFLATE_WINDOW_SIZE ?
+        (uint32_t)output_offset :
+        INFLATE_WINDOW_SIZE;
+    
+    return point;
+}
+
+void inflate_index_free(
+    InflateIndex * index)
+{
+    if (index == NULL) {
+        return;
+    }
+    
+    if (index->points != NULL) {
+        index->free_func(index->points);
+    }
+    index->free_func(index);
+}
+
+InflateIndex * inflate_index_build(
+    InflateContext * context,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    const uint64_t span,
+    uint32_t * out_good)
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(context != NULL);
+    assert(compressed_input != NULL || compressed_input_size == 0);
+    #endif
+    
+    *out_good = 0;
+    
+    InflateIndex * index = index_create(context);
+    InflateStream * stream = inflate_stream_begin(context);
+    if (index == NULL || stream == NULL) {
+        #ifndef INFLATE_SILENCE
+        printf("inflate_index_build() ERROR: malloc failed\n");
+        #endif
+        inflate_index_free(index);
+        if (stream != NULL) {
+            context->free_func(stream);
+        }
+        return NULL;
+    }
+    
+    index->compressed_size = compressed_input_size;
+    index->span = span;
+    stream->pause_at_blocks = 1;
+    
+    /*
+    Like inflate_to_sink(), we decode straight into the stream's window. We
+    don't need the output here, only the window at each access point.
+    */
+    uint64_t input_used = 0;
+    uint32_t status = INFLATE_STREAM_NEEDS_OUTPUT;
+    while (
+        status == INFLATE_STREAM_NEEDS_OUTPUT ||
+        status == INFLATE_STREAM_NEEDS_INPUT ||
+        status == STREAM_PAUSED_AT_BLOCK)
+    {
+        uint32_t window_at =
+            (uint32_t)(stream->total_out & INFLATE_WINDOW_MASK);
+        
+        uint64_t input_consumed = 0;
+        uint64_t output_written = 0;
+        status = inflate_stream_feed(
+            /* stream: */
+                stream,
+            /* input: */
+                compressed_input + input_used,
+            /* input_size: */
+                compressed_input_size - input_used,
+            /* input_consumed: */
+                &input_consumed,
+            /* output: */
+                stream->window + window_at,
+            /* output_size: */
+                INFLATE_WINDOW_SIZE - window_at,
+            /* output_written: */
+                &output_written);
+        input_used += input_consumed;
+        
+        if (status == STREAM_PAUSED_AT_BLOCK) {
+            /*
+            The first point is at the very start, after that we wait for at
+            least span bytes of output between points
+            */
+            if (
+                index->points_size > 0 &&
+                stream->total_out -
+                    index->points[index->points_size - 1].output_offset <
+                        span)
+            {
+                continue;
             }
             
-            // the remaining part of the algorithm is mostly the
-            // same whether we're using dynamic huffman tables
-            // or fixed huffman tables - we just use a different
-            // literal-length-dictionary.
-            // The only other difference is in the case of fixed
-            // huffman, when we need a distance value, it's
-            // consumed directly from the stream, whereas for
-            // dynamic huffman  it has to be decoded using the
-            // distance dictionary we prepared
-            if (BTYPE == 2) {
-                #ifndef INFLATE_IGNORE_ASSERTS
-                assert(distance_huffman != NULL);
-                assert(HDIST > 0);
-                assert(HLIT > 0);
-                assert(HLIT < 300);
-                #endif
-            } else if (BTYPE == 1) {
-                #ifndef INFLATE_IGNORE_ASSERTS
-                assert(distance_huffman == NULL);
-                assert(HDIST == 0);
-                assert(HLIT == 288);
+            InflateAccessPoint * point = index_add_point(
+                /* context: */
+                    context,
+                /* index: */
+                    index,
+                /* input_bit: */
+                    input_used * 8 - stream->bits_left,
+                /* output_offset: */
+                    stream->total_out);
+            if (point == NULL) {
+                #ifndef INFLATE_SILENCE
+                printf("inflate_index_build() ERROR: malloc failed\n");
                 #endif
+                break;
             }
             
-            #ifndef INFLATE_IGNORE_ASSERTS
-            assert(hashed_litlen_huffman != NULL);
-            #endif
-            
-            while (1) {
-                // we should normally break from this loop
-                // because we hit the magical value 256,
-                // not because of running out of bytes
-                
-                if ((uint64_t)(data_stream.data - compressed_input)
-                    >= compressed_input_size)
-                {
-                    #ifndef INFLATE_SILENCE
-                    printf(
-                        "\t\tWarning: breaking from DEFLATE preemptively "
-                        "because %li bytes were read - didn't find end of "
-                        "litlen (256)\n",
-                        data_stream.data - compressed_input);
-                    printf(
-                        "\t\tcompressed_input_size was: %llu\n",
-                        compressed_input_size);
-                    #endif
-                    read_more_deflate_blocks = 0;
-                    break;
-                }
-                
-                uint32_t litlen_good = 0; 
-                uint32_t litlenvalue = hashed_huffman_decode(
-                    /* dict: */
-                        hashed_litlen_huffman,
-                    /* raw data: */
-                        &data_stream,
-                    /* good: */
-                        &litlen_good);
-                if (!litlen_good) {
-                    #ifndef INFLATE_SILENCE
-                    printf(
-                        "inflate() failed, bad huffman decode\n");
-                    #endif
-                    *out_good = 0;
-                    return;
-                }
-                
-                if (litlenvalue < 256) {
-                    // literal value, not a length
-                    *recipient_at = (uint8_t)(litlenvalue & 255);
-                    recipient_at++;
-                    *final_recipient_size += 1;
-                    
-                    #ifndef INFLATE_IGNORE_ASSERTS
-                    assert(*final_recipient_size < recipient_size);
-                    assert(
-                        (uint64_t)(recipient_at - recipient)
-                            <= recipient_size);
-                    #endif
-                    
-                } else if (litlenvalue > 256) {
-                    // length, (therefore also need distance)
-                    #ifndef INFLATE_IGNORE_ASSERTS
-                    assert(litlenvalue < 286);
-                    #endif
-                    uint32_t i = litlenvalue - 257;
-                    
-                    #ifndef INFLATE_IGNORE_ASSERTS
-                    assert(length_extra_bits_table[i].value == litlenvalue);
-                    #endif
-                    
-                    uint32_t extra_bits =
-                        length_extra_bits_table[i]
-                            .num_extra_bits;
-                    uint32_t base_length =
-                        length_extra_bits_table[i]
-                            .base_decoded;
-                    uint32_t extra_length =
-                        extra_bits > 0 ?
-                            consume_bits(
-                                /* from: */ &data_stream,
-                                /* size: */ extra_bits)
-                        : 0;
-                    uint32_t total_length =
-                        base_length + extra_length;
-                    
-                    #ifndef INFLATE_IGNORE_ASSERTS
-                    assert(
-                        total_length >= length_extra_bits_table[i]
-                            .base_decoded);
-                    #endif
-                    
-                    uint32_t distvalue;
-                    
-                    if (distance_huffman == NULL) {
-                        distvalue = reverse_bit_order(
-                            consume_bits(
-                                /* from: */ &data_stream,
-                                /* size: */ 5),
-                            5);
-                    } else {
-                        uint32_t hashed_dist_good = 0;
-                        distvalue = hashed_huffman_decode(
-                            /* dict: */
-                                hashed_dist_huffman,
-                            /* raw data: */
-                                &data_stream,
-                            /* good: */
-                                &hashed_dist_good);
-                        if (!hashed_dist_good) {
-                            #ifndef INFLATE_SILENCE
-                            printf(
-                                "inflate() failed, "
-                                "bad hashed dist huffman decode\n");
-                            #endif
-                            *out_good = 0;
-                            return;
-                        }
-                    }
-                    
-                    if (distvalue > 29) {
-                        #ifndef INFLATE_SILENCE
-                        printf("distvalue > 29, failing...\n");
-                        #endif
-                        *out_good = 0;
-                        return;
-                    }
-                    
-                    if (dist_extra_bits_table[distvalue].value != distvalue)
-                    {
-                        #ifndef INFLATE_SILENCE
-                        printf("extra bits table != distvalue, failing...\n");
-                        #endif
-                        *out_good = 0;
-                        return;
-                    }
-                    
-                    uint32_t dist_extra_bits =
-                        dist_extra_bits_table[distvalue]
-                            .num_extra_bits;
-                    uint32_t base_dist =
-                        dist_extra_bits_table[distvalue]
-                            .base_decoded;
-                    
-                    uint32_t dist_extra_bits_decoded =
-                        dist_extra_bits > 0 ?
-                            consume_bits(
-                                /* from: */ &data_stream,
-                                /* size: */ dist_extra_bits)
-                            : 0;
-                    
-                    uint32_t total_dist = base_dist + dist_extra_bits_decoded;
-                    
-                    // go back dist bytes, then copy length bytes
-                    if (recipient_at - total_dist < recipient) {
-                        #ifndef INFLATE_SILENCE
-                        printf(
-                            "ERROR - can't repeat data from %u bytes before, "
-                            "address is out of bounds\n",
-                            total_dist);
-                        #endif
-                        *out_good = 0;
-                        return;
-                    }
-                    
-                    #ifndef INFLATE_IGNORE_ASSERTS
-                    assert(*final_recipient_size <= recipient_size);
-                    assert(
-                        (recipient_at - recipient) <
-                            (uint32_t)recipient_size);
-                    #endif
-                    
-                    if (total_length <= total_dist) {
-                        memcpy_func(
-                            /* dst: */
-                                recipient_at,
-                            /* src: */
-                                recipient_at - total_dist,
-                            /* size_bytes: */
-                                total_length * sizeof(uint32_t));
-                        *final_recipient_size += total_length;
-                        recipient_at += total_length;
-                    } else {
-                        uint8_t * back_dist_bytes = recipient_at - total_dist;
-                        for (uint32_t _ = 0; _ < total_length; _++) {
-                            *recipient_at = *back_dist_bytes;
-                            recipient_at++;
-                            *final_recipient_size += 1;
-                            if (recipient_at >= working_memory_at) {
-                                #ifndef INFLATE_SILENCE
-                                printf(
-                                    "ERROR - recipient overflowing into "
-                                    "working memory!\n");
-                                *out_good = 0;
-                                return;
-                                #endif
-                            }
-                            
-                            #ifndef INFLATE_IGNORE_ASSERTS
-                            assert(*final_recipient_size <= recipient_size);
-                            assert(
-                                (recipient_at - recipient) <
-                                    (uint32_t)recipient_size);
-                            #endif
-                            
-                            back_dist_bytes++;
-                            
-                        }
-                    }
-                } else {
-                    #ifndef INFLATE_IGNORE_ASSERTS
-                    assert(litlenvalue == 256);
-                    #endif
-                    
-                    #ifndef INFLATE_SILENCE
-                    printf("\t\tend of ltln found!\n");
-                    #endif
-                    
-                    break;
-                }
+            // unroll the circular window, oldest byte first
+            for (uint32_t i = 0; i < point->window_size; i++) {
+                point->window[i] = stream->window[
+                    (stream->total_out - point->window_size + i) &
+                        INFLATE_WINDOW_MASK];
             }
-            
-            literal_length_huffman = NULL;
-            distance_huffman = NULL;
+        } else if (
+            status == INFLATE_STREAM_NEEDS_INPUT &&
+            input_used >= compressed_input_size)
+        {
+            #ifndef INFLATE_SILENCE
+            printf(
+                "inflate_index_build() ERROR: ran out of input before the "
+                "end of the final block\n");
+            #endif
+            break;
         }
     }
     
-    if (data_stream.bits_left != 0) {
+    index->uncompressed_size = stream->total_out;
+    
+    inflate_stream_finish(stream, out_good);
+    
+    if (!*out_good) {
+        inflate_index_free(index);
+        return NULL;
+    }
+    
+    return index;
+}
+
+uint64_t inflate_index_uncompressed_size(
+    InflateIndex const * index)
+{
+    return index->uncompressed_size;
+}
+
+uint64_t inflate_index_points_size(
+    InflateIndex const * index)
+{
+    return index->points_size;
+}
+
+uint64_t inflate_index_serialized_size(
+    InflateIndex const * index)
+{
+    uint64_t return_value = INFLATE_INDEX_HEADER_SIZE;
+    
+    for (uint64_t i = 0; i < index->points_size; i++) {
+        return_value +=
+            INFLATE_INDEX_POINT_HEADER_SIZE + index->points[i].window_size;
+    }
+    
+    return return_value;
+}
+
+static void write_le(
+    uint8_t ** at,
+    uint64_t value,
+    const uint32_t bytes)
+{
+    for (uint32_t i = 0; i < bytes; i++) {
+        (*at)[i] = (uint8_t)(value & 255);
+        value >>= 8;
+    }
+    *at += bytes;
+}
+
+static uint64_t read_le(
+    uint8_t const ** at,
+    const uint32_t bytes)
+{
+    uint64_t return_value = 0;
+    for (uint32_t i = 0; i < bytes; i++) {
+        return_value |= (uint64_t)(*at)[i] << (i * 8);
+    }
+    *at += bytes;
+    
+    return return_value;
+}
+
+void inflate_index_serialize(
+    InflateIndex const * index,
+    uint8_t * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint32_t * out_good)
+{
+    *out_good = 0;
+    *final_recipient_size = 0;
+    
+    uint64_t size = inflate_index_serialized_size(index);
+    if (recipient_size < size) {
         #ifndef INFLATE_SILENCE
         printf(
-            "\t\tpartial byte left after DEFLATE\n");
-        printf(
-            "\t\tdiscarding: %u bits\n",
-            data_stream.bits_left);
+            "inflate_index_serialize() ERROR: the index needs %llu bytes, "
+            "but recipient_size is only %llu\n",
+            size,
+            recipient_size);
         #endif
-        
-        discard_bits(
-            /* from: */ &data_stream,
-            /* amount: */ data_stream.bits_left);
+        return;
+    }
+    
+    uint8_t * at = recipient;
+    for (uint32_t i = 0; i < INFLATE_INDEX_MAGIC_SIZE; i++) {
+        *at++ = (uint8_t)INFLATE_INDEX_MAGIC[i];
+    }
+    write_le(&at, index->compressed_size, 8);
+    write_le(&at, index->uncompressed_size, 8);
+    write_le(&at, index->span, 8);
+    write_le(&at, index->points_size, 8);
+    
+    for (uint64_t i = 0; i < index->points_size; i++) {
+        InflateAccessPoint const * point = index->points + i;
+        write_le(&at, point->input_bit, 8);
+        write_le(&at, point->output_offset, 8);
+        write_le(&at, point->window_size, 4);
+        for (uint32_t j = 0; j < point->window_size; j++) {
+            *at++ = point->window[j];
+        }
     }
     
-    uint32_t bytes_read = (uint32_t)(data_stream.data - compressed_input);
     #ifndef INFLATE_IGNORE_ASSERTS
-    assert(bytes_read >= 0);
+    assert((uint64_t)(at - recipient) == size);
     #endif
-    if (bytes_read != compressed_input_size) {
+    
+    *final_recipient_size = size;
+    *out_good = 1;
+}
+
+InflateIndex * inflate_index_deserialize(
+    InflateContext * context,
+    uint8_t const * serialized,
+    const uint64_t serialized_size,
+    uint32_t * out_good)
+{
+    *out_good = 0;
+    
+    if (serialized_size < INFLATE_INDEX_HEADER_SIZE) {
         #ifndef INFLATE_SILENCE
-        printf(
-           "Warning: expected to read %llu bytes but got %u\n",
-            compressed_input_size,
-            bytes_read);
+        printf("inflate_index_deserialize() ERROR: too small for a header\n");
         #endif
+        return NULL;
+    }
+    
+    uint8_t const * at = serialized;
+    uint8_t const * end = serialized + serialized_size;
+    for (uint32_t i = 0; i < INFLATE_INDEX_MAGIC_SIZE; i++) {
+        if (at[i] != (uint8_t)INFLATE_INDEX_MAGIC[i]) {
+            #ifndef INFLATE_SILENCE
+            printf(
+                "inflate_index_deserialize() ERROR: not an index, or an "
+                "index from an incompatible version\n");
+            #endif
+            return NULL;
+        }
+    }
+    at += INFLATE_INDEX_MAGIC_SIZE;
+    
+    InflateIndex * index = index_create(context);
+    if (index == NULL) {
+        return NULL;
+    }
+    
+    index->compressed_size = read_le(&at, 8);
+    index->uncompressed_size = read_le(&at, 8);
+    index->span = read_le(&at, 8);
+    uint64_t points_size = read_le(&at, 8);
+    
+    /*
+    Every point is checked against the one before it, so a damaged or
+    hand-made index can't make inflate_index_read() jump outside the
+    input or the output
+    */
+    uint32_t good = 1;
+    for (uint64_t i = 0; i < points_size; i++) {
+        if ((uint64_t)(end - at) < INFLATE_INDEX_POINT_HEADER_SIZE) {
+            good = 0;
+            break;
+        }
         
-        #ifndef INFLATE_IGNORE_ASSERTS
-        assert(compressed_input_size > bytes_read);
-        #endif
+        uint64_t input_bit = read_le(&at, 8);
+        uint64_t output_offset = read_le(&at, 8);
+        uint32_t window_size = (uint32_t)read_le(&at, 4);
+        
+        uint64_t expected_window_size = output_offset < INFLATE_WINDOW_SIZE ?
+            output_offset :
+            INFLATE_WINDOW_SIZE;
+        if (
+            window_size != expected_window_size ||
+            (uint64_t)(end - at) < window_size ||
+            input_bit >= index->compressed_size * 8 ||
+            output_offset > index->uncompressed_size ||
+            (i == 0 && (input_bit != 0 || output_offset != 0)) ||
+            (i > 0 &&
+                (input_bit <= index->points[i - 1].input_bit ||
+                    output_offset < index->points[i - 1].output_offset)))
+        {
+            good = 0;
+            break;
+        }
+        
+        InflateAccessPoint * point = index_add_point(
+            /* context: */ context,
+            /* index: */ index,
+            /* input_bit: */ input_bit,
+            /* output_offset: */ output_offset);
+        if (point == NULL) {
+            good = 0;
+            break;
+        }
         
-        uint64_t skip = compressed_input_size - (uint64_t)bytes_read;
+        context->memcpy_func(point->window, at, window_size);
+        at += window_size;
+    }
+    
+    if (!good || points_size == 0 || at != end) {
         #ifndef INFLATE_SILENCE
-        printf("skipping ahead %llu bytes...\n", skip);
+        printf("inflate_index_deserialize() ERROR: the index is damaged\n");
         #endif
-        
-        #ifndef INFLATE_IGNORE_ASSERTS
-        assert(data_stream.size_left >= skip);
+        inflate_index_free(index);
+        return NULL;
+    }
+    
+    *out_good = 1;
+    return index;
+}
+
+void inflate_index_read(
+    InflateContext * context,
+    InflateIndex const * index,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    const uint64_t offset,
+    uint8_t * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint32_t * out_good)
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(context != NULL);
+    assert(index != NULL);
+    assert(recipient != NULL || recipient_size == 0);
+    #endif
+    
+    *out_good = 0;
+    *final_recipient_size = 0;
+    
+    if (compressed_input_size != index->compressed_size) {
+        #ifndef INFLATE_SILENCE
+        printf(
+            "inflate_index_read() ERROR: the index was made for %llu bytes "
+            "of input, not %llu\n",
+            index->compressed_size,
+            compressed_input_size);
+        #endif
+        return;
+    }
+    
+    uint64_t wanted = recipient_size;
+    if (offset >= index->uncompressed_size) {
+        wanted = 0;
+    } else if (wanted > index->uncompressed_size - offset) {
+        wanted = index->uncompressed_size - offset;
+    }
+    if (wanted == 0) {
+        *out_good = 1;
+        return;
+    }
+    
+    // the last point at or before offset
+    uint64_t low = 0;
+    uint64_t high = index->points_size;
+    while (high - low > 1) {
+        uint64_t middle = low + (high - low) / 2;
+        if (index->points[middle].output_offset <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    InflateAccessPoint const * point = index->points + low;
+    
+    InflateStream * stream = inflate_stream_begin(context);
+    if (stream == NULL) {
+        #ifndef INFLATE_SILENCE
+        printf("inflate_index_read() ERROR: failed to allocate a stream\n");
         #endif
+        return;
+    }
+    
+    /*
+    Put the stream back in the state it was in when we paused there: the
+    window, the output count (so it knows how far back matches can reach)
+    and the bits of the first byte that belong to the previous block
+    */
+    stream->total_out = point->output_offset - point->window_size;
+    stream_update_window(stream, point->window, point->window_size);
+    
+    uint64_t input_used = point->input_bit >> 3;
+    uint32_t skip_bits = (uint32_t)(point->input_bit & 7);
+    if (skip_bits > 0) {
+        stream->bit_buffer = compressed_input[input_used] >> skip_bits;
+        stream->bits_left = 8 - skip_bits;
+        input_used++;
+    }
+    
+    uint64_t written = 0;
+    uint32_t status = INFLATE_STREAM_NEEDS_OUTPUT;
+    while (
+        written < wanted &&
+        (status == INFLATE_STREAM_NEEDS_OUTPUT ||
+            status == INFLATE_STREAM_NEEDS_INPUT))
+    {
+        uint64_t window_start = stream->total_out;
+        uint32_t window_at = (uint32_t)(window_start & INFLATE_WINDOW_MASK);
+        
+        uint64_t input_consumed = 0;
+        uint64_t output_written = 0;
+        status = inflate_stream_feed(
+            /* stream: */
+                stream,
+            /* input: */
+                compressed_input + input_used,
+            /* input_size: */
+                compressed_input_size - input_used,
+            /* input_consumed: */
+                &input_consumed,
+            /* output: */
+                stream->window + window_at,
+            /* output_size: */
+                INFLATE_WINDOW_SIZE - window_at,
+            /* output_written: */
+                &output_written);
+        input_used += input_consumed;
+        
+        // copy the part of this piece of output that overlaps our range
+        uint64_t from = offset + written;
+        uint64_t until = window_start + output_written;
+        if (until > offset + wanted) {
+            until = offset + wanted;
+        }
+        if (from < until) {
+            context->memcpy_func(
+                recipient + written,
+                stream->window + window_at + (from - window_start),
+                until - from);
+            written += until - from;
+        }
         
-        data_stream.data += skip;
-        data_stream.size_left -= skip;
+        if (
+            status == INFLATE_STREAM_NEEDS_INPUT &&
+            input_used >= compressed_input_size)
+        {
+            break;
+        }
     }
     
-    #ifndef INFLATE_SILENCE 
-    printf("\t\tend of succesful inflate..\n");
-    #endif
+    context->free_func(stream);
     
-    *out_good = 1;
-    return;
+    *final_recipient_size = written;
+    *out_good = written == wanted;
+    
+    #ifndef INFLATE_SILENCE
+    if (!*out_good) {
+        printf(
+            "inflate_index_read() ERROR: failed after %llu of %llu bytes, "
+            "the input doesn't match the index?\n",
+            written,
+            wanted);
+    }
+    #endif
 }
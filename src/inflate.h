@@ -2,16 +2,26 @@
 #define INFLATE_H
 
 /*
-This API offers only 1 function: inflate()
+This API offers 2 ways to use it: inflate(), and the inflate_stream_xxx()
+functions.
 
-It will decompress a buffer of bytes that was compressed using the DEFLATE or
-'zlib' algorithm.
+Both will decompress bytes that were compressed using the DEFLATE or
+'zlib' algorithm. inflate() does everything in 1 call but needs the whole
+input and a recipient big enough for the whole output. The stream functions
+take the input in slices and hand out the output in chunks, so you can
+decompress while you're still reading a file or a pipe.
 
 DEFLATE is widely used since the 90's. You could decompress the data chunk
 inside a gzip (.gz) file, the IDAT (image data) chunks from a .png image, and
 many others.
+
+On x86-64, inflate_context_create() checks if your CPU has BMI2 and AVX2,
+and if so, inflate() uses a version of its inner loop that was compiled for
+them. Everything else uses plain C.
 */
 
+// #define INFLATE_SCALAR_ONLY // never use the BMI2 / AVX2 kernel
+
 #include <inttypes.h>
 #include <stddef.h>
 
@@ -19,29 +29,55 @@ many others.
 extern "C" {
 #endif
 
-void inflate_init(
-    void * (* malloc_funcptr)(uint64_t __size),
-    void * (* arg_memset_func)(void *str, int c, uint64_t n),
-    void * (* arg_memcpy_func)(void * dest, const void * src, uint64_t n),
-    const uint32_t thread_id);
+/*
+Everything the decoder keeps between calls (lookup tables, and the
+functions you gave it) lives in an InflateContext. Create 1 for each thread
+that decompresses, they don't share anything.
+
+Pass malloc(), free(), memset() and memcpy() from the C standard library, or
+any other functions with the same signatures.
 
-void inflate_destroy(
+returns NULL if malloc_funcptr failed
+
+** Example:
+** InflateContext * context =
+**     inflate_context_create(malloc, free, memset, memcpy);
+** ...
+** inflate_context_destroy(context);
+*/
+typedef struct InflateContext InflateContext;
+
+InflateContext * inflate_context_create(
+    void * (* malloc_funcptr)(uint64_t __size),
     void (* free_funcptr)(void * to_free),
-    const uint32_t thread_id);
+    void * (* memset_funcptr)(void * str, int c, uint64_t n),
+    void * (* memcpy_funcptr)(void * dest, const void * src, uint64_t n));
+
+void inflate_context_destroy(
+    InflateContext * context);
+
+/*
+The amount of temp_working_memory that inflate() could ever need, for any
+input. It's the same every time (a few tens of KB), so you can allocate it
+once and reuse it for every call.
+*/
+uint64_t inflate_working_memory_required(void);
 
 /*
 This function decompresses data was compressed using the DEFLATE algorithm.
 
+- context: from inflate_context_create(), only use it from 1 thread at a time
 - recipient: the receiving memory to uncompress to
 - recipient_size: the capacity in bytes of recipient
 - final_recipient_size: will be filled in with the actual size of the recipient
 after decompressing everything.
-- temp_working_memory: will be used to store some hashmaps
+- temp_working_memory: will be used to store some lookup tables
 that are only useful while the functions runs. You can overwrite
 , free, or pass somewhere else immediately after. The function will fail when
   the working memory is insufficient. If you comment out
   #define INFLATE_SILENCE, the function will complain about insufficient
-  memory with printf() 
+  memory with printf(). inflate_working_memory_required() tells you how much
+  is always enough. It doesn't need to be zeroed.
 - temp_working_memory_size: the capacity in bytes of temp_working_memory
 - compressed_input: the data to be uncompressed
 - compressed_input_size: the capacity in bytes of compressed_input
@@ -49,6 +85,7 @@ that are only useful while the functions runs. You can overwrite
 set to 1 on success, and 0 on failure so you can see if inflate() worked
 */
 void inflate(
+    InflateContext * context,
     uint8_t const * recipient,
     const uint64_t recipient_size,
     uint64_t * final_recipient_size,
@@ -56,8 +93,437 @@ void inflate(
     const uint64_t temp_working_memory_size,
     uint8_t const * compressed_input,
     const uint64_t compressed_input_size,
-    uint32_t * out_good,
-    const uint32_t thread_id);
+    uint32_t * out_good);
+
+/*
+Find out how big the output of inflate() will be, without writing it
+
+This reads the whole input and decodes every symbol like inflate() does, but
+it never copies a match or a stored block, and it needs no memory besides
+temp_working_memory (not even a 32KiB window, because we only need to know
+how far back a match could reach). Use it when your container doesn't store
+the decompressed size, so you can allocate a recipient of exactly the right
+size once.
+
+- decompressed_size: will be set to the amount of bytes inflate() would write
+- temp_working_memory: inflate_working_memory_required() bytes, the same as
+  for inflate()
+- out_good: will be set to 1 on success, and 0 if the data is invalid or
+  truncated (then inflate() would fail too)
+*/
+void inflate_measure(
+    InflateContext * context,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    uint64_t * decompressed_size,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    uint32_t * out_good);
+
+/*
+The same as inflate(), but when recipient is full, it's grown with
+realloc_funcptr instead of failing, and decompression just continues. Use
+this when you don't know how big the output will be, and don't want to
+allocate for the worst case or decompress twice (see inflate_measure()).
+
+- realloc_funcptr: realloc() from the C standard library, or any other
+  function with the same signature that keeps the contents
+- recipient: your recipient, it can point to NULL if you'd rather we
+  allocate the first one. Will be set to the grown recipient, which you must
+  free (even if out_good is 0)
+- recipient_capacity: the capacity in bytes of *recipient, will be set to the
+  capacity of the grown recipient. We at least double it every time we grow,
+  so if your first guess is good, we won't have to grow at all.
+- final_recipient_size: will be set to the amount of bytes written
+
+The other parameters are the same as for inflate().
+*/
+void inflate_growable(
+    InflateContext * context,
+    void * (* realloc_funcptr)(void * to_grow, uint64_t new_size),
+    uint8_t ** recipient,
+    uint64_t * recipient_capacity,
+    uint64_t * final_recipient_size,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    uint32_t * out_good);
+
+/*
+Statistics about what inflate() decoded, for when you want to know why a
+file decodes slowly, or which encoder settings give you data that decodes
+fast.
+
+This only exists if you #define INFLATE_STATS for inflate.c and for your
+own code. Without it, none of the counting is compiled in, so it costs
+nothing.
+
+inflate() adds to the stats you gave the context with
+inflate_context_set_stats(), so they add up over several calls until you zero
+them yourself.
+
+** Example:
+** InflateStats stats;
+** memset(&stats, 0, sizeof(stats));
+** stats.clock_funcptr = my_nanoseconds; // or NULL to skip the timings
+** inflate_context_set_stats(context, &stats);
+** inflate(context, ...);
+** printf("%llu matches\n", stats.matches);
+*/
+#ifdef INFLATE_STATS
+#define INFLATE_STATS_MATCH_LENGTHS 259 // lengths are 3 to 258
+#define INFLATE_STATS_DISTANCE_BUCKETS 16 // distances are 1 to 32768
+
+typedef struct InflateStats {
+    /*
+    Optional, any function that returns an increasing time in any unit you
+    like (nanoseconds, cycles, ...). The 2 timings are in that unit.
+    */
+    uint64_t (* clock_funcptr)(void);
+    
+    // blocks by BTYPE: 0 stored, 1 fixed huffman, 2 dynamic huffman
+    uint64_t blocks[3];
+    
+    uint64_t literals;
+    uint64_t matches;
+    // how many matches had each length
+    uint64_t match_lengths[INFLATE_STATS_MATCH_LENGTHS];
+    // how many matches had a distance of at least 2^i, but less than 2^(i+1)
+    uint64_t match_distances[INFLATE_STATS_DISTANCE_BUCKETS];
+    
+    // reading the code lengths of dynamic blocks and building their tables
+    uint64_t table_build_time;
+    // decoding literals and matches, in fixed and dynamic blocks
+    uint64_t decode_time;
+    
+    // only for calls that succeeded
+    uint64_t input_bytes;
+    uint64_t output_bytes;
+} InflateStats;
+
+/*
+Start collecting stats for every inflate() with this context, or stop with
+NULL. The stats must stay alive until then.
+*/
+void inflate_context_set_stats(
+    InflateContext * context,
+    InflateStats * stats);
+#endif
+
+/*
+The streaming API
+
+** Example:
+** InflateStream * stream = inflate_stream_begin(context);
+** uint32_t status = INFLATE_STREAM_NEEDS_INPUT;
+** while (status == INFLATE_STREAM_NEEDS_INPUT ||
+**     status == INFLATE_STREAM_NEEDS_OUTPUT)
+** {
+**     // read the next slice of the file into input if it's all consumed...
+**     status = inflate_stream_feed(
+**         stream,
+**         input,
+**         input_size,
+**         &input_consumed,
+**         output,
+**         output_size,
+**         &output_written);
+**     // do something with output_written bytes of output...
+** }
+** uint32_t good = 0;
+** inflate_stream_finish(stream, &good);
+
+The stream is allocated with the context's malloc, and borrows the context's
+fixed huffman tables, so don't destroy the context before you finish the
+stream. You can run several streams with 1 context, but only from 1 thread.
+A stream keeps the last 32KiB of output internally, so you can reuse your
+output buffer right after each call.
+*/
+typedef struct InflateStream InflateStream;
+
+#define INFLATE_STREAM_ERROR 0
+// all input was consumed, call again with more input
+#define INFLATE_STREAM_NEEDS_INPUT 1
+// the output buffer is full, call again with more room
+#define INFLATE_STREAM_NEEDS_OUTPUT 2
+// the final block was decoded, you can call inflate_stream_finish()
+#define INFLATE_STREAM_FINISHED 3
+
+/*
+returns NULL if the context's malloc failed
+*/
+InflateStream * inflate_stream_begin(
+    InflateContext * context);
+
+/*
+Decompress as much of input as possible into output
+
+- input: the next slice of compressed data, can be of any size (even 0)
+- input_consumed: will be set to the amount of bytes of input that were used.
+  This is all of them unless the stream finished or the output is full, then
+  you should pass the rest again (together with your next slice if you like)
+- output: where to write the decompressed bytes
+- output_written: will be set to the amount of bytes written to output
+
+returns one of the INFLATE_STREAM_xxx values above. After an error, the
+stream is unusable and will keep returning INFLATE_STREAM_ERROR
+*/
+uint32_t inflate_stream_feed(
+    InflateStream * stream,
+    uint8_t const * input,
+    const uint64_t input_size,
+    uint64_t * input_consumed,
+    uint8_t * output,
+    const uint64_t output_size,
+    uint64_t * output_written);
+
+/*
+Free the stream. out_good will be set to 1 if the stream reached the end of
+its final block, and 0 if it failed or was truncated
+*/
+void inflate_stream_finish(
+    InflateStream * stream,
+    uint32_t * out_good);
+
+/*
+Decompress without ever holding the whole output in memory
+
+Only the last 32KiB of output (as much as DEFLATE can refer back to) is kept,
+inside a stream object. Every time a piece of that window is filled up, it's
+passed to sink_funcptr, so your peak memory use doesn't depend on how big the
+decompressed data is. If you'd rather pull the output through a small
+rotating buffer of your own, use inflate_stream_feed() directly.
+
+- sink_funcptr: called with each new chunk of output (up to 32KiB at a time).
+  The bytes are only valid until it returns. Return 1 to continue, or 0 to
+  stop decompressing (out_good will be 0)
+- sink_data: passed to sink_funcptr as-is, use it for your file handle etc.
+- final_output_size: will be set to the total amount of bytes sent to the sink
+- out_good: will be set to 1 on success, and 0 on failure
+*/
+void inflate_to_sink(
+    InflateContext * context,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    uint32_t (* sink_funcptr)(
+        void * sink_data,
+        uint8_t const * bytes,
+        const uint64_t bytes_size),
+    void * sink_data,
+    uint64_t * final_output_size,
+    uint32_t * out_good);
+
+/*
+Decompress only the first output_limit bytes, for when you only want to peek
+at the start of the data (to detect a file type, or to read the first row of
+an image). We stop as soon as we have them, even in the middle of a block or
+a match, so this costs about as much as decompressing output_limit bytes, no
+matter how big the whole output would be.
+
+- recipient: room for at least output_limit bytes
+- output_limit: the most bytes to decompress
+- final_recipient_size: will be set to the amount of bytes written. That's
+  output_limit, unless the data ends (or is broken) before that.
+- compressed_input: the data to be uncompressed, you can pass only the start
+  of it if that's all you have
+- input_consumed: will be set to how many bytes of compressed_input we read
+  to get there
+- reached_final_block: will be set to 1 if we decoded all of the data, and 0
+  if there's more after output_limit bytes
+- out_good: will be set to 1 if we got output_limit bytes or decoded all of
+  the data, and 0 if the data was invalid or ended too soon (the
+  final_recipient_size bytes we did get are still correct then)
+
+Like inflate_to_sink(), this uses a stream inside, so it allocates about
+70KB with the context's malloc.
+*/
+void inflate_partial(
+    InflateContext * context,
+    uint8_t * recipient,
+    const uint64_t output_limit,
+    uint64_t * final_recipient_size,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    uint64_t * input_consumed,
+    uint32_t * reached_final_block,
+    uint32_t * out_good);
+
+/*
+Speculative decoding
+
+These are the building blocks of inflate_parallel.h, which decompresses 1
+big stream on several threads. You only need them if you want to schedule
+that work yourself.
+
+Starting in the middle of a stream, we can't know the 32KiB of output that
+came before, so the output is 16-bit symbols instead of bytes: values below
+INFLATE_PLACEHOLDER are bytes, and INFLATE_PLACEHOLDER + i stands for byte i
+of the 32KiB window that came right before start_bit (byte 32767 is the last
+one). Once you know that window, you can replace each symbol with a byte.
+*/
+#define INFLATE_PLACEHOLDER 256
+
+/*
+Find the first bit in [from_bit, until_bit) where a dynamic (BTYPE 2) or
+stored (BTYPE 0) block could start. This is a guess: it can be fooled by
+data that happens to look like a block header, so check it by decoding.
+
+temp_working_memory needs inflate_working_memory_required() bytes.
+
+returns until_bit if nothing was found
+*/
+uint64_t inflate_find_block(
+    InflateContext * context,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    const uint64_t from_bit,
+    const uint64_t until_bit,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size);
+
+/*
+Decode whole blocks from start_bit, until the first block that ends at or
+after stop_bit, or until the final block
+
+- history_size: how much output came before start_bit and may be referred
+  to, 0 at the start of a stream and 32768 anywhere else
+- symbols: will be set to a buffer from the context's malloc, free it with
+  the context's free. NULL on failure.
+- symbols_size: will be set to the amount of symbols decoded
+- end_bit: will be set to the position after the last block we decoded
+- reached_final_block: will be set to 1 if that block was the final one
+- out_good: will be set to 1 on success, and 0 if the data was invalid
+*/
+void inflate_speculative(
+    InflateContext * context,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    const uint64_t start_bit,
+    const uint64_t stop_bit,
+    const uint32_t history_size,
+    uint16_t ** symbols,
+    uint64_t * symbols_size,
+    uint64_t * end_bit,
+    uint32_t * reached_final_block,
+    uint8_t * temp_working_memory,
+    const uint64_t temp_working_memory_size,
+    uint32_t * out_good);
+
+/*
+Random access
+
+To read a small range from the middle of a big stream, you'd normally have to
+decompress everything before it. An index remembers where to pick up instead:
+while decompressing the whole stream once, it records an 'access point' at
+the start of a block about every span bytes of output. Each access point
+holds the bit where that block starts, how much output came before it, and
+the 32KiB of output before it (so 32KiB of memory per point).
+
+Reading a range then only decompresses from the access point before it,
+which is about span bytes of work, wherever the range is.
+
+** Example:
+** uint32_t good = 0;
+** InflateIndex * index = inflate_index_build(
+**     context,
+**     deflate_data,
+**     deflate_data_size,
+**     1024 * 1024,
+**     &good);
+** ...
+** inflate_index_read(
+**     context,
+**     index,
+**     deflate_data,
+**     deflate_data_size,
+**     offset,
+**     recipient,
+**     recipient_size,
+**     &bytes_read,
+**     &good);
+** ...
+** inflate_index_free(index);
+
+For a .gz file, use decode_gz_deflate_data() in decode_gz.h to find the
+DEFLATE data inside it first.
+*/
+typedef struct InflateIndex InflateIndex;
+
+/*
+Decompress all of compressed_input once, and record access points
+
+- span: the minimum amount of output bytes between access points. Smaller
+  spans make reads faster, but the index bigger.
+- out_good: will be set to 1 on success, and 0 on failure
+
+returns NULL on failure. The index is allocated with the context's malloc,
+free it with inflate_index_free()
+*/
+InflateIndex * inflate_index_build(
+    InflateContext * context,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    const uint64_t span,
+    uint32_t * out_good);
+
+void inflate_index_free(
+    InflateIndex * index);
+
+// the size of all output of the indexed stream
+uint64_t inflate_index_uncompressed_size(
+    InflateIndex const * index);
+
+uint64_t inflate_index_points_size(
+    InflateIndex const * index);
+
+/*
+Save an index, for example to a sidecar file next to your .gz file, so you
+never have to decompress the whole thing again
+
+The format is the same on every platform. Use inflate_index_serialized_size()
+to find out how big recipient needs to be.
+*/
+uint64_t inflate_index_serialized_size(
+    InflateIndex const * index);
+
+void inflate_index_serialize(
+    InflateIndex const * index,
+    uint8_t * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint32_t * out_good);
+
+/*
+Load an index saved by inflate_index_serialize()
+
+returns NULL (and sets out_good to 0) if serialized is not a valid index
+*/
+InflateIndex * inflate_index_deserialize(
+    InflateContext * context,
+    uint8_t const * serialized,
+    const uint64_t serialized_size,
+    uint32_t * out_good);
+
+/*
+Decompress recipient_size bytes, starting at byte offset of the output
+
+- compressed_input: the same data the index was built from
+- final_recipient_size: will be set to the amount of bytes written, which is
+  less than recipient_size if the range goes past the end of the output
+- out_good: will be set to 1 on success, and 0 if the input failed to
+  decompress (for example because it's not the data the index was built from)
+*/
+void inflate_index_read(
+    InflateContext * context,
+    InflateIndex const * index,
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    const uint64_t offset,
+    uint8_t * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint32_t * out_good);
 
 #ifdef __cplusplus
 }
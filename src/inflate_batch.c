@@ -0,0 +1,389 @@
+#include "inflate_batch.h"
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+#ifndef INFLATE_SILENCE
+#include <stdio.h>
+#endif
+
+#ifndef INFLATE_IGNORE_ASSERTS
+#include <assert.h>
+#endif
+
+#ifndef INFLATE_BATCH_SINGLE_THREADED
+#include <pthread.h>
+#endif
+
+/*
+Each worker owns a queue of item indexes. The owner takes from the front
+(its biggest items), and workers with an empty queue steal from the back.
+Nothing is added to a queue once the run started, so when every queue is
+empty, the run is over.
+
+The items are whole inflate() calls, so a plain mutex per queue costs
+nothing compared to the work it protects.
+*/
+typedef struct InflateBatchQueue {
+    #ifndef INFLATE_BATCH_SINGLE_THREADED
+    pthread_mutex_t mutex;
+    uint32_t mutex_made;
+    #endif
+    uint32_t * jobs;
+    uint32_t front;
+    uint32_t back;
+} InflateBatchQueue;
+
+typedef struct InflateBatchWorker {
+    InflateBatch * batch;
+    uint32_t worker_i;
+    InflateContext * context;
+    uint8_t * working_memory;
+    InflateBatchQueue queue;
+    #ifndef INFLATE_BATCH_SINGLE_THREADED
+    pthread_t thread;
+    uint32_t thread_started;
+    #endif
+} InflateBatchWorker;
+
+struct InflateBatch {
+    void * (* malloc_func)(uint64_t __size);
+    void (* free_func)(void * to_free);
+    uint64_t working_memory_size;
+    uint32_t workers_count;
+    InflateBatchWorker * workers;
+    
+    // only valid during inflate_batch_run()
+    InflateBatchItem * items;
+};
+
+InflateBatch * inflate_batch_create(
+    const uint32_t workers_count,
+    void * (* malloc_funcptr)(uint64_t __size),
+    void (* free_funcptr)(void * to_free),
+    void * (* memset_funcptr)(void * str, int c, uint64_t n),
+    void * (* memcpy_funcptr)(void * dest, const void * src, uint64_t n))
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(workers_count > 0);
+    assert(malloc_funcptr != NULL);
+    assert(free_funcptr != NULL);
+    #endif
+    
+    InflateBatch * batch = (InflateBatch *)malloc_funcptr(
+        sizeof(InflateBatch));
+    if (batch == NULL) {
+        return NULL;
+    }
+    
+    batch->malloc_func = malloc_funcptr;
+    batch->free_func = free_funcptr;
+    batch->working_memory_size = inflate_working_memory_required();
+    batch->items = NULL;
+    batch->workers_count = 0;
+    batch->workers = (InflateBatchWorker *)malloc_funcptr(
+        sizeof(InflateBatchWorker) * workers_count);
+    if (batch->workers == NULL) {
+        free_funcptr(batch);
+        return NULL;
+    }
+    
+    for (uint32_t i = 0; i < workers_count; i++) {
+        InflateBatchWorker * worker = batch->workers + i;
+        worker->batch = batch;
+        worker->worker_i = i;
+        worker->queue.jobs = NULL;
+        worker->queue.front = 0;
+        worker->queue.back = 0;
+        worker->context = inflate_context_create(
+            malloc_funcptr,
+            free_funcptr,
+            memset_funcptr,
+            memcpy_funcptr);
+        worker->working_memory = (uint8_t *)malloc_funcptr(
+            batch->working_memory_size);
+        
+        uint32_t worker_good =
+            worker->context != NULL && worker->working_memory != NULL;
+        
+        #ifndef INFLATE_BATCH_SINGLE_THREADED
+        worker->thread_started = 0;
+        worker->queue.mutex_made =
+            pthread_mutex_init(&worker->queue.mutex, NULL) == 0;
+        worker_good = worker_good && worker->queue.mutex_made;
+        #endif
+        
+        // count it before checking, so destroy cleans up the half-made one
+        batch->workers_count = i + 1;
+        
+        if (!worker_good) {
+            inflate_batch_destroy(batch);
+            return NULL;
+        }
+    }
+    
+    return batch;
+}
+
+void inflate_batch_destroy(
+    InflateBatch * batch)
+{
+    if (batch == NULL) {
+        return;
+    }
+    
+    for (uint32_t i = 0; i < batch->workers_count; i++) {
+        InflateBatchWorker * worker = batch->workers + i;
+        inflate_context_destroy(worker->context);
+        if (worker->working_memory != NULL) {
+            batch->free_func(worker->working_memory);
+        }
+        #ifndef INFLATE_BATCH_SINGLE_THREADED
+        if (worker->queue.mutex_made) {
+            pthread_mutex_destroy(&worker->queue.mutex);
+        }
+        #endif
+    }
+    
+    batch->free_func(batch->workers);
+    batch->free_func(batch);
+}
+
+static uint32_t queue_take(
+    InflateBatchQueue * queue,
+    const uint32_t from_back,
+    uint32_t * job)
+{
+    uint32_t found = 0;
+    
+    #ifndef INFLATE_BATCH_SINGLE_THREADED
+    pthread_mutex_lock(&queue->mutex);
+    #endif
+    
+    if (queue->front < queue->back) {
+        if (from_back) {
+            queue->back -= 1;
+            *job = queue->jobs[queue->back];
+        } else {
+            *job = queue->jobs[queue->front];
+            queue->front += 1;
+        }
+        found = 1;
+    }
+    
+    #ifndef INFLATE_BATCH_SINGLE_THREADED
+    pthread_mutex_unlock(&queue->mutex);
+    #endif
+    
+    return found;
+}
+
+static void * inflate_batch_worker(
+    void * worker_ptr)
+{
+    InflateBatchWorker * worker = (InflateBatchWorker *)worker_ptr;
+    InflateBatch * batch = worker->batch;
+    
+    while (1) {
+        uint32_t job = 0;
+        uint32_t found = queue_take(
+            /* queue: */ &worker->queue,
+            /* from_back: */ 0,
+            /* job: */ &job);
+        
+        for (uint32_t i = 1; !found && i < batch->workers_count; i++) {
+            uint32_t victim_i =
+                (worker->worker_i + i) % batch->workers_count;
+            InflateBatchWorker * victim = batch->workers + victim_i;
+            found = queue_take(
+                /* queue: */ &victim->queue,
+                /* from_back: */ 1,
+                /* job: */ &job);
+        }
+        
+        if (!found) {
+            break;
+        }
+        
+        InflateBatchItem * item = batch->items + job;
+        item->output_written = 0;
+        item->good = 0;
+        inflate(
+            /* context: */
+                worker->context,
+            /* recipient: */
+                item->output,
+            /* recipient_size: */
+                item->output_size,
+            /* final_recipient_size: */
+                &item->output_written,
+            /* temp_working_memory: */
+                worker->working_memory,
+            /* temp_working_memory_size: */
+                batch->working_memory_size,
+            /* compressed_input: */
+                item->input,
+            /* compressed_input_size: */
+                item->input_size,
+            /* out_good: */
+                &item->good);
+    }
+    
+    return NULL;
+}
+
+/*
+Sort item indexes from the biggest input to the smallest (a merge sort, so
+a batch of thousands of items doesn't take quadratic time)
+*/
+static void sort_jobs_by_input_size(
+    InflateBatchItem const * items,
+    uint32_t * jobs,
+    uint32_t * scratch,
+    const uint32_t jobs_size)
+{
+    uint32_t * from = jobs;
+    uint32_t * to = scratch;
+    
+    for (uint32_t width = 1; width < jobs_size; width *= 2) {
+        for (uint32_t left = 0; left < jobs_size; left += 2 * width) {
+            uint32_t middle = left + width;
+            uint32_t right = left + 2 * width;
+            if (middle > jobs_size) { middle = jobs_size; }
+            if (right > jobs_size) { right = jobs_size; }
+            
+            uint32_t a = left;
+            uint32_t b = middle;
+            for (uint32_t i = left; i < right; i++) {
+                if (
+                    a < middle &&
+                    (b >= right ||
+                        items[from[a]].input_size >=
+                            items[from[b]].input_size))
+                {
+                    to[i] = from[a++];
+                } else {
+                    to[i] = from[b++];
+                }
+            }
+        }
+        
+        uint32_t * swap = from;
+        from = to;
+        to = swap;
+    }
+    
+    if (from != jobs) {
+        for (uint32_t i = 0; i < jobs_size; i++) {
+            jobs[i] = from[i];
+        }
+    }
+}
+
+void inflate_batch_run(
+    InflateBatch * batch,
+    InflateBatchItem * items,
+    const uint32_t items_size,
+    uint32_t * out_good)
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(batch != NULL);
+    assert(items != NULL || items_size == 0);
+    #endif
+    
+    *out_good = 0;
+    
+    for (uint32_t i = 0; i < items_size; i++) {
+        items[i].output_written = 0;
+        items[i].good = 0;
+    }
+    
+    if (items_size == 0) {
+        *out_good = 1;
+        return;
+    }
+    
+    uint32_t * jobs = (uint32_t *)batch->malloc_func(
+        sizeof(uint32_t) * items_size * 2);
+    if (jobs == NULL) {
+        #ifndef INFLATE_SILENCE
+        printf("inflate_batch_run() failing - malloc failed\n");
+        #endif
+        return;
+    }
+    uint32_t * sorted = jobs + items_size;
+    
+    for (uint32_t i = 0; i < items_size; i++) {
+        sorted[i] = i;
+    }
+    sort_jobs_by_input_size(
+        /* items: */ items,
+        /* jobs: */ sorted,
+        /* scratch: */ jobs,
+        /* jobs_size: */ items_size);
+    
+    /*
+    Deal the sorted items out like cards, so every worker gets a similar mix
+    of big and small ones, still sorted from big to small
+    */
+    uint32_t workers_count = batch->workers_count;
+    uint32_t slice_start = 0;
+    for (uint32_t w = 0; w < workers_count; w++) {
+        uint32_t slice_size =
+            items_size / workers_count +
+            (w < items_size % workers_count ? 1 : 0);
+        
+        InflateBatchQueue * queue = &batch->workers[w].queue;
+        queue->jobs = jobs + slice_start;
+        queue->front = 0;
+        queue->back = slice_size;
+        
+        for (uint32_t i = 0; i < slice_size; i++) {
+            queue->jobs[i] = sorted[w + i * workers_count];
+        }
+        slice_start += slice_size;
+    }
+    
+    batch->items = items;
+    
+    #ifndef INFLATE_BATCH_SINGLE_THREADED
+    /*
+    If a thread fails to start, its queue will just be stolen from by the
+    others, and we're still correct (only slower)
+    */
+    for (uint32_t w = 1; w < workers_count; w++) {
+        batch->workers[w].thread_started =
+            pthread_create(
+                &batch->workers[w].thread,
+                NULL,
+                inflate_batch_worker,
+                batch->workers + w) == 0;
+    }
+    #endif
+    
+    // the calling thread is worker 0
+    inflate_batch_worker(batch->workers + 0);
+    
+    #ifndef INFLATE_BATCH_SINGLE_THREADED
+    for (uint32_t w = 1; w < workers_count; w++) {
+        if (batch->workers[w].thread_started) {
+            pthread_join(batch->workers[w].thread, NULL);
+            batch->workers[w].thread_started = 0;
+        }
+    }
+    #endif
+    
+    batch->items = NULL;
+    for (uint32_t w = 0; w < workers_count; w++) {
+        batch->workers[w].queue.jobs = NULL;
+    }
+    batch->free_func(jobs);
+    
+    *out_good = 1;
+    for (uint32_t i = 0; i < items_size; i++) {
+        if (!items[i].good) {
+            *out_good = 0;
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef INFLATE_BATCH_H
+#define INFLATE_BATCH_H
+
+/*
+Decompress many independent DEFLATE streams (for example the IDAT data of a
+bunch of .png files, or the members of a few .gz files) on several threads
+at once.
+
+You describe each stream with an InflateBatchItem, and inflate_batch_run()
+spreads them over its workers. The biggest inputs are handed out first, and
+a worker that runs out of items steals from the others, so 1 huge stream at
+the end of your array doesn't leave all other cores idle.
+
+Every worker has its own InflateContext and working memory, which are
+created once in inflate_batch_create() and reused for every run.
+
+This file needs POSIX threads (link with -lpthread). If you don't have them,
+#define INFLATE_BATCH_SINGLE_THREADED and everything will run on the calling
+thread instead.
+*/
+
+// #define INFLATE_BATCH_SINGLE_THREADED // don't use pthreads
+
+#include "inflate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+1 independent stream to decompress
+
+You fill in:
+- input: raw DEFLATE data (without a zlib or gzip header), like for inflate()
+- input_size: the size in bytes of input
+- output: the receiving memory to uncompress to
+- output_size: the capacity in bytes of output
+
+The batch fills in:
+- output_written: the amount of bytes written to output
+- good: 1 on success, 0 on failure
+*/
+typedef struct InflateBatchItem {
+    uint8_t const * input;
+    uint64_t input_size;
+    uint8_t * output;
+    uint64_t output_size;
+    uint64_t output_written;
+    uint32_t good;
+} InflateBatchItem;
+
+typedef struct InflateBatch InflateBatch;
+
+/*
+- workers_count: how many threads to decompress with (including the thread
+  that calls inflate_batch_run()), usually the amount of cores you have
+
+returns NULL if malloc_funcptr failed
+
+** Example:
+** InflateBatch * batch = inflate_batch_create(
+**     8,
+**     malloc,
+**     free,
+**     memset,
+**     memcpy);
+** ...
+** uint32_t good = 0;
+** inflate_batch_run(batch, items, items_size, &good);
+** ...
+** inflate_batch_destroy(batch);
+*/
+InflateBatch * inflate_batch_create(
+    const uint32_t workers_count,
+    void * (* malloc_funcptr)(uint64_t __size),
+    void (* free_funcptr)(void * to_free),
+    void * (* memset_funcptr)(void * str, int c, uint64_t n),
+    void * (* memcpy_funcptr)(void * dest, const void * src, uint64_t n));
+
+void inflate_batch_destroy(
+    InflateBatch * batch);
+
+/*
+Decompress all items, and return when they're all done
+
+Only run 1 batch at a time with the same InflateBatch.
+
+- out_good: will be set to 1 if every item succeeded, and 0 otherwise. Check
+  the good of each item to see which ones failed.
+*/
+void inflate_batch_run(
+    InflateBatch * batch,
+    InflateBatchItem * items,
+    const uint32_t items_size,
+    uint32_t * out_good);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INFLATE_BATCH_H
@@ -0,0 +1,512 @@
+#include "inflate_parallel.h"
+#include "parallel_tasks.h"
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+#ifndef INFLATE_SILENCE
+#include <stdio.h>
+#endif
+
+#ifndef INFLATE_IGNORE_ASSERTS
+#include <assert.h>
+#endif
+
+#define INFLATE_PARALLEL_WINDOW_SIZE 32768
+#define INFLATE_PARALLEL_NO_STOP 0xffffffffffffffffull
+
+/*
+What we know about 1 chunk of the compressed input after step 1
+*/
+typedef struct InflateParallelChunk {
+    uint64_t first_bit; // where this chunk of the input begins
+    uint64_t start_bit; // where we found a block to start decoding
+    uint64_t end_bit;
+    uint16_t * symbols;
+    uint64_t symbols_size;
+    uint32_t reached_final_block;
+    uint32_t good;
+} InflateParallelChunk;
+
+/*
+A run of symbols in the final output, in order. That's either a chunk from
+step 1, or a part we decoded again in step 2.
+*/
+typedef struct InflateParallelPiece {
+    uint16_t * symbols;
+    uint64_t symbols_size;
+    uint64_t output_at;
+    uint32_t good;
+} InflateParallelPiece;
+
+#define INFLATE_PARALLEL_STEP_DECODE 0
+#define INFLATE_PARALLEL_STEP_RESOLVE 1
+
+typedef struct InflateParallelShared {
+    uint8_t const * compressed_input;
+    uint64_t compressed_input_size;
+    uint8_t * recipient;
+    
+    InflateParallelChunk * chunks;
+    uint32_t chunks_size;
+    InflateParallelPiece * pieces;
+    uint32_t pieces_size;
+    
+    uint32_t step;
+} InflateParallelShared;
+
+typedef struct InflateParallelThread {
+    InflateParallelShared * shared;
+    InflateContext * context;
+    uint8_t * working_memory;
+    uint64_t working_memory_size;
+} InflateParallelThread;
+
+/*
+Step 1 for 1 chunk: find a block start, and decode until the first block
+that ends in the next chunk
+*/
+static void decode_chunk(
+    InflateParallelThread * thread,
+    const uint32_t chunk_i)
+{
+    InflateParallelShared * shared = thread->shared;
+    InflateParallelChunk * chunk = shared->chunks + chunk_i;
+    
+    uint64_t until_bit = shared->compressed_input_size * 8;
+    uint64_t stop_bit = INFLATE_PARALLEL_NO_STOP;
+    if (chunk_i + 1 < shared->chunks_size) {
+        until_bit = shared->chunks[chunk_i + 1].first_bit;
+        stop_bit = until_bit;
+    }
+    
+    uint64_t from_bit = chunk->first_bit;
+    while (from_bit < until_bit) {
+        // the first chunk starts at the start of the stream, no guessing
+        uint64_t candidate = 0;
+        if (chunk_i > 0) {
+            candidate = inflate_find_block(
+                /* context: */
+                    thread->context,
+                /* compressed_input: */
+                    shared->compressed_input,
+                /* compressed_input_size: */
+                    shared->compressed_input_size,
+                /* from_bit: */
+                    from_bit,
+                /* until_bit: */
+                    until_bit,
+                /* temp_working_memory: */
+                    thread->working_memory,
+                /* temp_working_memory_size: */
+                    thread->working_memory_size);
+            if (candidate >= until_bit) {
+                break;
+            }
+        }
+        
+        inflate_speculative(
+            /* context: */
+                thread->context,
+            /* compressed_input: */
+                shared->compressed_input,
+            /* compressed_input_size: */
+                shared->compressed_input_size,
+            /* start_bit: */
+                candidate,
+            /* stop_bit: */
+                stop_bit,
+            /* history_size: */
+                chunk_i > 0 ? INFLATE_PARALLEL_WINDOW_SIZE : 0,
+            /* symbols: */
+                &chunk->symbols,
+            /* symbols_size: */
+                &chunk->symbols_size,
+            /* end_bit: */
+                &chunk->end_bit,
+            /* reached_final_block: */
+                &chunk->reached_final_block,
+            /* temp_working_memory: */
+                thread->working_memory,
+            /* temp_working_memory_size: */
+                thread->working_memory_size,
+            /* out_good: */
+                &chunk->good);
+        
+        if (chunk->good || chunk_i == 0) {
+            chunk->start_bit = candidate;
+            return;
+        }
+        
+        // that wasn't a real block, keep looking
+        from_bit = candidate + 1;
+    }
+}
+
+/*
+Replace symbols [from, to) of a piece with bytes. The 32KiB of output right
+before the piece must be written already.
+
+returns 0 if the data referred to bytes before the start of the output
+*/
+static uint32_t resolve_piece(
+    uint8_t * recipient,
+    InflateParallelPiece * piece,
+    const uint64_t from,
+    const uint64_t to)
+{
+    uint8_t * output = recipient + piece->output_at;
+    
+    for (uint64_t i = from; i < to; i++) {
+        uint32_t symbol = piece->symbols[i];
+        if (symbol < INFLATE_PLACEHOLDER) {
+            output[i] = (uint8_t)symbol;
+            continue;
+        }
+        
+        uint64_t back = INFLATE_PARALLEL_WINDOW_SIZE -
+            (symbol - INFLATE_PLACEHOLDER);
+        if (back > piece->output_at) {
+            return 0;
+        }
+        output[i] = recipient[piece->output_at - back];
+    }
+    
+    return 1;
+}
+
+static void run_task(
+    void * thread_ptr,
+    const uint32_t task)
+{
+    InflateParallelThread * thread = (InflateParallelThread *)thread_ptr;
+    InflateParallelShared * shared = thread->shared;
+    
+    if (shared->step == INFLATE_PARALLEL_STEP_DECODE) {
+        decode_chunk(thread, task);
+    } else {
+        // the last 32KiB of every piece was resolved in step 2 already
+        InflateParallelPiece * piece = shared->pieces + task;
+        uint64_t head_size =
+            piece->symbols_size > INFLATE_PARALLEL_WINDOW_SIZE ?
+                piece->symbols_size - INFLATE_PARALLEL_WINDOW_SIZE :
+                0;
+        piece->good = resolve_piece(
+            /* recipient: */ shared->recipient,
+            /* piece: */ piece,
+            /* from: */ 0,
+            /* to: */ head_size);
+    }
+}
+
+/*
+Run tasks_size tasks of the current step on all our threads, and return when
+they're done
+*/
+static void run_step(
+    InflateParallelThread * threads,
+    const uint32_t threads_size,
+    const uint32_t step,
+    const uint32_t tasks_size,
+    void * (* malloc_funcptr)(uint64_t __size),
+    void (* free_funcptr)(void * to_free))
+{
+    threads[0].shared->step = step;
+    
+    parallel_tasks_run(
+        /* run_task: */ run_task,
+        /* threads_data: */ threads,
+        /* thread_data_size: */ sizeof(InflateParallelThread),
+        /* threads_size: */ threads_size,
+        /* tasks_size: */ tasks_size,
+        /* malloc_funcptr: */ malloc_funcptr,
+        /* free_funcptr: */ free_funcptr);
+}
+
+/*
+Step 2: walk through the chunks in order and decide which ones we can use,
+decoding the gaps again with what we know now
+
+returns 0 on failure
+*/
+static uint32_t stitch_chunks(
+    InflateParallelThread * thread,
+    uint64_t * output_size)
+{
+    InflateParallelShared * shared = thread->shared;
+    InflateParallelChunk * chunks = shared->chunks;
+    
+    if (!chunks[0].good) {
+        return 0;
+    }
+    
+    uint64_t at_bit = chunks[0].end_bit;
+    uint32_t reached_final_block = chunks[0].reached_final_block;
+    shared->pieces[0].symbols = chunks[0].symbols;
+    shared->pieces[0].symbols_size = chunks[0].symbols_size;
+    chunks[0].symbols = NULL;
+    shared->pieces_size = 1;
+    
+    uint32_t chunk_i = 1;
+    while (!reached_final_block) {
+        while (
+            chunk_i < shared->chunks_size &&
+            (!chunks[chunk_i].good || chunks[chunk_i].start_bit < at_bit))
+        {
+            chunk_i++;
+        }
+        
+        InflateParallelPiece * piece = shared->pieces + shared->pieces_size;
+        
+        if (
+            chunk_i < shared->chunks_size &&
+            chunks[chunk_i].start_bit == at_bit)
+        {
+            // the block before ended right where this chunk guessed
+            piece->symbols = chunks[chunk_i].symbols;
+            piece->symbols_size = chunks[chunk_i].symbols_size;
+            chunks[chunk_i].symbols = NULL;
+            at_bit = chunks[chunk_i].end_bit;
+            reached_final_block = chunks[chunk_i].reached_final_block;
+            chunk_i++;
+        } else {
+            // catch up to the next chunk that might still fit
+            uint32_t good = 0;
+            inflate_speculative(
+                /* context: */
+                    thread->context,
+                /* compressed_input: */
+                    shared->compressed_input,
+                /* compressed_input_size: */
+                    shared->compressed_input_size,
+                /* start_bit: */
+                    at_bit,
+                /* stop_bit: */
+                    chunk_i < shared->chunks_size ?
+                        chunks[chunk_i].start_bit :
+                        INFLATE_PARALLEL_NO_STOP,
+                /* history_size: */
+                    INFLATE_PARALLEL_WINDOW_SIZE,
+                /* symbols: */
+                    &piece->symbols,
+                /* symbols_size: */
+                    &piece->symbols_size,
+                /* end_bit: */
+                    &at_bit,
+                /* reached_final_block: */
+                    &reached_final_block,
+                /* temp_working_memory: */
+                    thread->working_memory,
+                /* temp_working_memory_size: */
+                    thread->working_memory_size,
+                /* out_good: */
+                    &good);
+            if (!good) {
+                return 0;
+            }
+        }
+        
+        shared->pieces_size += 1;
+    }
+    
+    // now we know where every piece goes
+    *output_size = 0;
+    for (uint32_t i = 0; i < shared->pieces_size; i++) {
+        shared->pieces[i].output_at = *output_size;
+        shared->pieces[i].good = 1;
+        *output_size += shared->pieces[i].symbols_size;
+    }
+    
+    return 1;
+}
+
+void inflate_parallel(
+    const uint32_t threads_count,
+    void * (* malloc_funcptr)(uint64_t __size),
+    void (* free_funcptr)(void * to_free),
+    void * (* memset_funcptr)(void * str, int c, uint64_t n),
+    void * (* memcpy_funcptr)(void * dest, const void * src, uint64_t n),
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    uint8_t * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint32_t * out_good)
+{
+    #ifndef INFLATE_IGNORE_ASSERTS
+    assert(threads_count > 0);
+    #endif
+    
+    *out_good = 0;
+    *final_recipient_size = 0;
+    
+    uint32_t chunks_size = (uint32_t)(
+        compressed_input_size / INFLATE_PARALLEL_CHUNK_SIZE);
+    if (chunks_size < 2 || threads_count < 2) {
+        chunks_size = 1;
+    }
+    
+    uint32_t threads_size = threads_count;
+    if (threads_size > chunks_size) {
+        threads_size = chunks_size;
+    }
+    
+    /*
+    Everything is allocated up front: at most 1 piece per chunk, and 1 catch
+    up in front of each of those
+    */
+    InflateParallelShared shared;
+    shared.compressed_input = compressed_input;
+    shared.compressed_input_size = compressed_input_size;
+    shared.recipient = recipient;
+    shared.chunks_size = chunks_size;
+    shared.pieces_size = 0;
+    shared.chunks = (InflateParallelChunk *)malloc_funcptr(
+        sizeof(InflateParallelChunk) * chunks_size);
+    shared.pieces = (InflateParallelPiece *)malloc_funcptr(
+        sizeof(InflateParallelPiece) * (chunks_size * 2 + 1));
+    InflateParallelThread * threads = (InflateParallelThread *)malloc_funcptr(
+        sizeof(InflateParallelThread) * threads_size);
+    
+    uint32_t threads_made = 0;
+    uint32_t all_allocated =
+        shared.chunks != NULL &&
+        shared.pieces != NULL &&
+        threads != NULL;
+    
+    for (uint32_t i = 0; all_allocated && i < threads_size; i++) {
+        threads[i].shared = &shared;
+        threads[i].working_memory_size = inflate_working_memory_required();
+        threads[i].working_memory = (uint8_t *)malloc_funcptr(
+            threads[i].working_memory_size);
+        threads[i].context = inflate_context_create(
+            malloc_funcptr,
+            free_funcptr,
+            memset_funcptr,
+            memcpy_funcptr);
+        threads_made = i + 1;
+        
+        all_allocated =
+            threads[i].working_memory != NULL &&
+            threads[i].context != NULL;
+    }
+    
+    uint32_t parallel_good = 0;
+    if (all_allocated && chunks_size > 1) {
+        for (uint32_t i = 0; i < chunks_size; i++) {
+            shared.chunks[i].first_bit =
+                (uint64_t)i * INFLATE_PARALLEL_CHUNK_SIZE * 8;
+            shared.chunks[i].start_bit = 0;
+            shared.chunks[i].symbols = NULL;
+            shared.chunks[i].symbols_size = 0;
+            shared.chunks[i].good = 0;
+        }
+        
+        run_step(
+            /* threads: */ threads,
+            /* threads_size: */ threads_size,
+            /* step: */ INFLATE_PARALLEL_STEP_DECODE,
+            /* tasks_size: */ chunks_size,
+            /* malloc_funcptr: */ malloc_funcptr,
+            /* free_funcptr: */ free_funcptr);
+        
+        uint64_t output_size = 0;
+        parallel_good = stitch_chunks(threads + 0, &output_size);
+        
+        if (parallel_good && output_size > recipient_size) {
+            #ifndef INFLATE_SILENCE
+            printf(
+                "inflate_parallel() ERROR: the output needs %llu bytes, but "
+                "recipient_size is only %llu\n",
+                output_size,
+                recipient_size);
+            #endif
+            parallel_good = 0;
+        }
+        
+        /*
+        Each piece's window is the end of the pieces before it, so we fill in
+        the last 32KiB of every piece in order. After that, all the windows
+        are known and the rest of every piece can be done in parallel.
+        */
+        for (uint32_t i = 0; parallel_good && i < shared.pieces_size; i++) {
+            InflateParallelPiece * piece = shared.pieces + i;
+            uint64_t tail_from =
+                piece->symbols_size > INFLATE_PARALLEL_WINDOW_SIZE ?
+                    piece->symbols_size - INFLATE_PARALLEL_WINDOW_SIZE :
+                    0;
+            parallel_good = resolve_piece(
+                /* recipient: */ recipient,
+                /* piece: */ piece,
+                /* from: */ tail_from,
+                /* to: */ piece->symbols_size);
+        }
+        
+        if (parallel_good) {
+            run_step(
+                /* threads: */ threads,
+                /* threads_size: */ threads_size,
+                /* step: */ INFLATE_PARALLEL_STEP_RESOLVE,
+                /* tasks_size: */ shared.pieces_size,
+                /* malloc_funcptr: */ malloc_funcptr,
+                /* free_funcptr: */ free_funcptr);
+            
+            for (uint32_t i = 0; i < shared.pieces_size; i++) {
+                parallel_good = parallel_good && shared.pieces[i].good;
+            }
+        }
+        
+        if (parallel_good) {
+            *final_recipient_size = output_size;
+            *out_good = 1;
+        }
+        
+        for (uint32_t i = 0; i < chunks_size; i++) {
+            if (shared.chunks[i].symbols != NULL) {
+                free_funcptr(shared.chunks[i].symbols);
+            }
+        }
+        for (uint32_t i = 0; i < shared.pieces_size; i++) {
+            free_funcptr(shared.pieces[i].symbols);
+        }
+    }
+    
+    if (!parallel_good && all_allocated) {
+        #ifndef INFLATE_SILENCE
+        if (chunks_size > 1) {
+            printf("inflate_parallel() falling back to inflate()\n");
+        }
+        #endif
+        inflate(
+            /* context: */
+                threads[0].context,
+            /* recipient: */
+                recipient,
+            /* recipient_size: */
+                recipient_size,
+            /* final_recipient_size: */
+                final_recipient_size,
+            /* temp_working_memory: */
+                threads[0].working_memory,
+            /* temp_working_memory_size: */
+                threads[0].working_memory_size,
+            /* compressed_input: */
+                compressed_input,
+            /* compressed_input_size: */
+                compressed_input_size,
+            /* out_good: */
+                out_good);
+    }
+    
+    for (uint32_t i = 0; i < threads_made; i++) {
+        if (threads[i].working_memory != NULL) {
+            free_funcptr(threads[i].working_memory);
+        }
+        inflate_context_destroy(threads[i].context);
+    }
+    
+    if (threads != NULL) { free_funcptr(threads); }
+    if (shared.pieces != NULL) { free_funcptr(shared.pieces); }
+    if (shared.chunks != NULL) { free_funcptr(shared.chunks); }
+}
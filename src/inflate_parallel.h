@@ -0,0 +1,77 @@
+#ifndef INFLATE_PARALLEL_H
+#define INFLATE_PARALLEL_H
+
+/*
+Decompress 1 big DEFLATE stream on several threads
+
+DEFLATE was never meant to be decoded in parallel: you don't know where a
+block starts until you decoded the one before it, and every block can copy
+bytes from the 32KiB of output before it. We do it anyway, like pugz and
+rapidgzip:
+
+1. Split the compressed input into chunks. Each thread takes a chunk,
+   searches it for something that looks like the start of a block, and
+   decodes from there without knowing the output before it (see
+   inflate_speculative() in inflate.h). Bytes it can't know yet are written
+   as placeholders.
+2. Going through the chunks in order, we only keep a chunk if the chunk
+   before it ended exactly where it started. That proves the start was
+   real. Where that's not the case (a false start, or a chunk that only had
+   fixed blocks in it), we decode that part again on 1 thread.
+3. Now the output before each chunk is known, so the threads replace all the
+   placeholders with real bytes.
+
+Step 2 is cheap when the guesses were right, which they almost always are
+for real data, so this scales with your cores. It does need 2 bytes of
+memory per output byte while it runs. When anything goes wrong, we fall back
+to plain inflate(), so you'll get the same result (and the same errors).
+
+This file needs parallel_tasks.c and POSIX threads (link with -lpthread). If
+you don't have pthreads, #define PARALLEL_TASKS_SINGLE_THREADED and
+everything will run on the calling thread instead.
+*/
+
+/*
+How many bytes of compressed input each thread searches and decodes at once.
+Smaller chunks give more parallelism, but each one costs a search for a block
+start, and a 'catch up' on 1 thread when the search guessed wrong.
+*/
+#ifndef INFLATE_PARALLEL_CHUNK_SIZE
+#define INFLATE_PARALLEL_CHUNK_SIZE (4 * 1024 * 1024)
+#endif
+
+#include "inflate.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+The same as inflate(), but on up to threads_count threads (including the
+calling thread). Inputs smaller than 2 chunks are just passed to inflate().
+
+- threads_count: usually the amount of cores you have
+- compressed_input: raw DEFLATE data (without a zlib or gzip header)
+- recipient: the receiving memory to uncompress to
+- recipient_size: the capacity in bytes of recipient
+- final_recipient_size: will be set to the amount of bytes written
+- out_good: will be set to 1 on success, and 0 on failure
+*/
+void inflate_parallel(
+    const uint32_t threads_count,
+    void * (* malloc_funcptr)(uint64_t __size),
+    void (* free_funcptr)(void * to_free),
+    void * (* memset_funcptr)(void * str, int c, uint64_t n),
+    void * (* memcpy_funcptr)(void * dest, const void * src, uint64_t n),
+    uint8_t const * compressed_input,
+    const uint64_t compressed_input_size,
+    uint8_t * recipient,
+    const uint64_t recipient_size,
+    uint64_t * final_recipient_size,
+    uint32_t * out_good);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INFLATE_PARALLEL_H
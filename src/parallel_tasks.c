@@ -0,0 +1,118 @@
+#include "parallel_tasks.h"
+
+#ifndef NULL
+#define NULL 0
+#endif
+
+#ifndef PARALLEL_TASKS_SINGLE_THREADED
+#include <pthread.h>
+
+typedef struct ParallelTasksShared {
+    void (* run_task)(void * thread_data, const uint32_t task_i);
+    uint32_t tasks_size;
+    uint32_t next_task;
+    pthread_mutex_t mutex;
+} ParallelTasksShared;
+
+typedef struct ParallelTasksThread {
+    ParallelTasksShared * shared;
+    void * thread_data;
+    pthread_t thread;
+    uint32_t thread_started;
+} ParallelTasksThread;
+
+static void * parallel_tasks_thread(
+    void * thread_ptr)
+{
+    ParallelTasksThread * thread = (ParallelTasksThread *)thread_ptr;
+    ParallelTasksShared * shared = thread->shared;
+    
+    while (1) {
+        pthread_mutex_lock(&shared->mutex);
+        uint32_t task_i = shared->next_task;
+        if (task_i < shared->tasks_size) {
+            shared->next_task += 1;
+        }
+        pthread_mutex_unlock(&shared->mutex);
+        
+        if (task_i >= shared->tasks_size) {
+            break;
+        }
+        
+        shared->run_task(thread->thread_data, task_i);
+    }
+    
+    return NULL;
+}
+#endif
+
+void parallel_tasks_run(
+    void (* run_task)(void * thread_data, const uint32_t task_i),
+    void * threads_data,
+    const uint64_t thread_data_size,
+    const uint32_t threads_size,
+    const uint32_t tasks_size,
+    void * (* malloc_funcptr)(uint64_t __size),
+    void (* free_funcptr)(void * to_free))
+{
+    #ifndef PARALLEL_TASKS_SINGLE_THREADED
+    ParallelTasksShared shared;
+    shared.run_task = run_task;
+    shared.tasks_size = tasks_size;
+    shared.next_task = 0;
+    
+    /*
+    Without the memory or the mutex, the calling thread just runs every task
+    by itself. The same goes for the tasks of any thread that fails to start.
+    */
+    ParallelTasksThread * threads = NULL;
+    if (threads_size > 1 && tasks_size > 1) {
+        threads = (ParallelTasksThread *)malloc_funcptr(
+            sizeof(ParallelTasksThread) * threads_size);
+    }
+    
+    if (threads != NULL && pthread_mutex_init(&shared.mutex, NULL) != 0) {
+        free_funcptr(threads);
+        threads = NULL;
+    }
+    
+    if (threads != NULL) {
+        for (uint32_t i = 0; i < threads_size; i++) {
+            threads[i].shared = &shared;
+            threads[i].thread_data =
+                (uint8_t *)threads_data + thread_data_size * i;
+            threads[i].thread_started = 0;
+        }
+        
+        for (uint32_t i = 1; i < threads_size; i++) {
+            threads[i].thread_started =
+                pthread_create(
+                    &threads[i].thread,
+                    NULL,
+                    parallel_tasks_thread,
+                    threads + i) == 0;
+        }
+        
+        parallel_tasks_thread(threads + 0);
+        
+        for (uint32_t i = 1; i < threads_size; i++) {
+            if (threads[i].thread_started) {
+                pthread_join(threads[i].thread, NULL);
+            }
+        }
+        
+        pthread_mutex_destroy(&shared.mutex);
+        free_funcptr(threads);
+        return;
+    }
+    #else
+    (void)thread_data_size;
+    (void)threads_size;
+    (void)malloc_funcptr;
+    (void)free_funcptr;
+    #endif
+    
+    for (uint32_t i = 0; i < tasks_size; i++) {
+        run_task(threads_data, i);
+    }
+}
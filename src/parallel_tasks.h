@@ -0,0 +1,47 @@
+#ifndef PARALLEL_TASKS_H
+#define PARALLEL_TASKS_H
+
+/*
+Run a list of independent tasks on a few threads, for inflate_parallel.c and
+deflate_parallel.c. You don't need to call this yourself.
+
+This file needs POSIX threads (link with -lpthread). If you don't have them,
+#define PARALLEL_TASKS_SINGLE_THREADED and every task will run on the calling
+thread instead.
+*/
+
+// #define PARALLEL_TASKS_SINGLE_THREADED // don't use pthreads
+
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+Run run_task(thread_data, task_i) for every task_i from 0 to tasks_size - 1,
+on up to threads_size threads (including the calling thread), and return
+when all of them are done. Each thread takes the next task that nobody took
+yet, so 1 slow task doesn't hold up the rest.
+
+- threads_data: threads_size structs of thread_data_size bytes each, 1 per
+  thread, with whatever each thread needs for itself (a context, working
+  memory...). The calling thread uses the first one.
+
+If a thread (or the memory to keep track of them) can't be made, the threads
+we do have will just run more tasks, so this never fails.
+*/
+void parallel_tasks_run(
+    void (* run_task)(void * thread_data, const uint32_t task_i),
+    void * threads_data,
+    const uint64_t thread_data_size,
+    const uint32_t threads_size,
+    const uint32_t tasks_size,
+    void * (* malloc_funcptr)(uint64_t __size),
+    void (* free_funcptr)(void * to_free));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PARALLEL_TASKS_H